@@ -5,12 +5,11 @@ function (build_asm asm_path out_path)
     file(GLOB files ${asm_path})
     foreach(file ${files})
         get_filename_component(filename ${file} NAME_WE)
-        set(filename_bin "${filename}.bin")
+        set(filename_elf "${filename}.elf")
         set(filename_dump "${filename}.dump")
 
-        exec_program("riscv64-unknown-elf-gcc -Ttests/link.ld -Iriscv-tests/env/p -Iriscv-tests/isa/macros/scalar -nostdlib -ffreestanding -march=rv64g -mabi=lp64 -nostartfiles -O0 -o temp ${file}")
-        exec_program("riscv64-unknown-elf-objcopy -O binary temp ${out_path}/bin/${filename_bin}")
-        exec_program("riscv64-unknown-elf-objdump --disassemble-all temp > ${out_path}/dumped/${filename_dump}")
+        exec_program("riscv64-unknown-elf-gcc -Ttests/link.ld -Iriscv-tests/env/p -Iriscv-tests/isa/macros/scalar -nostdlib -ffreestanding -march=rv64g -mabi=lp64 -nostartfiles -O0 -o ${out_path}/bin/${filename_elf} ${file}")
+        exec_program("riscv64-unknown-elf-objdump --disassemble-all ${out_path}/bin/${filename_elf} > ${out_path}/dumped/${filename_dump}")
     endforeach()
 endfunction()
 
@@ -31,5 +30,3 @@ build_asm("riscv-tests/isa/rv64uc/*.S" "testbins/rv64uc")
 
 build_asm("riscv-tests/isa/rv64mi/*.S" "testbins/rv64mi")
 build_asm("riscv-tests/isa/rv64si/*.S" "testbins/rv64si")
-
-file(REMOVE temp)
@@ -2,36 +2,68 @@
 #include "clint.hpp"
 #include "cpu.hpp"
 #include "cpu_config.hpp"
+#include "elf.hpp"
+#include "fork_server.hpp"
 #include "gpu.hpp"
 #include "helper.hpp"
 #include "plic.hpp"
 #include "ram.hpp"
+#include "snapshot.hpp"
 #include "syscon.hpp"
 #include "virtio.hpp"
+#include "virtio_net.hpp"
 #include <algorithm>
 #include <array>
+#include <cstdio>
 #include <cstring>
 #include <filesystem>
 #include <fmt/core.h>
 #include <getopt.h>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <thread>
 #include <utility>
+#include <vector>
 
 void print_usage(char* argv[])
 {
     std::cerr << fmt::format(
         "Usage: {} [options]\n"
         "Options:\n"
-        "  -b, --bios Path to the BIOS file (mandatory)\n"
+        "  -b, --bios Path to the BIOS file, a raw binary or an ELF file (mandatory)\n"
 #if !NATIVE_CLI
         "  -f, --font Path to the font file (mandatory)\n"
 #endif
         "  -d, --dtb Path to the device tree blob file (optional, "
         "mandatory if kernel is present)\n"
-        "  -k, --kernel Path to the kernel file (optional)\n"
+        "  -k, --kernel Path to the kernel file, a raw binary or an ELF file (optional)\n"
         "  -m, --memory Emulator RAM buffer size in MiB (optional, default 64 MiB)\n"
-        "  -v, --virtual-drive Path to virtual disk image to use as a filesystem (optional)\n",
-        argv[0]);
+        "  -v, --virtual-drive Path to virtual disk image to use as a filesystem (optional)\n"
+        "  -D, --drive-mode What happens to writes to the virtual drive, discard, write-back or "
+        "read-only (optional, default discard, or write-back with an overlay)\n"
+        "  -o, --drive-overlay Path to an overlay the virtual drive's written blocks go to, "
+        "created if missing, the image itself is only read (optional)\n"
+        "  -j, --jit Compile hot code to native x86-64 code (optional)\n"
+        "  -H, --harts Number of harts, each runs on its own host thread, the dtb has to list "
+        "as many cpus (optional, default 1, at most {})\n"
+        "  -s, --save-snapshot Path to save a snapshot to when the guest writes 0x3333 to syscon "
+        "or the emulator gets SIGUSR1, not with a write-back drive (optional)\n"
+        "  -l, --load-snapshot Path to a snapshot to resume from instead of booting, it brings "
+        "its own memory size, harts and disk, whose files are opened again unless others are "
+        "given (optional)\n"
+        "  -i, --snapshot-interval Also save a snapshot every that many seconds, the ones after "
+        "the first only carry what changed (optional)\n"
+        "  -F, --fork-server Path of a Unix socket to serve forked copies of the machine on once "
+        "the guest writes 0x4444 to syscon, one per connection (optional)\n"
+        "  -n, --network Backend of a virtio_net device, user, socket:PATH to another emulator "
+        "or tap:NAME (optional)\n"
+        "  -M, --mac MAC address of the virtio_net device (optional, default "
+        "52:54:00:12:34:56)\n"
+        "  -h, --help Print this message\n",
+        argv[0], HARTS_MAX);
 }
 
 void error_exit(char* argv[], const std::string& error_message)
@@ -46,7 +78,7 @@ bool file_exists(const char* path)
     return std::filesystem::exists(path);
 }
 
-bool patch_dtb_ram_size(std::vector<uint8_t>& dtb_data, uint32_t ram_size)
+bool patch_dtb_ram_size(std::span<uint8_t> dtb_data, uint32_t ram_size)
 {
     static constexpr std::array<uint8_t, sizeof(uint32_t)> search_pattern = {0x0b, 0xad, 0xc0,
                                                                              0xde};
@@ -74,6 +106,16 @@ int main(int argc, char* argv[])
     const char* dtb_path = nullptr;
     const char* kernel_path = nullptr;
     const char* virt_drive_path = nullptr;
+    std::optional<disk::Mode> virt_drive_mode;
+    const char* virt_drive_overlay_path = nullptr;
+    const char* save_snapshot_path = nullptr;
+    const char* load_snapshot_path = nullptr;
+    uint64_t snapshot_interval = 0;
+    const char* fork_server_path = nullptr;
+    const char* network_spec = nullptr;
+    std::optional<std::array<uint8_t, 6>> network_mac;
+    bool use_jit = false;
+    uint64_t hart_count = 1;
 
     uint64_t ram_size = SIZE_MIB(64);
 
@@ -85,6 +127,17 @@ int main(int argc, char* argv[])
         {"kernel", required_argument, nullptr, 'k'},
         {"memory", required_argument, nullptr, 'm'},
         {"virtual-drive", required_argument, nullptr, 'v'},
+        {"drive-mode", required_argument, nullptr, 'D'},
+        {"drive-overlay", required_argument, nullptr, 'o'},
+        {"jit", no_argument, nullptr, 'j'},
+        {"harts", required_argument, nullptr, 'H'},
+        {"save-snapshot", required_argument, nullptr, 's'},
+        {"load-snapshot", required_argument, nullptr, 'l'},
+        {"snapshot-interval", required_argument, nullptr, 'i'},
+        {"fork-server", required_argument, nullptr, 'F'},
+        {"network", required_argument, nullptr, 'n'},
+        {"mac", required_argument, nullptr, 'M'},
+        {"help", no_argument, nullptr, 'h'},
         {}
     };
     // clang-format on
@@ -92,7 +145,8 @@ int main(int argc, char* argv[])
     int opt;
     int option_index = 0;
 
-    while ((opt = getopt_long(argc, argv, "b:f:d:k:m:v:", long_options, &option_index)) != -1)
+    while ((opt = getopt_long(argc, argv, "b:f:d:k:m:v:D:o:jH:s:l:i:F:n:M:h", long_options,
+                              &option_index)) != -1)
     {
         switch (opt)
         {
@@ -114,13 +168,70 @@ int main(int argc, char* argv[])
         case 'v':
             virt_drive_path = optarg;
             break;
+        case 'D':
+            if (std::string_view(optarg) == "discard")
+            {
+                virt_drive_mode = disk::Mode::discard;
+            }
+            else if (std::string_view(optarg) == "write-back")
+            {
+                virt_drive_mode = disk::Mode::write_back;
+            }
+            else if (std::string_view(optarg) == "read-only")
+            {
+                virt_drive_mode = disk::Mode::read_only;
+            }
+            else
+            {
+                error_exit(argv, "drive mode must be discard, write-back or read-only");
+            }
+            break;
+        case 'o':
+            virt_drive_overlay_path = optarg;
+            break;
+        case 'j':
+            use_jit = true;
+            break;
+        case 'H':
+            hart_count = atoi(optarg);
+            break;
+        case 's':
+            save_snapshot_path = optarg;
+            break;
+        case 'l':
+            load_snapshot_path = optarg;
+            break;
+        case 'i':
+            snapshot_interval = atoi(optarg);
+            break;
+        case 'F':
+            fork_server_path = optarg;
+            break;
+        case 'n':
+            network_spec = optarg;
+            break;
+        case 'M': {
+            std::array<uint8_t, 6> mac;
+
+            if (sscanf(optarg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3],
+                       &mac[4], &mac[5]) != 6)
+            {
+                error_exit(argv, "mac address must be six hex bytes separated by colons");
+            }
+
+            network_mac = mac;
+            break;
+        }
+        case 'h':
+            print_usage(argv);
+            exit(0);
         default:
             print_usage(argv);
             exit(1);
         }
     }
 
-    if (bios_path == nullptr
+    if ((bios_path == nullptr && load_snapshot_path == nullptr)
 #if !NATIVE_CLI
         || font_path == nullptr
 #endif
@@ -133,12 +244,58 @@ int main(int argc, char* argv[])
 #endif
     }
 
+    if (network_spec != nullptr && !net::is_supported(network_spec))
+    {
+        error_exit(argv, "the socket and TAP network backends are only supported on Linux");
+    }
+
+    // Every child would share the one socket peer or TAP interface
+    if (fork_server_path != nullptr && network_spec != nullptr &&
+        std::string_view(network_spec) != "user")
+    {
+        error_exit(argv, "the fork server only works with the user network backend");
+    }
+
+    std::optional<snapshot::Info> snapshot_info;
+
+    if (load_snapshot_path != nullptr)
+    {
+        snapshot_info = snapshot::read_info(load_snapshot_path);
+
+        if (!snapshot_info)
+        {
+            error_exit(argv, "load snapshot path is not a snapshot");
+        }
+
+        // The drive's files are opened again unless others are given, everything else comes
+        // from the snapshot
+        if (virt_drive_path != nullptr && !snapshot_info->has_virtio_blk)
+        {
+            error_exit(argv, "the snapshot has no virtual drive");
+        }
+
+        if (virt_drive_path == nullptr && (virt_drive_mode || virt_drive_overlay_path != nullptr))
+        {
+            error_exit(argv, "drive mode and overlay need the virtual drive with a snapshot");
+        }
+
+        bios_path = nullptr;
+        dtb_path = nullptr;
+        kernel_path = nullptr;
+        hart_count = snapshot_info->hart_count;
+    }
+
+    if (hart_count == 0 || hart_count > HARTS_MAX)
+    {
+        error_exit(argv, fmt::format("hart count must be between 1 and {}", HARTS_MAX));
+    }
+
     if (kernel_path != nullptr && dtb_path == nullptr)
     {
         error_exit(argv, "dtb path must be provided when kernel path is provided");
     }
 
-    if (!file_exists(bios_path))
+    if (bios_path != nullptr && !file_exists(bios_path))
     {
         error_exit(argv, "bios path invalid");
     }
@@ -157,6 +314,11 @@ int main(int argc, char* argv[])
         ram_size_total += SIZE_MIB(2);
     }
 
+    if (snapshot_info)
+    {
+        ram_size_total = snapshot_info->ram_size;
+    }
+
     virtio::VirtioBlkDevice* virtio_device = nullptr;
 
     if (virt_drive_path)
@@ -166,15 +328,105 @@ int main(int argc, char* argv[])
             error_exit(argv, "virt_drive path invalid");
         }
 
-        std::vector<uint8_t> virt_drive = helper::load_file(virt_drive_path);
-        virtio_device = new virtio::VirtioBlkDevice(std::move(virt_drive));
+        virtio_device = new virtio::VirtioBlkDevice();
+
+        // An overlay is there to take the writes
+        disk::Mode mode = virt_drive_mode.value_or(
+            virt_drive_overlay_path != nullptr ? disk::Mode::write_back : disk::Mode::discard);
+
+        if (!virtio_device->open_disk(virt_drive_path, mode, virt_drive_overlay_path))
+        {
+            error_exit(argv, "virt_drive could not be opened");
+        }
+    }
+    else if (snapshot_info && snapshot_info->has_virtio_blk)
+    {
+        virtio_device = new virtio::VirtioBlkDevice();
+    }
+
+    virtio::VirtioNetDevice* virtio_net_device = nullptr;
+
+    // A restored guest keeps its card, the backend is up to this run
+    if (network_spec != nullptr || (snapshot_info && snapshot_info->has_virtio_net))
+    {
+        virtio_net_device = new virtio::VirtioNetDevice();
+
+        if (network_mac)
+        {
+            virtio_net_device->set_mac(*network_mac);
+        }
+    }
+
+    if (network_spec != nullptr)
+    {
+        std::unique_ptr<net::Backend> backend = net::open(network_spec);
+
+        if (backend == nullptr)
+        {
+            error_exit(argv, "network backend could not be opened");
+        }
+
+        virtio_net_device->set_backend(std::move(backend));
+    }
+
+    RamDevice dram = RamDevice(DRAM_BASE, ram_size_total);
+
+    elf::SymbolTable symbols;
+    uint64_t entry = dram.get_base_address();
+
+    if (bios_path != nullptr && elf::is_elf(bios_path))
+    {
+        std::optional<elf::Image> image = elf::load(bios_path, dram, 0);
+
+        if (!image)
+        {
+            error_exit(argv, "bios is not a RISC-V ELF64 file or does not fit in memory");
+        }
+
+        entry = image->entry;
+        symbols.add(image->symbols);
+    }
+    else if (bios_path != nullptr && !dram.load_file(bios_path, 0))
+    {
+        error_exit(argv, "bios does not fit in memory");
     }
 
-    RamDevice dram = RamDevice(DRAM_BASE, ram_size_total, helper::load_file(bios_path));
     gpu::GpuDevice gpu = gpu::GpuDevice("RISC V emulator", font_path, 960, 540);
     SysconDevice syscon = SysconDevice();
 
-    Cpu cpu = Cpu(&dram, &gpu, virtio_device, &syscon);
+    Cpu cpu = Cpu(&dram, &gpu, virtio_device, &syscon, virtio_net_device);
+    cpu.symbols = &symbols;
+
+    std::vector<std::unique_ptr<Cpu>> harts;
+
+    for (uint64_t hart_id = 1; hart_id < hart_count; hart_id++)
+    {
+        harts.push_back(std::make_unique<Cpu>(cpu, hart_id));
+        harts.back()->regs[Cpu::reg_abi_name::a0] = hart_id;
+    }
+
+    cpu.pc = entry;
+
+    for (auto& hart : harts)
+    {
+        hart->pc = entry;
+    }
+
+    if (use_jit)
+    {
+        bool jit_supported = cpu.jit.init();
+
+        for (auto& hart : harts)
+        {
+            jit_supported = jit_supported && hart->jit.init();
+        }
+
+        if (!jit_supported)
+        {
+            std::cout
+                << "Warning: JIT is not supported on this host, falling back to the interpreter\n";
+        }
+    }
 
     if (dtb_path)
     {
@@ -183,18 +435,27 @@ int main(int argc, char* argv[])
             error_exit(argv, "dtb path invalid");
         }
 
-        std::vector<uint8_t> dtb = helper::load_file(dtb_path);
         uint64_t dtb_offset = dram.data.size() - SIZE_MIB(2);
+        std::optional<uint64_t> dtb_size = dram.load_file(dtb_path, dtb_offset);
+
+        if (!dtb_size)
+        {
+            error_exit(argv, "dtb does not fit in its 2 MiB");
+        }
+
         cpu.regs[Cpu::reg_abi_name::a1] = dram.get_base_address() + dtb_offset;
 
-        if (!patch_dtb_ram_size(dtb, ram_size))
+        for (auto& hart : harts)
+        {
+            hart->regs[Cpu::reg_abi_name::a1] = cpu.regs[Cpu::reg_abi_name::a1];
+        }
+
+        if (!patch_dtb_ram_size(dram.data.subspan(dtb_offset, *dtb_size), ram_size))
         {
             std::cout << "Warning: couldn't find dtb memory size magic value "
                          "(0x0badc0de), make sure that the memory the emulator allocates is equal "
                          "or greater than one specified in the dtb\n";
         }
-
-        memcpy(dram.data.data() + dtb_offset, dtb.data(), dtb.size());
     }
 
     if (kernel_path)
@@ -204,8 +465,66 @@ int main(int argc, char* argv[])
             error_exit(argv, "kernel path invalid");
         }
 
-        std::vector<uint8_t> kernel = helper::load_file(kernel_path);
-        memcpy(dram.data.data() + KERNEL_OFFSET, kernel.data(), kernel.size());
+        if (elf::is_elf(kernel_path))
+        {
+            // The bios jumps to KERNEL_OFFSET, so the kernel's own entry point is not used
+            std::optional<elf::Image> image = elf::load(kernel_path, dram, KERNEL_OFFSET);
+
+            if (!image)
+            {
+                error_exit(argv, "kernel is not a RISC-V ELF64 file or does not fit in memory");
+            }
+
+            symbols.add(image->symbols);
+        }
+        else if (!dram.load_file(kernel_path, KERNEL_OFFSET))
+        {
+            error_exit(argv, "kernel does not fit in memory");
+        }
+    }
+
+    std::vector<Cpu*> machine = {&cpu};
+
+    for (auto& hart : harts)
+    {
+        machine.push_back(hart.get());
+    }
+
+    if (load_snapshot_path != nullptr && !snapshot::restore(load_snapshot_path, machine))
+    {
+        error_exit(argv, "snapshot or the files of its virtual drive could not be opened");
+    }
+
+    // Writes after a snapshot would change the files it is restored from
+    if (save_snapshot_path != nullptr && virtio_device != nullptr &&
+        virtio_device->disk.write_back())
+    {
+        error_exit(argv, "snapshots need the virtual drive in discard or read-only mode");
+    }
+
+    if (save_snapshot_path != nullptr)
+    {
+        snapshot::enable(save_snapshot_path, machine, snapshot_interval);
+    }
+
+    if (fork_server_path != nullptr)
+    {
+#if !NATIVE_CLI
+        error_exit(argv, "fork server needs the native CLI build");
+#endif
+
+        if (!fork_server::enable(fork_server_path, machine))
+        {
+            error_exit(argv, "fork server socket could not be created");
+        }
+    }
+
+    // The boot hart stays on the main thread, that is where the display has to be driven from
+    std::vector<std::thread> hart_threads;
+
+    for (auto& hart : harts)
+    {
+        hart_threads.emplace_back([&hart] { hart->run(); });
     }
 
     cpu.run();
@@ -0,0 +1,119 @@
+#include "block.hpp"
+#include "cpu.hpp"
+
+namespace block
+{
+
+Block* BlockCache::get(Cpu& cpu, uint64_t p_address)
+{
+    if (generation != cpu.icache.generation) [[unlikely]]
+    {
+        flush();
+        generation = cpu.icache.generation;
+    }
+
+    Block* block = nullptr;
+
+    if (previous != nullptr)
+    {
+        for (Block* successor : previous->successors)
+        {
+            if (successor != nullptr && successor->p_address == p_address)
+            {
+                block = successor;
+                break;
+            }
+        }
+    }
+
+    if (block == nullptr)
+    {
+        block = find(cpu, p_address);
+
+        if (block == nullptr) [[unlikely]]
+        {
+            return previous = nullptr;
+        }
+
+        if (previous != nullptr)
+        {
+            previous->successors[previous->next_successor] = block;
+            previous->next_successor = (previous->next_successor + 1) % max_successors;
+        }
+    }
+
+    return previous = block;
+}
+
+void BlockCache::flush()
+{
+    blocks.clear();
+    previous = nullptr;
+}
+
+Block* BlockCache::find(Cpu& cpu, uint64_t p_address)
+{
+    auto it = blocks.find(p_address);
+
+    if (it != blocks.end()) [[likely]]
+    {
+        return it->second.get();
+    }
+
+    return build(cpu, p_address);
+}
+
+Block* BlockCache::build(Cpu& cpu, uint64_t p_address)
+{
+    auto block = std::make_unique<Block>();
+    block->p_address = p_address;
+
+    uint64_t p = p_address;
+
+    while (block->insns.size() < max_block_insns)
+    {
+        icache::CachedInsn* cached = cpu.icache.get(p);
+
+        if (cached == nullptr)
+        {
+            break;
+        }
+
+        if (cached->handler == nullptr)
+        {
+            uint32_t insn = cpu.mmu.fetch_physical(p);
+
+            // Faults are raised once execution actually reaches the instruction
+            if (cpu.exc_val != exception::Exception::None) [[unlikely]]
+            {
+                cpu.clear_exception();
+                break;
+            }
+
+            *cached = cpu.decode(insn);
+        }
+
+        block->insns.push_back(*cached);
+
+        p += cached->size;
+
+        // The block is entered through a single translation, so it cannot leave the page
+        if (cached->ends_block || p % icache::page_size == 0)
+        {
+            break;
+        }
+    }
+
+    if (block->insns.empty()) [[unlikely]]
+    {
+        return nullptr;
+    }
+
+    Block* ret = block.get();
+
+    blocks.emplace(p_address, std::move(block));
+
+    return ret;
+}
+
+} // namespace block
@@ -2,6 +2,7 @@
 #include "clint.hpp"
 #include "cpu.hpp"
 #include "gpu.hpp"
+#include "plic.hpp"
 #include "virtio.hpp"
 #include <algorithm>
 #include <fmt/core.h>
@@ -9,6 +10,29 @@
 void Bus::add_device(BusDevice* bus_device)
 {
     bus_devices.push_back(bus_device);
+
+    uint64_t base = bus_device->get_base_address();
+    uint64_t end = bus_device->get_end_address();
+
+    if (base >= end)
+    {
+        return;
+    }
+
+    auto position = std::upper_bound(regions.begin(), regions.end(), base, Region::is_before);
+
+    regions.insert(position, {base, end, bus_device});
+    last_region = nullptr;
+}
+
+void Bus::share_devices(Bus& boot_bus)
+{
+    bus_devices = boot_bus.bus_devices;
+    regions = boot_bus.regions;
+    last_region = nullptr;
+    shared = boot_bus.shared;
+
+    shared->smp = true;
 }
 
 uint64_t Bus::load(Cpu& cpu, uint64_t address, uint64_t length)
@@ -17,6 +41,10 @@ uint64_t Bus::load(Cpu& cpu, uint64_t address, uint64_t length)
 
     if (bus_device != nullptr)
     {
+        // Harts race on memory just like on hardware
+        std::unique_lock<std::mutex> lock =
+            bus_device != cpu.dram_device ? lock_devices() : std::unique_lock<std::mutex>();
+
         return bus_device->load(*this, address, length);
     }
     else
@@ -32,6 +60,10 @@ void Bus::store(Cpu& cpu, uint64_t address, uint64_t value, uint64_t length)
 
     if (bus_device != nullptr)
     {
+        std::unique_lock<std::mutex> lock =
+            bus_device != cpu.dram_device ? lock_devices() : std::unique_lock<std::mutex>();
+
+        cpu.icache.invalidate(address, length);
         bus_device->store(*this, address, value, length);
     }
     else
@@ -42,32 +74,90 @@ void Bus::store(Cpu& cpu, uint64_t address, uint64_t value, uint64_t length)
 
 BusDevice* Bus::find_bus_device(uint64_t address) const
 {
-    auto devices = bus_devices.data();
+    // Accesses mostly go to the device the last one went to, RAM above all
+    if (last_region != nullptr && last_region->contains(address)) [[likely]]
+    {
+        return last_region->device;
+    }
+
+    // The only candidate is the last region starting at or below the address
+    auto next = std::upper_bound(regions.begin(), regions.end(), address, Region::is_before);
 
-    for (size_t i = 0; i < bus_devices.size(); i++)
+    if (next == regions.begin())
     {
-        BusDevice* device = devices[i];
+        return nullptr;
+    }
+
+    const Region& region = *(next - 1);
 
-        if (address >= device->get_base_address() && address < device->get_end_address())
-        {
-            return device;
-        }
+    if (address >= region.end)
+    {
+        return nullptr;
     }
 
-    return nullptr;
+    last_region = &region;
+
+    return region.device;
 }
 
 void Bus::tick_devices(Cpu& cpu)
 {
-#if !CPU_TEST
-    cpu.gpu_device->tick(cpu);
-    cpu.clint_device.tick(cpu);
+    if (scheduler.due(cpu.cregs.load(csr::Address::CYCLE))) [[unlikely]]
+    {
+        std::unique_lock<std::mutex> lock = lock_devices();
 
-    if (cpu.virtio_blk_device != nullptr)
+        scheduler.run(cpu);
+    }
+}
+
+void Bus::set_irq_line(uint32_t irqn, bool level)
+{
+    uint64_t line = 1ULL << irqn;
+    uint64_t old_lines = level ? shared->irq_lines.fetch_or(line, std::memory_order_relaxed)
+                               : shared->irq_lines.fetch_and(~line, std::memory_order_relaxed);
+
+    if (level && (old_lines & line) == 0 && shared->plic != nullptr)
     {
-        cpu.virtio_blk_device->tick(cpu);
+        shared->plic->update_pending(*this, irqn);
     }
-#endif
+}
+
+uint64_t Bus::get_irq_lines() const
+{
+    return shared->irq_lines.load(std::memory_order_relaxed);
+}
+
+void Bus::restore_irq_lines(uint64_t lines)
+{
+    shared->irq_lines.store(lines, std::memory_order_relaxed);
+}
+
+void Bus::set_interrupt_controller(PlicDevice* plic)
+{
+    shared->plic = plic;
+}
+
+void Bus::add_hart(uint64_t hart_id, std::atomic<bool>& interrupts_dirty)
+{
+    shared->harts[hart_id] = &interrupts_dirty;
+}
+
+void Bus::notify_hart(uint64_t hart_id)
+{
+    if (hart_id < shared->harts.size() && shared->harts[hart_id] != nullptr)
+    {
+        shared->harts[hart_id]->store(true, std::memory_order_relaxed);
+    }
+}
+
+std::unique_lock<std::mutex> Bus::lock_devices()
+{
+    if (!shared->smp) [[likely]]
+    {
+        return {};
+    }
+
+    return std::unique_lock<std::mutex>(shared->device_lock);
 }
 
 std::span<BusDevice*> Bus::get_device_list()
@@ -79,7 +169,10 @@ void BusDevice::tick([[maybe_unused]] Cpu& cpu)
 {
 }
 
-std::optional<uint32_t> BusDevice::is_interrupting()
+void BusDevice::save([[maybe_unused]] snapshot::Writer& writer)
+{
+}
+
+void BusDevice::restore([[maybe_unused]] snapshot::Reader& reader)
 {
-    return {};
 }
\ No newline at end of file
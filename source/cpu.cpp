@@ -6,8 +6,10 @@
 #include "ctypeinsn.hpp"
 #include "decoder.hpp"
 #include "fdtypeinsn.hpp"
+#include "fork_server.hpp"
 #include "gpu.hpp"
 #include "i64insn.hpp"
+#include "insntable.hpp"
 #include "itypeinsn.hpp"
 #include "loadinsn.hpp"
 #include "otherinsn.hpp"
@@ -16,6 +18,7 @@
 #include "r64insn.hpp"
 #include "ram.hpp"
 #include "rtypeinsn.hpp"
+#include "snapshot.hpp"
 #include "stypeinsn.hpp"
 #include <array>
 #include <fmt/core.h>
@@ -25,8 +28,10 @@
 #include <utility>
 
 Cpu::Cpu(RamDevice* dram_device, gpu::GpuDevice* gpu_device,
-         virtio::VirtioBlkDevice* virtio_blk_device, SysconDevice* syscon_device)
-    : mmu(*this)
+         virtio::VirtioBlkDevice* virtio_blk_device, SysconDevice* syscon_device,
+         virtio::VirtioNetDevice* virtio_net_device)
+    : mmu(*this), own_plic_device(std::make_unique<PlicDevice>()),
+      own_clint_device(std::make_unique<ClintDevice>())
 {
     mode = cpu::Mode::Machine;
 
@@ -42,8 +47,8 @@ Cpu::Cpu(RamDevice* dram_device, gpu::GpuDevice* gpu_device,
     }
 #endif
 
-    bus.add_device(&plic_device);
-    bus.add_device(&clint_device);
+    bus.add_device(own_plic_device.get());
+    bus.add_device(own_clint_device.get());
 
 #if NATIVE_CLI
     if (gpu_device != nullptr)
@@ -62,14 +67,67 @@ Cpu::Cpu(RamDevice* dram_device, gpu::GpuDevice* gpu_device,
         bus.add_device(syscon_device);
     }
 
+    if (virtio_net_device != nullptr)
+    {
+        bus.add_device(virtio_net_device);
+    }
+
+    bus.set_interrupt_controller(own_plic_device.get());
+    bus.add_hart(hart_id, cregs.interrupts_dirty);
+
+    this->plic_device = own_plic_device.get();
+    this->clint_device = own_clint_device.get();
     this->dram_device = dram_device;
     this->gpu_device = gpu_device;
     this->virtio_blk_device = virtio_blk_device;
     this->syscon_device = syscon_device;
+    this->virtio_net_device = virtio_net_device;
+
+#if !CPU_TEST
+    // Both poll the host, they reschedule themselves from then on
+    if (gpu_device != nullptr)
+    {
+        bus.scheduler.schedule(gpu_device, 0);
+    }
+
+    bus.scheduler.schedule(clint_device, 0);
+#endif
+
+    icache.init(dram_device->get_base_address(), dram_device->get_end_address());
 
     csr::init_handler_array();
 }
 
+Cpu::Cpu(Cpu& boot_hart, uint64_t hart_id) : mmu(*this)
+{
+    mode = cpu::Mode::Machine;
+    this->hart_id = hart_id;
+
+    pc = boot_hart.dram_device->get_base_address();
+    regs[reg_abi_name::sp] = boot_hart.dram_device->get_end_address();
+
+    bus.share_devices(boot_hart.bus);
+    bus.add_hart(hart_id, cregs.interrupts_dirty);
+
+    plic_device = boot_hart.plic_device;
+    clint_device = boot_hart.clint_device;
+    dram_device = boot_hart.dram_device;
+    gpu_device = boot_hart.gpu_device;
+    virtio_blk_device = boot_hart.virtio_blk_device;
+    syscon_device = boot_hart.syscon_device;
+    virtio_net_device = boot_hart.virtio_net_device;
+    symbols = boot_hart.symbols;
+
+#if !CPU_TEST
+    // The boot hart polls the host input, every hart polls its own timer
+    bus.scheduler.schedule(clint_device, 0);
+#endif
+
+    cregs.store(csr::Address::MHARTID, hart_id);
+
+    icache.init(dram_device->get_base_address(), dram_device->get_end_address());
+}
+
 void Cpu::dump_registers(std::ostream& stream)
 {
     stream << "Registers:\n\n";
@@ -87,12 +145,50 @@ void Cpu::dump_registers(std::ostream& stream)
                               fregs[i].get_u64());
     }
 
-    stream << fmt::format("pc: 0x{:0>8x}\n", pc);
+    std::string pc_symbol = symbols != nullptr ? symbols->describe(pc) : "";
+
+    if (!pc_symbol.empty())
+    {
+        stream << fmt::format("pc: 0x{:0>8x} <{}>\n", pc, pc_symbol);
+    }
+    else
+    {
+        stream << fmt::format("pc: 0x{:0>8x}\n", pc);
+    }
     stream << fmt::format("wfi: {}\n", sleep);
 
     stream << "\n\n";
 }
 
+void Cpu::save(snapshot::Writer& writer) const
+{
+    writer.put(regs);
+    writer.put(fregs);
+    writer.put(cregs.regs);
+    writer.put(pc);
+    writer.put(mode);
+    writer.put(sleep);
+}
+
+void Cpu::restore(snapshot::Reader& reader)
+{
+    reader.get(regs);
+    reader.get(fregs);
+    reader.get(cregs.regs);
+    reader.get(pc);
+    reader.get(mode);
+    reader.get(sleep);
+
+    exc_val = exception::Exception::None;
+    reservation.reset();
+    cregs.interrupts_dirty.store(true, std::memory_order_relaxed);
+
+    // The paging mode follows from satp
+    mmu.update();
+    mmu.flush_tlb();
+    icache.flush();
+}
+
 void Cpu::dump_bus_devices(std::ostream& stream)
 {
     for (auto device : bus.get_device_list())
@@ -110,7 +206,17 @@ void Cpu::run()
 {
     while (true)
     {
-        loop(std::cout);
+        block_loop(std::cout);
+
+        if (snapshot::requested()) [[unlikely]]
+        {
+            snapshot::stop(*this);
+        }
+
+        if (fork_server::requested()) [[unlikely]]
+        {
+            fork_server::stop(*this);
+        }
     }
 }
 
@@ -120,6 +226,235 @@ void Cpu::loop(std::ostream& debug_stream)
 
     bus.tick_devices(*this);
 
+    process_interrupts(debug_stream);
+
+    uint32_t insn_size = _loop(debug_stream);
+
+    if (exc_val != exception::Exception::None) [[unlikely]]
+    {
+        process_exception(debug_stream);
+
+        return;
+    }
+
+    // previous_pc = pc;
+    pc += insn_size;
+}
+
+void Cpu::block_loop(std::ostream& debug_stream)
+{
+    bus.tick_devices(*this);
+
+    process_interrupts(debug_stream);
+
+    regs[reg_abi_name::zero] = 0;
+
+    if (sleep) [[unlikely]]
+    {
+        cregs.store(csr::Address::CYCLE, cregs.load(csr::Address::CYCLE) + 1);
+        return;
+    }
+
+    uint64_t p_pc = mmu.translate(pc, mmu::Mmu::AccessType::Instruction);
+
+    block::Block* block = nullptr;
+
+    if (exc_val == exception::Exception::None) [[likely]]
+    {
+        // Compiled code for dropped blocks is unreachable from here on
+        if (jit.enabled && blocks.generation != icache.generation) [[unlikely]]
+        {
+            jit.flush();
+        }
+
+        block = blocks.get(*this, p_pc);
+    }
+
+    if (block == nullptr) [[unlikely]]
+    {
+        cregs.store(csr::Address::CYCLE, cregs.load(csr::Address::CYCLE) + 1);
+
+        uint32_t insn_size = exc_val == exception::Exception::None ? _loop(debug_stream) : 0;
+
+        if (exc_val != exception::Exception::None) [[unlikely]]
+        {
+            process_exception(debug_stream);
+
+            return;
+        }
+
+        pc += insn_size;
+
+        return;
+    }
+
+    if (jit.enabled)
+    {
+        if (block->compiled == nullptr && ++block->executions >= jit.hot_threshold) [[unlikely]]
+        {
+            block->compiled = jit.compile(*this, *block);
+
+            // Out of code space, start over with an empty cache
+            if (block->compiled == nullptr) [[unlikely]]
+            {
+                jit.flush();
+                blocks.flush();
+
+                return;
+            }
+        }
+
+        if (block->compiled != nullptr)
+        {
+            execute_compiled_block(*block, debug_stream);
+
+            return;
+        }
+    }
+
+    execute_block(*block, debug_stream);
+}
+
+static inline void trace_insn(std::ostream& debug_stream, uint64_t pc, uint32_t insn)
+{
+#if CPU_TEST
+    debug_stream << fmt::format("pc: 0x{:0>8x}\n", pc);
+    Decoder(insn).dump(debug_stream);
+    debug_stream << "\n\n" << std::flush;
+#endif
+}
+
+// Labels as values let every handler jump straight to the next one instead of going back
+// through a single shared dispatch branch
+#if defined(__GNUC__)
+#define THREADED_DISPATCH 1
+#else
+#define THREADED_DISPATCH 0
+#endif
+
+void Cpu::execute_block(block::Block& block, std::ostream& debug_stream)
+{
+    // Charged upfront so that a CSR read at the end of the block sees the right count
+    uint64_t cycle = cregs.load(csr::Address::CYCLE);
+    cregs.store(csr::Address::CYCLE, cycle + block.insns.size());
+
+    uint64_t generation = icache.generation;
+    const icache::CachedInsn* insn = block.insns.data();
+    const icache::CachedInsn* end = insn + block.insns.size();
+
+    // Handlers are called directly, the flags are constants, so instructions that cannot
+    // trap skip the exception and self modifying code checks
+#define EXECUTE_INSN(name, mask, match, handler, flags)                                            \
+    EXECUTE_CASE(name)                                                                             \
+    handler(*this, Decoder(insn->insn));                                                           \
+                                                                                                   \
+    if constexpr ((insntable::flags & insntable::MAY_TRAP) != 0)                                   \
+    {                                                                                              \
+        if (exc_val != exception::Exception::None) [[unlikely]]                                    \
+        {                                                                                          \
+            goto exception;                                                                        \
+        }                                                                                          \
+    }                                                                                              \
+                                                                                                   \
+    pc += insn->size;                                                                              \
+                                                                                                   \
+    if constexpr ((insntable::flags & insntable::MAY_TRAP) != 0)                                   \
+    {                                                                                              \
+        if (icache.generation != generation) [[unlikely]]                                          \
+        {                                                                                          \
+            goto stale;                                                                            \
+        }                                                                                          \
+    }                                                                                              \
+                                                                                                   \
+    EXECUTE_NEXT();
+
+#if THREADED_DISPATCH
+#define EXECUTE_LABEL(name, mask, match, handler, flags) &&execute_##name,
+    static void* const labels[] = {RV64GC_INSTRUCTIONS(EXECUTE_LABEL) &&execute_ILLEGAL};
+#undef EXECUTE_LABEL
+
+#define EXECUTE_CASE(name) execute_##name:
+#define EXECUTE_DISPATCH()                                                                         \
+    regs[reg_abi_name::zero] = 0;                                                                  \
+    trace_insn(debug_stream, pc, insn->insn);                                                      \
+    goto* labels[static_cast<uint16_t>(insn->id)]
+#define EXECUTE_NEXT()                                                                             \
+    if (++insn == end) [[unlikely]]                                                                \
+    {                                                                                              \
+        return;                                                                                    \
+    }                                                                                              \
+    EXECUTE_DISPATCH()
+
+    EXECUTE_DISPATCH();
+
+    RV64GC_INSTRUCTIONS(EXECUTE_INSN)
+    EXECUTE_INSN(ILLEGAL, 0, 0, insntable::illegal, CTRL)
+#else
+#define EXECUTE_CASE(name) case insntable::InsnId::name:
+#define EXECUTE_NEXT()                                                                             \
+    insn++;                                                                                        \
+    continue
+
+    while (insn != end)
+    {
+        regs[reg_abi_name::zero] = 0;
+        trace_insn(debug_stream, pc, insn->insn);
+
+        switch (insn->id)
+        {
+            RV64GC_INSTRUCTIONS(EXECUTE_INSN)
+            EXECUTE_INSN(ILLEGAL, 0, 0, insntable::illegal, CTRL)
+        }
+    }
+
+    return;
+#endif
+
+#undef EXECUTE_INSN
+#undef EXECUTE_CASE
+#undef EXECUTE_DISPATCH
+#undef EXECUTE_NEXT
+
+exception:
+    cregs.store(csr::Address::CYCLE, cycle + (insn - block.insns.data()) + 1);
+
+    process_exception(debug_stream);
+
+    return;
+
+stale:
+    // The block stored to a page that holds cached code, the rest of it may be stale
+    cregs.store(csr::Address::CYCLE, cycle + (insn - block.insns.data()) + 1);
+}
+
+void Cpu::execute_compiled_block(block::Block& block, std::ostream& debug_stream)
+{
+    uint64_t cycle = cregs.load(csr::Address::CYCLE);
+    cregs.store(csr::Address::CYCLE, cycle + block.insns.size());
+
+    uint64_t executed = block.compiled(*this);
+
+    if (executed != block.insns.size()) [[unlikely]]
+    {
+        cregs.store(csr::Address::CYCLE, cycle + executed);
+    }
+
+    if (exc_val != exception::Exception::None) [[unlikely]]
+    {
+        process_exception(debug_stream);
+    }
+}
+
+void Cpu::process_interrupts(std::ostream& debug_stream)
+{
+    if (!cregs.interrupts_dirty.load(std::memory_order_relaxed)) [[likely]]
+    {
+        return;
+    }
+
+    // Cleared before looking, so a device that raises an interrupt meanwhile is not missed
+    cregs.interrupts_dirty.store(false, std::memory_order_relaxed);
+
     interrupt::Interrupt::InterruptValue pending_interrupt =
         interrupt::get_pending_interrupt(*this);
 
@@ -134,28 +469,25 @@ void Cpu::loop(std::ostream& debug_stream)
         interrupt::process(*this, pending_interrupt);
     }
 
-    uint32_t insn_size = _loop(debug_stream);
+    if (interrupt::may_be_pending(*this))
+    {
+        cregs.interrupts_dirty.store(true, std::memory_order_relaxed);
+    }
+}
 
-    if (exc_val != exception::Exception::None) [[unlikely]]
+void Cpu::process_exception(std::ostream& debug_stream)
+{
+    if constexpr (CPU_VERBOSE_DEBUG)
     {
-        if constexpr (CPU_VERBOSE_DEBUG)
-        {
-            debug_stream << fmt::format(
-                "Exception: {} with data 0x{:0>8x}, happened at pc=0x{:0>8x}\n",
-                exception::Exception::get_exception_str(exc_val), exc_data, pc);
-        }
+        debug_stream << fmt::format("Exception: {} with data 0x{:0>8x}, happened at pc=0x{:0>8x}\n",
+                                    exception::Exception::get_exception_str(exc_val), exc_data, pc);
+    }
 
-        exception::process(*this);
+    exception::process(*this);
 
 #if !CPU_TEST
-        clear_exception();
+    clear_exception();
 #endif
-
-        return;
-    }
-
-    // previous_pc = pc;
-    pc += insn_size;
 }
 
 void Cpu::set_exception(exception::Exception::ExceptionValue value, uint64_t exc_data)
@@ -179,129 +511,48 @@ uint32_t Cpu::_loop(std::ostream& debug_stream)
         return 0;
     }
 
-    uint32_t insn = mmu.fetch(pc);
+    uint64_t p_pc = mmu.translate(pc, mmu::Mmu::AccessType::Instruction);
 
     if (exc_val != exception::Exception::None) [[unlikely]]
     {
         return 4;
     }
 
-    Decoder decoder = Decoder(insn);
+    icache::CachedInsn uncached = {};
+    icache::CachedInsn* cached = icache.get(p_pc);
 
-#if CPU_TEST
-    debug_stream << fmt::format("pc: 0x{:0>8x}\n", pc);
-    decoder.dump(debug_stream);
-    debug_stream << "\n\n" << std::flush;
-#endif
-
-    if (insn == 0) [[unlikely]]
+    if (cached == nullptr) [[unlikely]]
     {
-        set_exception(exception::Exception::IllegalInstruction, insn);
-        return 4;
+        cached = &uncached;
     }
 
-    uint32_t insn_size = decoder.insn_size();
-
-    if (insn_size == 2)
+    if (cached->handler == nullptr) [[unlikely]]
     {
-        execute16(decoder);
-    }
-    else
-    {
-        execute32(decoder);
-    }
+        uint32_t insn = mmu.fetch_physical(p_pc);
 
-    return insn_size;
-}
+        if (exc_val != exception::Exception::None) [[unlikely]]
+        {
+            return 4;
+        }
 
-void Cpu::execute16(Decoder decoder)
-{
-    switch (static_cast<OpcodeType>(decoder.compressed_opcode()))
-    {
-    case OpcodeType::COMPRESSED_QUANDRANT0:
-        ctype::quadrant0(*this, decoder);
-        break;
-    case OpcodeType::COMPRESSED_QUANDRANT1:
-        ctype::quadrant1(*this, decoder);
-        break;
-    case OpcodeType::COMPRESSED_QUANDRANT2:
-        ctype::quadrant2(*this, decoder);
-        break;
-    default:
-        set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
+        *cached = decode(insn);
     }
+
+    // The handler may store to the page it was fetched from, which drops the cached page
+    icache::CachedInsn insn = *cached;
+
+    trace_insn(debug_stream, pc, insn.insn);
+
+    insn.handler(*this, Decoder(insn.insn));
+
+    return insn.size;
 }
 
-void Cpu::execute32(Decoder decoder)
+icache::CachedInsn Cpu::decode(uint32_t insn)
 {
-    switch (decoder.opcode_type())
-    {
-    case OpcodeType::LOAD:
-        load::funct3(*this, decoder);
-        break;
-    case OpcodeType::FENCE:
-        fence::fence(*this, decoder);
-        break;
-    case OpcodeType::I:
-        itype::funct3(*this, decoder);
-        break;
-    case OpcodeType::S:
-        stype::funct3(*this, decoder);
-        break;
-    case OpcodeType::R:
-        rtype::funct3(*this, decoder);
-        break;
-    case OpcodeType::B:
-        btype::funct3(*this, decoder);
-        break;
-    case OpcodeType::FL:
-        fdtype::fl(*this, decoder);
-        break;
-    case OpcodeType::FS:
-        fdtype::fs(*this, decoder);
-        break;
-    case OpcodeType::FMADD:
-        fdtype::fmadd(*this, decoder);
-        break;
-    case OpcodeType::FMSUB:
-        fdtype::fmsub(*this, decoder);
-        break;
-    case OpcodeType::FNMADD:
-        fdtype::fnmadd(*this, decoder);
-        break;
-    case OpcodeType::FNMSUB:
-        fdtype::fnmsub(*this, decoder);
-        break;
-    case OpcodeType::FOTHER:
-        fdtype::fother(*this, decoder);
-        break;
-    case OpcodeType::ATOMIC:
-        atomic::funct3(*this, decoder);
-        break;
-    case OpcodeType::I64:
-        i64::funct3(*this, decoder);
-        break;
-    case OpcodeType::R64:
-        r64::funct3(*this, decoder);
-        break;
-    case OpcodeType::AUIPC:
-        auipc::auipc(*this, decoder);
-        break;
-    case OpcodeType::LUI:
-        lui::lui(*this, decoder);
-        break;
-    case OpcodeType::JAL:
-        jal::jal(*this, decoder);
-        break;
-    case OpcodeType::JALR:
-        jalr::jalr(*this, decoder);
-        break;
-    case OpcodeType::CSR:
-        csr::funct3(*this, decoder);
-        break;
-    default:
-        set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
+    insntable::InsnId id = insntable::decode(insn);
+    uint8_t insn_size = Decoder(insn).insn_size();
+    bool ends_block = (insntable::flags(id) & insntable::ENDS_BLOCK) != 0;
+
+    return {insntable::handler(id), insn, id, insn_size, ends_block};
 }
@@ -28,6 +28,10 @@ uint64_t Csr::load(uint64_t address)
 
 void Csr::store(uint64_t address, uint64_t value)
 {
+    uint64_t mstatus = regs[Address::MSTATUS];
+    uint64_t mie = regs[Address::MIE];
+    uint64_t mip = regs[Address::MIP];
+
     switch (address)
     {
     case Address::SSTATUS: {
@@ -50,6 +54,16 @@ void Csr::store(uint64_t address, uint64_t value)
     default:
         regs[address] = value;
     }
+
+    constexpr uint64_t enable_bits =
+        (1ULL << static_cast<uint64_t>(Mask::MSTATUSBit::MIE)) |
+        (1ULL << static_cast<uint64_t>(Mask::SSTATUSBit::SIE));
+
+    if (((mstatus ^ regs[Address::MSTATUS]) & enable_bits) != 0 || mie != regs[Address::MIE] ||
+        mip != regs[Address::MIP])
+    {
+        interrupts_dirty.store(true, std::memory_order_relaxed);
+    }
 }
 
 uint64_t Csr::read_bit(uint64_t address, uint64_t offset)
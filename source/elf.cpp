@@ -0,0 +1,316 @@
+#include "elf.hpp"
+#include <algorithm>
+#include <array>
+#include <fcntl.h>
+#include <fmt/core.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace elf
+{
+
+// Only the little endian ELF64 layouts are needed, the structures match the file byte for byte
+struct FileHeader
+{
+    std::array<uint8_t, 16> ident;
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+};
+
+struct ProgramHeader
+{
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+};
+
+struct SectionHeader
+{
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t addralign;
+    uint64_t entsize;
+};
+
+struct SymbolEntry
+{
+    uint32_t name;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+};
+
+static constexpr std::array<uint8_t, 4> magic = {0x7f, 'E', 'L', 'F'};
+static constexpr uint8_t class64 = 2;
+static constexpr uint8_t little_endian = 1;
+static constexpr uint16_t machine_riscv = 243;
+
+static constexpr uint32_t pt_load = 1;
+static constexpr uint32_t sht_symtab = 2;
+
+static constexpr uint16_t shn_undef = 0;
+
+static constexpr uint8_t stt_notype = 0;
+static constexpr uint8_t stt_object = 1;
+static constexpr uint8_t stt_func = 2;
+
+template <typename T> static bool read_struct(int fd, uint64_t offset, T& value)
+{
+    return pread(fd, &value, sizeof(T), offset) == sizeof(T);
+}
+
+static bool read_header(int fd, FileHeader& header)
+{
+    return read_struct(fd, 0, header) &&
+           std::equal(magic.begin(), magic.end(), header.ident.begin()) &&
+           header.ident[4] == class64 && header.ident[5] == little_endian &&
+           header.machine == machine_riscv && header.phentsize == sizeof(ProgramHeader);
+}
+
+// Sizes come from the file, so a section has to lie within it before anything is allocated
+static bool in_file(uint64_t offset, uint64_t length, uint64_t file_size)
+{
+    return offset <= file_size && length <= file_size - offset;
+}
+
+// Symbols are moved along with an image that was not loaded at its own addresses
+static std::vector<Symbol> read_symbols(int fd, const FileHeader& header, uint64_t relocation)
+{
+    std::vector<Symbol> symbols;
+    struct stat file_stat = {};
+
+    if (header.shentsize != sizeof(SectionHeader) || fstat(fd, &file_stat) != 0)
+    {
+        return symbols;
+    }
+
+    uint64_t file_size = file_stat.st_size;
+
+    for (uint16_t i = 0; i < header.shnum; i++)
+    {
+        SectionHeader symtab;
+        SectionHeader strtab;
+
+        if (!read_struct(fd, header.shoff + i * sizeof(SectionHeader), symtab) ||
+            symtab.type != sht_symtab || symtab.entsize != sizeof(SymbolEntry) ||
+            !read_struct(fd, header.shoff + symtab.link * sizeof(SectionHeader), strtab) ||
+            !in_file(symtab.offset, symtab.size, file_size) ||
+            !in_file(strtab.offset, strtab.size, file_size))
+        {
+            continue;
+        }
+
+        std::string names(strtab.size, '\0');
+
+        if (pread(fd, names.data(), names.size(), strtab.offset) !=
+            static_cast<ssize_t>(names.size()))
+        {
+            continue;
+        }
+
+        for (uint64_t offset = 0; offset < symtab.size; offset += sizeof(SymbolEntry))
+        {
+            SymbolEntry entry;
+
+            if (!read_struct(fd, symtab.offset + offset, entry))
+            {
+                break;
+            }
+
+            uint8_t type = entry.info & 0x0fU;
+
+            // Labels defined in assembly without a .type have no type, tohost among them
+            if ((type != stt_func && type != stt_object && type != stt_notype) ||
+                entry.shndx == shn_undef || entry.name == 0 || entry.name >= names.size())
+            {
+                continue;
+            }
+
+            symbols.push_back({entry.value + relocation, entry.size, names.c_str() + entry.name});
+        }
+    }
+
+    return symbols;
+}
+
+static bool load_segments(int fd, const FileHeader& header, RamDevice& ram,
+                          uint64_t default_offset, uint64_t& relocation)
+{
+    std::vector<ProgramHeader> segments;
+
+    for (uint16_t i = 0; i < header.phnum; i++)
+    {
+        ProgramHeader segment;
+
+        if (!read_struct(fd, header.phoff + i * sizeof(ProgramHeader), segment))
+        {
+            return false;
+        }
+
+        if (segment.type == pt_load && segment.memsz != 0)
+        {
+            if (segment.filesz > segment.memsz)
+            {
+                return false;
+            }
+
+            segments.push_back(segment);
+        }
+    }
+
+    if (segments.empty())
+    {
+        return false;
+    }
+
+    auto lowest = std::min_element(segments.begin(), segments.end(),
+                                   [](auto& a, auto& b) { return a.paddr < b.paddr; });
+
+    uint64_t ram_base = ram.get_base_address();
+    bool in_place = lowest->paddr >= ram_base && lowest->paddr - ram_base < ram.data.size();
+
+    // Kernels are linked to run from virtual addresses, their physical ones say nothing about
+    // where our RAM is, so such images are moved as a whole
+    uint64_t bias = in_place ? 0 : ram_base + default_offset - lowest->paddr;
+
+    for (auto& segment : segments)
+    {
+        uint64_t offset = segment.paddr + bias - ram_base;
+
+        if (segment.paddr + bias < ram_base || offset > ram.data.size() ||
+            segment.memsz > ram.data.size() - offset)
+        {
+            return false;
+        }
+
+        if (!ram.map_file_range(fd, offset, segment.offset, segment.filesz) ||
+            !ram.clear_range(offset + segment.filesz, segment.memsz - segment.filesz))
+        {
+            return false;
+        }
+    }
+
+    relocation = in_place ? 0 : ram_base + default_offset - lowest->vaddr;
+
+    return true;
+}
+
+bool is_elf(const char* path)
+{
+    std::array<uint8_t, magic.size()> ident = {};
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    bool result = read(fd, ident.data(), ident.size()) == static_cast<ssize_t>(ident.size()) &&
+                  ident == magic;
+
+    close(fd);
+
+    return result;
+}
+
+std::optional<Image> load(const char* path, RamDevice& ram, uint64_t default_offset)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return {};
+    }
+
+    FileHeader header;
+    Image image;
+    uint64_t relocation = 0;
+
+    bool loaded = read_header(fd, header) &&
+                  load_segments(fd, header, ram, default_offset, relocation);
+
+    if (loaded)
+    {
+        image.entry = header.entry + relocation;
+        image.symbols = read_symbols(fd, header, relocation);
+    }
+
+    close(fd);
+
+    if (!loaded)
+    {
+        return {};
+    }
+
+    return image;
+}
+
+void SymbolTable::add(const std::vector<Symbol>& new_symbols)
+{
+    symbols.insert(symbols.end(), new_symbols.begin(), new_symbols.end());
+
+    std::stable_sort(symbols.begin(), symbols.end(),
+                     [](auto& a, auto& b) { return a.address < b.address; });
+}
+
+const Symbol* SymbolTable::find(uint64_t address) const
+{
+    auto it = std::upper_bound(symbols.begin(), symbols.end(), address,
+                               [](uint64_t value, auto& symbol) { return value < symbol.address; });
+
+    if (it == symbols.begin())
+    {
+        return nullptr;
+    }
+
+    const Symbol& symbol = *std::prev(it);
+
+    if (symbol.size != 0 && address - symbol.address >= symbol.size)
+    {
+        return nullptr;
+    }
+
+    return &symbol;
+}
+
+std::string SymbolTable::describe(uint64_t address) const
+{
+    const Symbol* symbol = find(address);
+
+    if (symbol == nullptr)
+    {
+        return {};
+    }
+
+    return fmt::format("{}+0x{:x}", symbol->name, address - symbol->address);
+}
+
+bool SymbolTable::empty() const
+{
+    return symbols.empty();
+}
+} // namespace elf
@@ -0,0 +1,220 @@
+#include "fork_server.hpp"
+#include "cpu.hpp"
+#include "snapshot.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fmt/core.h>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fork_server
+{
+
+std::atomic<bool> serve_requested = false;
+
+static std::string socket_path;
+static int listen_fd = -1;
+static std::vector<Cpu*> target_harts;
+
+static std::mutex stop_lock;
+static std::condition_variable stopped;
+static uint64_t stopped_harts = 0;
+
+bool enable(const char* path, std::vector<Cpu*> harts)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+
+    strcpy(address.sun_path, path);
+
+    // Left behind by an earlier server, anything else at the path is not ours to remove
+    struct stat st;
+
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(path);
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (listen_fd < 0)
+    {
+        return false;
+    }
+
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0)
+    {
+        close(listen_fd);
+        listen_fd = -1;
+
+        return false;
+    }
+
+    socket_path = path;
+    target_harts = std::move(harts);
+
+    return true;
+}
+
+void request()
+{
+    serve_requested.store(true, std::memory_order_relaxed);
+}
+
+// Only the forking thread exists in a child, the machine is brought back from there
+static void resume_child(Cpu& boot_hart, int connection)
+{
+    close(listen_fd);
+    listen_fd = -1;
+    std::signal(SIGCHLD, SIG_DFL);
+
+    dup2(connection, STDIN_FILENO);
+    dup2(connection, STDOUT_FILENO);
+    close(connection);
+
+    serve_requested = false;
+
+    boot_hart.clint_device->resume_time();
+
+    snapshot::forked();
+
+    if (boot_hart.virtio_blk_device != nullptr)
+    {
+        boot_hart.virtio_blk_device->forget_worker();
+        boot_hart.virtio_blk_device->disk.make_private();
+    }
+
+    if (boot_hart.virtio_net_device != nullptr && boot_hart.virtio_net_device->backend != nullptr)
+    {
+        boot_hart.virtio_net_device->backend->forked();
+    }
+
+#if NATIVE_CLI && !__EMSCRIPTEN__
+    boot_hart.gpu_device->restart_stdin_reader();
+#endif
+
+    for (Cpu* hart : target_harts)
+    {
+        if (hart != &boot_hart)
+        {
+            std::thread([hart] { hart->run(); }).detach();
+        }
+    }
+}
+
+static void serve(Cpu& boot_hart)
+{
+    std::cerr << fmt::format("\nFork server listening on {}\n", socket_path);
+
+#if NATIVE_CLI && !__EMSCRIPTEN__
+    // Children read their own connection, the server has no use for its stdin
+    boot_hart.gpu_device->thread_done = true;
+#endif
+
+    // Children are never waited for
+    std::signal(SIGCHLD, SIG_IGN);
+
+    if (boot_hart.virtio_blk_device != nullptr)
+    {
+        boot_hart.virtio_blk_device->quiesce();
+    }
+
+    uint64_t backoff_ms = 0;
+
+    while (true)
+    {
+        int connection = accept(listen_fd, nullptr, nullptr);
+
+        if (connection < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+
+            std::cerr << fmt::format("Fork server accept failed: {}\n", strerror(errno));
+
+            // Running out of descriptors or memory passes as children exit, nothing else does
+            if (errno != EMFILE && errno != ENFILE && errno != ENOBUFS && errno != ENOMEM)
+            {
+                exit(1);
+            }
+
+            backoff_ms = std::clamp<uint64_t>(backoff_ms * 2, 10, 1000);
+            std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+
+            continue;
+        }
+
+        backoff_ms = 0;
+
+        // Anything still buffered would be written again by every child
+        std::cout.flush();
+        fflush(stdout);
+
+        pid_t pid = fork();
+
+        if (pid == 0)
+        {
+            resume_child(boot_hart, connection);
+            return;
+        }
+
+        if (pid < 0)
+        {
+            std::cerr << fmt::format("Fork server fork failed: {}\n", strerror(errno));
+        }
+
+        close(connection);
+    }
+}
+
+void stop(Cpu& cpu)
+{
+    std::unique_lock<std::mutex> lock(stop_lock);
+
+    if (listen_fd < 0)
+    {
+        serve_requested = false;
+        return;
+    }
+
+    stopped_harts++;
+    stopped.notify_all();
+
+    // The other harts stay parked in the server, children start fresh threads for them. Not on
+    // the condition variable, children would wait for the waiter that did not come along when
+    // they destroy it on exit
+    if (&cpu != target_harts[0])
+    {
+        lock.unlock();
+
+        while (true)
+        {
+            pause();
+        }
+    }
+
+    stopped.wait(lock, [] { return stopped_harts == target_harts.size(); });
+    lock.unlock();
+
+    serve(cpu);
+}
+} // namespace fork_server
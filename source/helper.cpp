@@ -1,9 +1,12 @@
 #include "helper.hpp"
 #include "cpu_config.hpp"
+#include <algorithm>
 #include <chrono>
 #include <cstring>
 #include <fmt/core.h>
 #include <fstream>
+#include <sys/mman.h>
+#include <unistd.h>
 
 void helper::dump(std::ostream& stream, const uint8_t* data, size_t data_len)
 {
@@ -137,3 +140,83 @@ std::vector<uint8_t> helper::load_file(const char* filename)
     return std::vector<uint8_t>{std::istreambuf_iterator<char>(input),
                                 std::istreambuf_iterator<char>()};
 }
+
+// Every mapping splits the one it lands in, and a process only gets vm.max_map_count of them
+// (65530 by default). A sparse snapshot has a run per group of pages, so shorter ranges are
+// copied instead, which keeps the mappings to one per this many bytes at most
+static constexpr uint64_t map_min_length = SIZE_MIB(1);
+
+bool helper::map_file_range(uint8_t* target, int fd, uint64_t file_offset, uint64_t length)
+{
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t offset = reinterpret_cast<uintptr_t>(target);
+
+    // Whole pages are mapped copy on write, so nothing is read until they are touched and
+    // stores to them never reach the file. That needs the file and memory offsets to share
+    // their page offset, the partial pages around them are read
+    uint64_t head = (page_size - offset % page_size) % page_size;
+    uint64_t whole_pages = length > head ? (length - head) & ~(page_size - 1) : 0;
+
+    if (offset % page_size != file_offset % page_size || whole_pages < map_min_length)
+    {
+        head = length;
+        whole_pages = 0;
+    }
+
+    if (whole_pages != 0 && mmap(target + head, whole_pages, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_FIXED, fd, file_offset + head) == MAP_FAILED)
+    {
+        // A failed fixed mapping may have dropped the memory that was there
+        mmap(target + head, whole_pages, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+
+        head = length;
+        whole_pages = 0;
+    }
+
+    auto read_range = [&](uint64_t begin, uint64_t end)
+    {
+        while (begin < end)
+        {
+            ssize_t count = pread(fd, target + begin, end - begin, file_offset + begin);
+
+            if (count <= 0)
+            {
+                return false;
+            }
+
+            begin += count;
+        }
+
+        return true;
+    };
+
+    return read_range(0, head) && read_range(head + whole_pages, length);
+}
+
+bool helper::clear_range(uint8_t* target, uint64_t length)
+{
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t offset = reinterpret_cast<uintptr_t>(target);
+
+    uint64_t head = std::min((page_size - offset % page_size) % page_size, length);
+    uint64_t whole_pages = (length - head) & ~(page_size - 1);
+
+    if (whole_pages < map_min_length)
+    {
+        memset(target, 0, length);
+        return true;
+    }
+
+    // A failed fixed mapping may have dropped the memory that was there, so it is not written
+    if (mmap(target + head, whole_pages, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED)
+    {
+        return false;
+    }
+
+    memset(target, 0, head);
+    memset(target + head + whole_pages, 0, length - head - whole_pages);
+
+    return true;
+}
@@ -0,0 +1,64 @@
+#include "icache.hpp"
+
+namespace icache
+{
+
+void InsnCache::init(uint64_t base_address, uint64_t end_address)
+{
+    base_addr = base_address;
+    size = end_address - base_address;
+
+    pages.clear();
+    pages.resize((size + page_size - 1) / page_size);
+}
+
+CachedInsn* InsnCache::get(uint64_t p_address)
+{
+    uint64_t offset = p_address - base_addr;
+
+    // Instructions that straddle a page boundary are not cached, as a store to the
+    // following page would not invalidate them
+    if (offset >= size || (offset % page_size) > page_size - sizeof(uint32_t)) [[unlikely]]
+    {
+        return nullptr;
+    }
+
+    std::unique_ptr<CachedPage>& page = pages[offset / page_size];
+
+    if (page == nullptr) [[unlikely]]
+    {
+        page = std::make_unique<CachedPage>();
+    }
+
+    return &page->slots[(offset % page_size) / 2];
+}
+
+void InsnCache::invalidate(uint64_t p_address, uint64_t length)
+{
+    uint64_t first = p_address - base_addr;
+    uint64_t last = first + length / 8 - 1;
+
+    if (first < size && pages[first / page_size] != nullptr) [[unlikely]]
+    {
+        pages[first / page_size].reset();
+        generation++;
+    }
+
+    if (last < size && pages[last / page_size] != nullptr) [[unlikely]]
+    {
+        pages[last / page_size].reset();
+        generation++;
+    }
+}
+
+void InsnCache::flush()
+{
+    for (std::unique_ptr<CachedPage>& page : pages)
+    {
+        page.reset();
+    }
+
+    generation++;
+}
+
+} // namespace icache
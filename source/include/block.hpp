@@ -0,0 +1,51 @@
+#pragma once
+
+#include "icache.hpp"
+#include "jit.hpp"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class Cpu;
+
+namespace block
+{
+
+constexpr uint64_t max_block_insns = 64;
+constexpr uint64_t max_successors = 2;
+
+struct Block
+{
+    uint64_t p_address;
+    std::vector<icache::CachedInsn> insns;
+
+    // Blocks that were previously entered right after this one
+    std::array<Block*, max_successors> successors = {};
+    uint64_t next_successor = 0;
+
+    uint64_t executions = 0;
+    jit::compiled_block_t compiled = nullptr;
+};
+
+class BlockCache
+{
+  public:
+    BlockCache() = default;
+
+    Block* get(Cpu& cpu, uint64_t p_address);
+    void flush();
+
+  private:
+    Block* build(Cpu& cpu, uint64_t p_address);
+    Block* find(Cpu& cpu, uint64_t p_address);
+
+  public:
+    uint64_t generation = 0;
+
+    Block* previous = nullptr;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Block>> blocks;
+};
+} // namespace block
@@ -1,6 +1,12 @@
 #pragma once
 
+#include "cpu_config.hpp"
+#include "scheduler.hpp"
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <ostream>
 #include <span>
@@ -11,6 +17,14 @@ class Bus;
 
 class Cpu;
 
+class PlicDevice;
+
+namespace snapshot
+{
+class Writer;
+class Reader;
+} // namespace snapshot
+
 class BusDevice
 {
   public:
@@ -23,7 +37,10 @@ class BusDevice
     virtual uint64_t get_end_address() const = 0;
 
     virtual void tick(Cpu& cpu);
-    virtual std::optional<uint32_t> is_interrupting();
+
+    // State a snapshot carries, devices without any keep the defaults
+    virtual void save(snapshot::Writer& writer);
+    virtual void restore(snapshot::Reader& reader);
 
     virtual std::string_view get_peripheral_name() const = 0;
 
@@ -34,19 +51,80 @@ class Bus
 {
   public:
     Bus() = default;
-    Bus(Bus&&) = default;
 
     void add_device(BusDevice* bus_device);
 
+    // Gives the bus of another hart the devices, interrupt lines and device lock of this one
+    void share_devices(Bus& boot_bus);
+
     uint64_t load(Cpu& cpu, uint64_t address, uint64_t length);
     void store(Cpu& cpu, uint64_t address, uint64_t value, uint64_t length);
 
     void tick_devices(Cpu& cpu);
 
+    // Devices push every change of their interrupt line instead of being polled, a rising one
+    // makes the PLIC latch a request
+    void set_irq_line(uint32_t irqn, bool level);
+    uint64_t get_irq_lines() const;
+
+    // Puts the lines back as a snapshot left them, the PLIC has its requests restored already
+    void restore_irq_lines(uint64_t lines);
+
+    void set_interrupt_controller(PlicDevice* plic);
+
+    // Every hart hands in its interrupts_dirty flag, which devices set from any thread to make
+    // it look at its interrupts again
+    void add_hart(uint64_t hart_id, std::atomic<bool>& interrupts_dirty);
+    void notify_hart(uint64_t hart_id);
+
+    // Devices other than RAM are touched by one hart at a time, the lock is only taken once
+    // a second hart shares them
+    std::unique_lock<std::mutex> lock_devices();
+
     std::span<BusDevice*> get_device_list();
 
   public:
     BusDevice* find_bus_device(uint64_t address) const;
 
     std::vector<BusDevice*> bus_devices;
+
+    scheduler::Scheduler scheduler;
+
+  private:
+    struct Shared
+    {
+        std::mutex device_lock;
+        std::atomic<uint64_t> irq_lines = 0;
+        bool smp = false;
+
+        PlicDevice* plic = nullptr;
+        std::array<std::atomic<bool>*, HARTS_MAX> harts = {};
+    };
+
+    std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+
+  private:
+    struct Region
+    {
+        uint64_t base;
+        uint64_t end;
+        BusDevice* device;
+
+        bool contains(uint64_t address) const
+        {
+            return address >= base && address < end;
+        }
+
+        // Orders regions by base for upper_bound
+        static bool is_before(uint64_t address, const Region& region)
+        {
+            return address < region.base;
+        }
+    };
+
+    // Device address ranges sorted by base, device ranges never overlap
+    std::vector<Region> regions;
+
+    // Where find_bus_device found a device last, every hart has a bus of its own
+    mutable const Region* last_region = nullptr;
 };
@@ -1,21 +1,27 @@
 #pragma once
 
+#include "block.hpp"
 #include "bus.hpp"
 #include "clint.hpp"
 #include "common_def.hpp"
 #include "csr.hpp"
+#include "elf.hpp"
 #include "gpu.hpp"
+#include "icache.hpp"
 #include "interupt.hpp"
+#include "jit.hpp"
 #include "misc.hpp"
 #include "mmu.hpp"
 #include "plic.hpp"
 #include "ram.hpp"
 #include "syscon.hpp"
 #include "virtio.hpp"
+#include "virtio_net.hpp"
 #include <array>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <ostream>
-#include <set>
 
 class Decoder;
 
@@ -24,12 +30,20 @@ class Cpu
   public:
     Cpu(RamDevice* dram_device, gpu::GpuDevice* gpu_device = nullptr,
         virtio::VirtioBlkDevice* virtio_blk_device = nullptr,
-        SysconDevice* syscon_device = nullptr);
+        SysconDevice* syscon_device = nullptr,
+        virtio::VirtioNetDevice* virtio_net_device = nullptr);
+
+    // Another hart of the boot hart's machine, memory and devices are shared between them
+    Cpu(Cpu& boot_hart, uint64_t hart_id);
 
     void dump_registers(std::ostream& stream);
 
     void dump_bus_devices(std::ostream& stream);
 
+    // Architectural state only, caches and translations are rebuilt after a restore
+    void save(snapshot::Writer& writer) const;
+    void restore(snapshot::Reader& reader);
+
   public:
     enum reg_name : uint64_t
     {
@@ -143,13 +157,17 @@ class Cpu
   public:
     [[noreturn]] void run();
     void loop(std::ostream& debug_stream = std::cout);
+    void block_loop(std::ostream& debug_stream = std::cout);
 
   public:
     uint32_t _loop(std::ostream& debug_stream = std::cout);
+    void process_interrupts(std::ostream& debug_stream);
+    void process_exception(std::ostream& debug_stream);
+    void execute_block(block::Block& block, std::ostream& debug_stream);
+    void execute_compiled_block(block::Block& block, std::ostream& debug_stream);
 
   public:
-    void execute16(Decoder decoder);
-    void execute32(Decoder decoder);
+    icache::CachedInsn decode(uint32_t insn);
 
   public:
     void set_exception(exception::Exception::ExceptionValue value, uint64_t exc_data = 0);
@@ -158,6 +176,9 @@ class Cpu
   public:
     Bus bus;
     mmu::Mmu mmu;
+    icache::InsnCache icache;
+    block::BlockCache blocks;
+    jit::Jit jit;
 
   public:
     std::array<uint64_t, 32> regs = {};
@@ -168,15 +189,20 @@ class Cpu
     uint64_t previous_pc = 0;
 
   public:
-    PlicDevice plic_device;
-    ClintDevice clint_device;
+    PlicDevice* plic_device;
+    ClintDevice* clint_device;
     RamDevice* dram_device;
     gpu::GpuDevice* gpu_device;
     virtio::VirtioBlkDevice* virtio_blk_device;
     SysconDevice* syscon_device;
+    virtio::VirtioNetDevice* virtio_net_device;
 
   public:
     cpu::Mode mode;
+    uint64_t hart_id = 0;
+
+    // Symbols of the loaded ELF images, shared by every hart, used to name addresses in dumps
+    const elf::SymbolTable* symbols = nullptr;
 
   public:
     exception::Exception::ExceptionValue exc_val = exception::Exception::None;
@@ -186,7 +212,14 @@ class Cpu
     bool sleep = false;
 
   public:
-    std::set<uint64_t> reservations;
+    // Virtual address of the last lr and the value it read, sc needs both to match
+    std::optional<uint64_t> reservation;
+    uint64_t reserved_value = 0;
+
+  private:
+    // Only the boot hart owns the interrupt controllers
+    std::unique_ptr<PlicDevice> own_plic_device;
+    std::unique_ptr<ClintDevice> own_clint_device;
 
   public:
     static constexpr auto reg_name_abi_str = std::array<const char*, 32>{
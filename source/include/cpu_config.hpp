@@ -12,6 +12,60 @@
 #define USE_TLB 1
 #endif
 
+// Both TLBs are set associative, the set count must be a power of two
+#ifndef ITLB_SETS
+#define ITLB_SETS 16
+#endif
+
+#ifndef ITLB_WAYS
+#define ITLB_WAYS 4
+#endif
+
+#ifndef DTLB_SETS
+#define DTLB_SETS 64
+#endif
+
+#ifndef DTLB_WAYS
+#define DTLB_WAYS 4
+#endif
+
+// Guest cycles between polls of the host clock and input devices
+#ifndef DEVICE_POLL_CYCLES
+#define DEVICE_POLL_CYCLES 4096
+#endif
+
+// Direct mapped cache of non-leaf page table entries, must be a power of two
+#ifndef PWC_ENTRIES
+#define PWC_ENTRIES 64
+#endif
+
+// Upper bound for --harts, sizes the per hart CLINT registers and PLIC contexts
+#ifndef HARTS_MAX
+#define HARTS_MAX 32
+#endif
+
+// Ask the host to back guest RAM with transparent huge pages
+#ifndef RAM_TRANSPARENT_HUGEPAGES
+#define RAM_TRANSPARENT_HUGEPAGES 1
+#endif
+
+// Take guest RAM from the hugetlbfs pool (vm.nr_hugepages) when it has room, normal pages
+// otherwise
+#ifndef RAM_HUGETLB
+#define RAM_HUGETLB 0
+#endif
+
+// Offer the version 1 MMIO interface of virtio devices instead of version 2, for guests that
+// predate it
+#ifndef VIRTIO_MMIO_LEGACY
+#define VIRTIO_MMIO_LEGACY 0
+#endif
+
+// Request queues of the block device, each has a worker thread of its own
+#ifndef VIRTIO_BLK_QUEUES
+#define VIRTIO_BLK_QUEUES 4
+#endif
+
 #ifndef DRAM_BASE
 #define DRAM_BASE 0x80000000U
 #endif
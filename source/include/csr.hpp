@@ -1,6 +1,7 @@
 #pragma once
 #include "common_def.hpp"
 #include <array>
+#include <atomic>
 #include <cstdint>
 
 namespace csr
@@ -199,5 +200,10 @@ class Csr
 
   public:
     std::array<uint64_t, 4096> regs = {};
+
+    // Set whenever something that decides if an interrupt can be taken may have changed,
+    // the hart only looks for pending interrupts while it is set. Devices set it from the
+    // threads of other harts
+    std::atomic<bool> interrupts_dirty = true;
 };
 } // namespace csr
\ No newline at end of file
@@ -56,6 +56,15 @@ struct LOADType
     };
 };
 
+struct FenceType
+{
+    enum funct3 : uint64_t
+    {
+        FENCE = 0x00,
+        FENCEI = 0x01
+    };
+};
+
 struct IType
 {
     enum funct3 : uint64_t
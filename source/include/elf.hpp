@@ -0,0 +1,51 @@
+#pragma once
+
+#include "ram.hpp"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace elf
+{
+
+struct Symbol
+{
+    uint64_t address;
+    uint64_t size;
+    std::string name;
+};
+
+// Function, object and untyped symbols of the loaded images, for naming guest addresses in dumps
+class SymbolTable
+{
+  public:
+    SymbolTable() = default;
+
+    void add(const std::vector<Symbol>& new_symbols);
+
+    // The symbol containing the address, or the closest one below it when it has no size
+    const Symbol* find(uint64_t address) const;
+    std::string describe(uint64_t address) const;
+
+    bool empty() const;
+
+  private:
+    // Sorted by address
+    std::vector<Symbol> symbols;
+};
+
+struct Image
+{
+    uint64_t entry;
+    std::vector<Symbol> symbols;
+};
+
+bool is_elf(const char* path);
+
+// Maps the PT_LOAD segments of a RISC-V ELF64 file into RAM. Segments are placed at their
+// physical addresses when those are in RAM, otherwise the image keeps its layout and starts at
+// default_offset into RAM. The file bytes are mapped copy on write and the rest of each segment
+// is left to the untouched RAM pages, so bss costs nothing until the guest uses it
+std::optional<Image> load(const char* path, RamDevice& ram, uint64_t default_offset);
+} // namespace elf
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+class Cpu;
+
+namespace fork_server
+{
+
+// Binds the socket up front, so a bad path shows up before the guest boots
+bool enable(const char* path, std::vector<Cpu*> harts);
+
+// Once the guest asks for it every hart stops between two blocks and the boot hart serves the
+// socket. Every connection gets a forked copy of the machine that resumes with the UART on the
+// connection, guest RAM is shared copy on write. Only returns in those children
+void request();
+void stop(Cpu& cpu);
+
+extern std::atomic<bool> serve_requested;
+
+inline bool requested()
+{
+    return serve_requested.load(std::memory_order_relaxed);
+}
+} // namespace fork_server
@@ -49,6 +49,14 @@ uint64_t align_up(uint64_t value, uint64_t alignment);
 
 std::vector<uint8_t> load_file(const char* filename);
 
+// Places length bytes of an open file at target, which has to be in a private mapping. Whole
+// pages of long ranges are mapped copy on write instead of read
+bool map_file_range(uint8_t* target, int fd, uint64_t file_offset, uint64_t length);
+
+// Zeroes a range of a private mapping, whole pages go back to untouched anonymous memory. On
+// failure the range may no longer be mapped
+bool clear_range(uint8_t* target, uint64_t length);
+
 template <typename T> bool value_in_range(T value, T lower_range, T upper_range)
 {
     return (value >= lower_range) && (value < upper_range);
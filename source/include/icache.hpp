@@ -0,0 +1,53 @@
+#pragma once
+
+#include "insntable.hpp"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace icache
+{
+
+constexpr uint64_t page_size = 4096;
+
+// Compressed instructions can start on any 2 byte boundary
+constexpr uint64_t slots_per_page = page_size / 2;
+
+using insn_handler_t = insntable::insn_handler_t;
+
+struct CachedInsn
+{
+    insn_handler_t handler;
+    uint32_t insn;
+    insntable::InsnId id;
+    uint8_t size;
+    bool ends_block;
+};
+
+struct CachedPage
+{
+    std::array<CachedInsn, slots_per_page> slots = {};
+};
+
+class InsnCache
+{
+  public:
+    InsnCache() = default;
+
+    void init(uint64_t base_address, uint64_t end_address);
+
+    CachedInsn* get(uint64_t p_address);
+    void invalidate(uint64_t p_address, uint64_t length);
+    void flush();
+
+  public:
+    uint64_t base_addr = 0;
+    uint64_t size = 0;
+
+    // Bumped whenever cached instructions are dropped
+    uint64_t generation = 0;
+
+    std::vector<std::unique_ptr<CachedPage>> pages;
+};
+} // namespace icache
@@ -29,6 +29,9 @@ struct Interrupt
 };
 
 Interrupt::InterruptValue get_pending_interrupt(Cpu& cpu);
+
+// False only if get_pending_interrupt would find nothing and have no effect
+bool may_be_pending(Cpu& cpu);
 void process(Cpu& cpu, Interrupt::InterruptValue int_val);
 
 } // namespace interrupt
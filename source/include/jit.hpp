@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+
+class Cpu;
+
+namespace block
+{
+struct Block;
+}
+
+namespace jit
+{
+
+constexpr uint64_t default_hot_threshold = 16;
+
+// Returns the amount of guest instructions that were executed
+using compiled_block_t = uint64_t (*)(Cpu& cpu);
+
+class Jit
+{
+  public:
+    Jit() = default;
+    ~Jit();
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // Returns false when the host doesn't support the JIT backend
+    bool init();
+
+    // Returns nullptr when the code buffer is full, in which case it should be flushed
+    compiled_block_t compile(Cpu& cpu, const block::Block& block);
+    void flush();
+
+    static bool is_supported();
+
+  public:
+    bool enabled = false;
+    uint64_t hot_threshold = default_hot_threshold;
+
+    uint8_t* buffer = nullptr;
+    uint64_t buffer_size = 0;
+    uint64_t used = 0;
+};
+} // namespace jit
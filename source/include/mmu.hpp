@@ -4,6 +4,7 @@
 #include "common_def.hpp"
 #include <array>
 #include <cstdint>
+#include <vector>
 
 class Cpu;
 
@@ -14,22 +15,84 @@ constexpr uint64_t page_size = 4096;
 
 using pn_arr_t = std::array<uint64_t, 5>;
 
+// Page bases have the low 12 bits clear, so this never matches a lookup
+constexpr uint64_t tlb_invalid_base = ~0ULL;
+
 struct TLBEntry
 {
-    uint64_t virt_base;
+    uint64_t virt_base = tlb_invalid_base;
     uint64_t phys_base;
     uint64_t pte;
     uint64_t pte_addr;
-    uint64_t age;
     bool dirty;
     bool accessed;
     bool read;
     bool write;
     bool execute;
     bool user;
+
+    // Global entries match every address space
+    uint64_t asid;
+    bool global;
+
+    // Size of the leaf page minus one, larger than a page for superpages
+    uint64_t page_mask;
+
+    // Access types that passed the permission checks and have the accessed and dirty bits
+    // set under `context`, those go straight to the physical address
+    uint64_t context;
+    uint8_t allowed;
+
+    // Where the page lives on the host when it is RAM
+    uint8_t* host;
 };
 
-constexpr uint64_t tlb_entries = 4;
+class Tlb
+{
+  public:
+    Tlb(uint64_t sets, uint64_t ways);
+
+    TLBEntry* find(uint64_t virt_base, uint64_t asid);
+    TLBEntry& replace(uint64_t virt_base);
+    void insert(TLBEntry& entry, uint64_t virt_base);
+
+    void flush();
+    void flush_asid(uint64_t asid);
+    void flush_page(uint64_t virt_base, uint64_t asid, bool any_asid);
+
+  private:
+    uint64_t ways;
+    uint64_t set_mask;
+
+    // Superpage entries also cover pages that index other sets
+    bool has_superpages = false;
+
+    // Set i holds entries [i * ways, (i + 1) * ways)
+    std::vector<TLBEntry> entries;
+    std::vector<uint64_t> next_victim;
+};
+
+// Remembers non-leaf page table entries by their physical address, so a walk only has to go
+// to memory for the levels that changed since the last fence
+class WalkCache
+{
+  public:
+    WalkCache(uint64_t size);
+
+    bool find(uint64_t pte_addr, uint64_t& pte);
+    void insert(uint64_t pte_addr, uint64_t pte);
+    void flush();
+
+  private:
+    struct Entry
+    {
+        uint64_t pte_addr = tlb_invalid_base;
+        uint64_t pte;
+    };
+
+    uint64_t mask;
+    std::vector<Entry> entries;
+};
 
 struct Mode
 {
@@ -64,6 +127,7 @@ class Mmu
 
     uint64_t load(uint64_t address, uint64_t length);
     uint64_t fetch(uint64_t address, uint64_t length = 32);
+    uint64_t fetch_physical(uint64_t p_address, uint64_t length = 32);
     void store(uint64_t address, uint64_t value, uint64_t length);
 
   public:
@@ -74,12 +138,21 @@ class Mmu
         Instruction
     };
 
+    // For naturally aligned atomics, which work on RAM in place. Null if the access faulted or
+    // has to go through the bus, p_address is set in the latter case
+    uint8_t* translate_host(uint64_t address, AccessType acces_type, uint64_t& p_address);
+
   public:
     void update();
+    uint64_t get_context(AccessType acces_type);
+    TLBEntry* find_checked(uint64_t address, AccessType acces_type);
     bool fetch_pte(uint64_t address, AccessType acces_type, cpu::Mode cpu_mode, TLBEntry& entry);
     TLBEntry* get_tlb_entry(uint64_t address, AccessType acces_type, cpu::Mode cpu_mode);
+    // Sets the accessed and dirty bits only if the PTE in memory still matches the cached one
+    bool update_pte(TLBEntry& entry, uint64_t pte);
     uint64_t translate(uint64_t address, AccessType acces_type);
     void flush_tlb();
+    void fence(uint64_t address, uint64_t asid, bool any_address, bool any_asid);
 
   public:
     uint32_t get_levels();
@@ -90,11 +163,14 @@ class Mmu
     void set_cpu_error(uint64_t address, AccessType access_type);
 
   public:
-    std::array<TLBEntry, tlb_entries> tlb_cache = {};
+    Tlb itlb;
+    Tlb dtlb;
+    WalkCache walk_cache;
 
   public:
     Mode::ModeValue mode;
     uint32_t mppn;
+    uint64_t asid;
 
   public:
     Cpu& cpu;
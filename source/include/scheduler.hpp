@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class BusDevice;
+class Cpu;
+
+namespace scheduler
+{
+
+constexpr uint64_t never = ~0ULL;
+
+// Devices are ticked only once the guest cycle count reaches a deadline they asked for, so the
+// execution loop compares a single counter instead of ticking every device
+class Scheduler
+{
+  public:
+    Scheduler() = default;
+
+    // Keeps the earlier deadline if the device already has one
+    void schedule(BusDevice* device, uint64_t deadline);
+    void schedule_in(BusDevice* device, uint64_t cycles);
+
+    bool due(uint64_t cycle);
+    void run(Cpu& cpu);
+
+  public:
+    // Cycle count at the last check, deadlines asked for in between are relative to it
+    uint64_t now = 0;
+
+  private:
+    struct Event
+    {
+        BusDevice* device;
+        uint64_t deadline;
+    };
+
+    // One event per device, there are few enough of them that a flat array beats a heap
+    std::vector<Event> events;
+    uint64_t next_deadline = never;
+};
+} // namespace scheduler
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+class Cpu;
+
+namespace snapshot
+{
+
+// One bit per page written since the last snapshot, so an incremental one only has to carry
+// those. Marking is a load when the bit is already set, harts mark pages concurrently
+class DirtyPages
+{
+  public:
+    static constexpr uint64_t page_size = 4096;
+
+    void resize(uint64_t size);
+
+    void mark(uint64_t offset)
+    {
+        uint64_t page = offset / page_size;
+        std::atomic<uint64_t>& word = words[page / 64];
+        uint64_t bit = 1ULL << (page % 64);
+
+        if ((word.load(std::memory_order_relaxed) & bit) == 0) [[unlikely]]
+        {
+            word.fetch_or(bit, std::memory_order_relaxed);
+        }
+    }
+
+    void mark_range(uint64_t offset, uint64_t length);
+
+    // Returns the marked pages and starts over
+    std::vector<uint64_t> take();
+
+    // Returns the marked pages and keeps them
+    std::vector<uint64_t> get() const;
+
+  private:
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+    uint64_t word_count = 0;
+};
+
+// Buffers the small fields, sparse blobs go straight to the file
+class Writer
+{
+  public:
+    Writer(int fd, bool incremental);
+
+    template <typename T> void put(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        put_bytes(&value, sizeof(T));
+    }
+
+    void put_bytes(const void* data, uint64_t length);
+
+    // Pages that are all zero are left out, the others start at a page aligned file offset so
+    // they can be mapped back instead of read. Incremental snapshots only carry the dirty pages,
+    // either way tracking starts over
+    void put_sparse(std::span<const uint8_t> data, DirtyPages& dirty);
+
+    // Only the given pages, zero ones included, which restoring puts over what is there
+    // already. Whether the snapshot is incremental does not matter
+    void put_pages(std::span<const uint8_t> data, const std::vector<uint64_t>& pages);
+
+    bool is_incremental() const;
+
+    // Returns whether everything reached the file
+    bool finish();
+
+  private:
+    // All pages but the zero ones without a page list
+    void put_runs(std::span<const uint8_t> data, const std::vector<uint64_t>* pages);
+
+    void flush();
+    void write_out(const void* data, uint64_t length);
+
+    int fd;
+    bool incremental;
+    bool failed = false;
+
+    // File offset of the first buffered byte
+    uint64_t position = 0;
+    std::vector<uint8_t> buffer;
+};
+
+class Reader
+{
+  public:
+    explicit Reader(int fd);
+
+    template <typename T> void get(T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        get_bytes(&value, sizeof(T));
+    }
+
+    void get_bytes(void* data, uint64_t length);
+
+    // A run of pages written by put_sparse, zero runs have no data in the file
+    struct Run
+    {
+        uint64_t offset;
+        uint64_t length;
+        uint64_t file_offset;
+        bool zero;
+    };
+
+    struct Sparse
+    {
+        uint64_t size;
+
+        // Everything outside the runs is zero, otherwise it is left as it was
+        bool complete;
+
+        std::vector<Run> runs;
+    };
+
+    // Only reads where the runs are, the caller maps or reads them from the file
+    Sparse get_sparse();
+    void read_at(void* data, uint64_t length, uint64_t file_offset);
+
+    int get_fd() const;
+
+    void fail();
+    bool good() const;
+
+  private:
+    int fd;
+    bool failed = false;
+    uint64_t position = 0;
+};
+
+struct Info
+{
+    uint64_t ram_size;
+    uint64_t hart_count;
+    bool has_virtio_blk;
+    bool has_virtio_net;
+};
+
+// What the machine has to be built with before a snapshot can be restored into it
+std::optional<Info> read_info(const char* path);
+
+// The harts of one machine, the boot hart first. All of them have to be stopped. With a parent
+// only what changed since the parent was saved is written, restoring goes through the chain
+bool save(const char* path, std::span<Cpu* const> harts, const char* parent = nullptr);
+bool restore(const char* path, std::span<Cpu* const> harts);
+
+// Saving on request stops every hart between two blocks, the last one to stop writes the file
+// and lets the others go on. The first snapshot goes to path, the ones after it are incremental
+// and go to path.1, path.2 and so on. A non zero interval also requests one every that many
+// seconds
+void enable(const char* path, std::vector<Cpu*> harts, uint64_t interval_seconds = 0);
+
+// For a forked child, its snapshots go to path.PID instead and start over with a complete one
+void forked();
+
+// Safe to call from a signal handler
+void request();
+void stop(Cpu& cpu);
+
+extern std::atomic<bool> save_requested;
+
+inline bool requested()
+{
+    return save_requested.load(std::memory_order_relaxed);
+}
+} // namespace snapshot
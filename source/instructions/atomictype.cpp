@@ -1,497 +1,322 @@
 #include "atomictype.hpp"
 #include "helper.hpp"
+#include <algorithm>
+#include <atomic>
+#include <type_traits>
 #include <utility>
 
-static inline void amow(Cpu& cpu, Decoder decoder)
+template <typename T, typename Update>
+static T fetch_update(std::atomic_ref<T> value, T operand, Update update)
 {
-    if (cpu.regs[decoder.rs1()] % 4 != 0)
-    {
-        cpu.set_exception(exception::Exception::InstructionAddressMisaligned, decoder.insn);
-    }
+    T old = value.load(std::memory_order_relaxed);
 
-    switch (decoder.funct5())
+    while (!value.compare_exchange_weak(old, update(old, operand)))
     {
-    case AtomicType::ADD:
-        atomic::amoaddw(cpu, decoder);
-        break;
-    case AtomicType::SWAP:
-        atomic::amoswapw(cpu, decoder);
-        break;
-    case AtomicType::LR:
-        atomic::lrw(cpu, decoder);
-        break;
-    case AtomicType::SC:
-        atomic::scw(cpu, decoder);
-        break;
-    case AtomicType::XOR:
-        atomic::amoxorw(cpu, decoder);
-        break;
-    case AtomicType::OR:
-        atomic::amoorw(cpu, decoder);
-        break;
-    case AtomicType::AND:
-        atomic::amoandw(cpu, decoder);
-        break;
-    case AtomicType::MIN:
-        atomic::amominw(cpu, decoder);
-        break;
-    case AtomicType::MAX:
-        atomic::amomaxw(cpu, decoder);
-        break;
-    case AtomicType::MINU:
-        atomic::amominuw(cpu, decoder);
-        break;
-    case AtomicType::MAXU:
-        atomic::amomaxuw(cpu, decoder);
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
     }
+
+    return old;
 }
 
-static inline void amod(Cpu& cpu, Decoder decoder)
+template <typename T> static T* host_cast(uint8_t* host)
 {
-    if (cpu.regs[decoder.rs1()] % 8 != 0)
-    {
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-    }
-
-    switch (decoder.funct5())
-    {
-    case AtomicType::ADD:
-        atomic::amoaddd(cpu, decoder);
-        break;
-    case AtomicType::SWAP:
-        atomic::amoswapd(cpu, decoder);
-        break;
-    case AtomicType::LR:
-        atomic::lrd(cpu, decoder);
-        break;
-    case AtomicType::SC:
-        atomic::scd(cpu, decoder);
-        break;
-    case AtomicType::XOR:
-        atomic::amoxord(cpu, decoder);
-        break;
-    case AtomicType::OR:
-        atomic::amoord(cpu, decoder);
-        break;
-    case AtomicType::AND:
-        atomic::amoandd(cpu, decoder);
-        break;
-    case AtomicType::MIN:
-        atomic::amomind(cpu, decoder);
-        break;
-    case AtomicType::MAX:
-        atomic::amomaxd(cpu, decoder);
-        break;
-    case AtomicType::MINU:
-        atomic::amominud(cpu, decoder);
-        break;
-    case AtomicType::MAXU:
-        atomic::amomaxud(cpu, decoder);
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
+    return reinterpret_cast<T*>(host);
 }
 
-void atomic::funct3(Cpu& cpu, Decoder decoder)
+// Memory is updated in place with a host atomic, so other harts never see half an AMO
+template <typename T, typename Op> static void amo(Cpu& cpu, Decoder decoder, Op op)
 {
-    switch (decoder.funct3())
+    using unsigned_t = std::make_unsigned_t<T>;
+
+    uint64_t address = cpu.regs[decoder.rs1()];
+    T operand = cpu.regs[decoder.rs2()];
+
+    if (address % sizeof(T) != 0) [[unlikely]]
     {
-    case AtomicType::AMOW:
-        amow(cpu, decoder);
-        break;
-    case AtomicType::AMOD:
-        amod(cpu, decoder);
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
+        cpu.set_exception(exception::Exception::StoreAddressMisaligned, address);
+        return;
     }
-}
 
-// amow
+    uint64_t p_address = 0;
+    uint8_t* host = cpu.mmu.translate_host(address, mmu::Mmu::AccessType::Store, p_address);
 
-#define amotarget_t int32_t
-#define amoutarget_t uint32_t
+    if (cpu.exc_val != exception::Exception::None) [[unlikely]]
+    {
+        return;
+    }
 
-void atomic::amoaddw(Cpu& cpu, Decoder decoder)
-{
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
+    T old;
+
+    if (host != nullptr) [[likely]]
+    {
+        old = op(std::atomic_ref<T>(*host_cast<T>(host)), operand);
+    }
+    else
+    {
+        // Device registers are not shared memory, a plain read-modify-write does for them
+        T value = cpu.bus.load(cpu, p_address, sizeof(T) * 8);
 
-    uint64_t addres = cpu.regs[rs1];
+        if (cpu.exc_val != exception::Exception::None) [[unlikely]]
+        {
+            return;
+        }
 
-    amotarget_t val1 = cpu.mmu.load(addres, 32);
-    amotarget_t val2 = cpu.regs[rs2];
+        old = op(std::atomic_ref<T>(value), operand);
+        cpu.bus.store(cpu, p_address, static_cast<unsigned_t>(value), sizeof(T) * 8);
 
-    amotarget_t result = val1 + val2;
+        if (cpu.exc_val != exception::Exception::None) [[unlikely]]
+        {
+            return;
+        }
+    }
 
-    cpu.mmu.store(addres, result, 32);
+    cpu.icache.invalidate(p_address, sizeof(T) * 8);
+    cpu.dram_device->break_reservations(cpu.hart_id, p_address);
 
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    cpu.regs[decoder.rd()] = SIGNEXTEND_CAST(old, std::make_signed_t<T>);
 }
 
-void atomic::amoswapw(Cpu& cpu, Decoder decoder)
+template <typename T> static void load_reserved(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
+    using unsigned_t = std::make_unsigned_t<T>;
 
-    uint64_t addres = cpu.regs[rs1];
+    uint64_t address = cpu.regs[decoder.rs1()];
 
-    amotarget_t val1 = cpu.mmu.load(addres, 32);
-    amotarget_t val2 = cpu.regs[rs2];
+    if (address % sizeof(T) != 0) [[unlikely]]
+    {
+        cpu.set_exception(exception::Exception::LoadAddressMisaligned, address);
+        return;
+    }
 
-    cpu.mmu.store(addres, val2, 32);
+    uint64_t p_address = 0;
+    uint8_t* host = cpu.mmu.translate_host(address, mmu::Mmu::AccessType::Load, p_address);
 
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
-}
+    if (cpu.exc_val != exception::Exception::None) [[unlikely]]
+    {
+        return;
+    }
 
-void atomic::lrw(Cpu& cpu, Decoder decoder)
-{
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rd = decoder.rd();
+    T value = host != nullptr ? std::atomic_ref<T>(*host_cast<T>(host)).load()
+                              : static_cast<T>(cpu.bus.load(cpu, p_address, sizeof(T) * 8));
 
-    uint64_t addres = cpu.regs[rs1];
+    if (cpu.exc_val != exception::Exception::None) [[unlikely]]
+    {
+        return;
+    }
 
-    amotarget_t val1 = cpu.mmu.load(addres, 32);
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    cpu.reservation = address;
+    cpu.reserved_value = static_cast<unsigned_t>(value);
+    cpu.dram_device->reserve(cpu.hart_id, p_address);
 
-    cpu.reservations.insert(addres);
+    cpu.regs[decoder.rd()] = SIGNEXTEND_CAST(value, std::make_signed_t<T>);
 }
 
-void atomic::scw(Cpu& cpu, Decoder decoder)
+// Succeeds only if no other hart stored to the granule since the lr, and the compare exchange
+// also catches a store that raced with the check
+template <typename T> static void store_conditional(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
+    using unsigned_t = std::make_unsigned_t<T>;
+
+    uint64_t address = cpu.regs[decoder.rs1()];
+    T value = cpu.regs[decoder.rs2()];
 
-    uint64_t addres = cpu.regs[rs1];
+    if (address % sizeof(T) != 0) [[unlikely]]
+    {
+        cpu.set_exception(exception::Exception::StoreAddressMisaligned, address);
+        return;
+    }
 
-    amoutarget_t val2 = cpu.regs[rs2];
+    bool reserved = cpu.reservation == address;
+    uint64_t granule = cpu.dram_device->release(cpu.hart_id);
 
-    if (cpu.reservations.contains(addres))
+    cpu.reservation.reset();
+
+    if (!reserved)
     {
-        cpu.reservations.erase(addres);
+        cpu.regs[decoder.rd()] = 1;
+        return;
+    }
 
-        cpu.mmu.store(addres, val2, 32);
+    uint64_t p_address = 0;
+    uint8_t* host = cpu.mmu.translate_host(address, mmu::Mmu::AccessType::Store, p_address);
 
-        cpu.regs[rd] = 0;
+    if (cpu.exc_val != exception::Exception::None) [[unlikely]]
+    {
+        return;
     }
-    else
+
+    bool success = granule == (p_address & ~7ULL);
+
+    if (success && host != nullptr) [[likely]]
     {
-        cpu.regs[rd] = 1;
+        T expected = static_cast<T>(cpu.reserved_value);
+
+        success = std::atomic_ref<T>(*host_cast<T>(host)).compare_exchange_strong(expected, value);
     }
-}
+    else if (success)
+    {
+        cpu.bus.store(cpu, p_address, static_cast<unsigned_t>(value), sizeof(T) * 8);
 
-void atomic::amoxorw(Cpu& cpu, Decoder decoder)
-{
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
+        if (cpu.exc_val != exception::Exception::None) [[unlikely]]
+        {
+            return;
+        }
+    }
 
-    uint64_t addres = cpu.regs[rs1];
+    if (success)
+    {
+        cpu.icache.invalidate(p_address, sizeof(T) * 8);
+        cpu.dram_device->break_reservations(cpu.hart_id, p_address);
+    }
 
-    amotarget_t val1 = cpu.mmu.load(addres, 32);
-    amotarget_t val2 = cpu.regs[rs2];
+    cpu.regs[decoder.rd()] = success ? 0 : 1;
+}
 
-    cpu.mmu.store(addres, SIGNEXTEND_CAST(val1 ^ val2, amotarget_t), 32);
+// amow
 
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+void atomic::amoaddw(Cpu& cpu, Decoder decoder)
+{
+    amo<int32_t>(cpu, decoder, [](std::atomic_ref<int32_t> value, int32_t operand) {
+        return value.fetch_add(operand);
+    });
 }
 
-void atomic::amoorw(Cpu& cpu, Decoder decoder)
+void atomic::amoswapw(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
+    amo<int32_t>(cpu, decoder, [](std::atomic_ref<int32_t> value, int32_t operand) {
+        return value.exchange(operand);
+    });
+}
 
-    uint64_t addres = cpu.regs[rs1];
+void atomic::lrw(Cpu& cpu, Decoder decoder)
+{
+    load_reserved<int32_t>(cpu, decoder);
+}
 
-    amotarget_t val1 = cpu.mmu.load(addres, 32);
-    amotarget_t val2 = cpu.regs[rs2];
+void atomic::scw(Cpu& cpu, Decoder decoder)
+{
+    store_conditional<int32_t>(cpu, decoder);
+}
 
-    cpu.mmu.store(addres, SIGNEXTEND_CAST(val1 | val2, amotarget_t), 32);
+void atomic::amoxorw(Cpu& cpu, Decoder decoder)
+{
+    amo<int32_t>(cpu, decoder, [](std::atomic_ref<int32_t> value, int32_t operand) {
+        return value.fetch_xor(operand);
+    });
+}
 
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+void atomic::amoorw(Cpu& cpu, Decoder decoder)
+{
+    amo<int32_t>(cpu, decoder, [](std::atomic_ref<int32_t> value, int32_t operand) {
+        return value.fetch_or(operand);
+    });
 }
 
 void atomic::amoandw(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amotarget_t val1 = cpu.mmu.load(addres, 32);
-    amotarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, SIGNEXTEND_CAST(val1 & val2, amotarget_t), 32);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    amo<int32_t>(cpu, decoder, [](std::atomic_ref<int32_t> value, int32_t operand) {
+        return value.fetch_and(operand);
+    });
 }
 
 void atomic::amominw(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amotarget_t val1 = cpu.mmu.load(addres, 32);
-    amotarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, SIGNEXTEND_CAST(std::min(val1, val2), amotarget_t), 32);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    amo<int32_t>(cpu, decoder, [](std::atomic_ref<int32_t> value, int32_t operand) {
+        return fetch_update(value, operand, [](auto a, auto b) { return std::min(a, b); });
+    });
 }
 
 void atomic::amomaxw(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amotarget_t val1 = cpu.mmu.load(addres, 32);
-    amotarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, SIGNEXTEND_CAST(std::max(val1, val2), amotarget_t), 32);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    amo<int32_t>(cpu, decoder, [](std::atomic_ref<int32_t> value, int32_t operand) {
+        return fetch_update(value, operand, [](auto a, auto b) { return std::max(a, b); });
+    });
 }
 
 void atomic::amominuw(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amoutarget_t val1 = cpu.mmu.load(addres, 32);
-    amoutarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, std::min(val1, val2), 32);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    amo<uint32_t>(cpu, decoder, [](std::atomic_ref<uint32_t> value, uint32_t operand) {
+        return fetch_update(value, operand, [](auto a, auto b) { return std::min(a, b); });
+    });
 }
 
 void atomic::amomaxuw(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amoutarget_t val1 = cpu.mmu.load(addres, 32);
-    amoutarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, std::max(val1, val2), 32);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    amo<uint32_t>(cpu, decoder, [](std::atomic_ref<uint32_t> value, uint32_t operand) {
+        return fetch_update(value, operand, [](auto a, auto b) { return std::max(a, b); });
+    });
 }
 
-#undef amotarget_t
-#undef amoutarget_t
-
 // amod
 
-#define amotarget_t int64_t
-#define amoutarget_t uint64_t
-
 void atomic::amoaddd(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amotarget_t val1 = cpu.mmu.load(addres, 64);
-    amotarget_t val2 = cpu.regs[rs2];
-
-    amotarget_t result = val1 + val2;
-
-    cpu.mmu.store(addres, result, 64);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    amo<int64_t>(cpu, decoder, [](std::atomic_ref<int64_t> value, int64_t operand) {
+        return value.fetch_add(operand);
+    });
 }
 
 void atomic::amoswapd(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amotarget_t val1 = cpu.mmu.load(addres, 64);
-    amotarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, val2, 64);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    amo<int64_t>(cpu, decoder, [](std::atomic_ref<int64_t> value, int64_t operand) {
+        return value.exchange(operand);
+    });
 }
 
 void atomic::lrd(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amotarget_t val1 = cpu.mmu.load(addres, 64);
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
-
-    cpu.reservations.insert(addres);
+    load_reserved<int64_t>(cpu, decoder);
 }
 
 void atomic::scd(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amoutarget_t val2 = cpu.regs[rs2];
-
-    if (cpu.reservations.contains(addres))
-    {
-        cpu.reservations.erase(addres);
-
-        cpu.mmu.store(addres, val2, 64);
-
-        cpu.regs[rd] = 0;
-    }
-    else
-    {
-        cpu.regs[rd] = 1;
-    }
+    store_conditional<int64_t>(cpu, decoder);
 }
 
 void atomic::amoxord(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amotarget_t val1 = cpu.mmu.load(addres, 64);
-    amotarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, SIGNEXTEND_CAST(val1 ^ val2, amotarget_t), 64);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    amo<int64_t>(cpu, decoder, [](std::atomic_ref<int64_t> value, int64_t operand) {
+        return value.fetch_xor(operand);
+    });
 }
 
 void atomic::amoord(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amotarget_t val1 = cpu.mmu.load(addres, 64);
-    amotarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, SIGNEXTEND_CAST(val1 | val2, amotarget_t), 64);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    amo<int64_t>(cpu, decoder, [](std::atomic_ref<int64_t> value, int64_t operand) {
+        return value.fetch_or(operand);
+    });
 }
 
 void atomic::amoandd(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amotarget_t val1 = cpu.mmu.load(addres, 64);
-    amotarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, SIGNEXTEND_CAST(val1 & val2, amotarget_t), 64);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    amo<int64_t>(cpu, decoder, [](std::atomic_ref<int64_t> value, int64_t operand) {
+        return value.fetch_and(operand);
+    });
 }
 
 void atomic::amomind(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amotarget_t val1 = cpu.mmu.load(addres, 64);
-    amotarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, SIGNEXTEND_CAST(std::min(val1, val2), amotarget_t), 64);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    amo<int64_t>(cpu, decoder, [](std::atomic_ref<int64_t> value, int64_t operand) {
+        return fetch_update(value, operand, [](auto a, auto b) { return std::min(a, b); });
+    });
 }
 
 void atomic::amomaxd(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amotarget_t val1 = cpu.mmu.load(addres, 64);
-    amotarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, SIGNEXTEND_CAST(std::max(val1, val2), amotarget_t), 64);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amotarget_t);
+    amo<int64_t>(cpu, decoder, [](std::atomic_ref<int64_t> value, int64_t operand) {
+        return fetch_update(value, operand, [](auto a, auto b) { return std::max(a, b); });
+    });
 }
 
 void atomic::amominud(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amoutarget_t val1 = cpu.mmu.load(addres, 64);
-    amoutarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, SIGNEXTEND_CAST(std::min(val1, val2), amoutarget_t), 64);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amoutarget_t);
+    amo<uint64_t>(cpu, decoder, [](std::atomic_ref<uint64_t> value, uint64_t operand) {
+        return fetch_update(value, operand, [](auto a, auto b) { return std::min(a, b); });
+    });
 }
 
 void atomic::amomaxud(Cpu& cpu, Decoder decoder)
 {
-    Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
-    Cpu::reg_name rd = decoder.rd();
-
-    uint64_t addres = cpu.regs[rs1];
-
-    amoutarget_t val1 = cpu.mmu.load(addres, 64);
-    amoutarget_t val2 = cpu.regs[rs2];
-
-    cpu.mmu.store(addres, SIGNEXTEND_CAST(std::max(val1, val2), amoutarget_t), 64);
-
-    cpu.regs[rd] = SIGNEXTEND_CAST(val1, amoutarget_t);
+    amo<uint64_t>(cpu, decoder, [](std::atomic_ref<uint64_t> value, uint64_t operand) {
+        return fetch_update(value, operand, [](auto a, auto b) { return std::max(a, b); });
+    });
 }
-
-#undef amotarget_t
-#undef amoutarget_t
\ No newline at end of file
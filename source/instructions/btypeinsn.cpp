@@ -1,34 +1,6 @@
 #include "btypeinsn.hpp"
 #include "helper.hpp"
 
-void btype::funct3(Cpu& cpu, Decoder decoder)
-{
-    switch (decoder.funct3())
-    {
-    case BType::BEQ:
-        beq(cpu, decoder);
-        break;
-    case BType::BNE:
-        bne(cpu, decoder);
-        break;
-    case BType::BLT:
-        blt(cpu, decoder);
-        break;
-    case BType::BGE:
-        bge(cpu, decoder);
-        break;
-    case BType::BLTU:
-        bltu(cpu, decoder);
-        break;
-    case BType::BGEU:
-        bgeu(cpu, decoder);
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-}
-
 void btype::beq(Cpu& cpu, Decoder decoder)
 {
     int64_t imm = decoder.imm_b();
@@ -3,95 +3,6 @@
 #include <array>
 #include <fmt/core.h>
 
-void csr::funct3(Cpu& cpu, Decoder decoder)
-{
-    switch (decoder.funct3())
-    {
-    case CsrType::ENVIRONMENT:
-        environment(cpu, decoder);
-        break;
-    case CsrType::CSRW:
-        csrw(cpu, decoder);
-        break;
-    case CsrType::CSRS:
-        csrs(cpu, decoder);
-        break;
-    case CsrType::CSRC:
-        csrc(cpu, decoder);
-        break;
-    case CsrType::CSRWI:
-        csrwi(cpu, decoder);
-        break;
-    case CsrType::CSRSI:
-        csrsi(cpu, decoder);
-        break;
-    case CsrType::CSRCI:
-        csrci(cpu, decoder);
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-    }
-}
-
-void csr::environment(Cpu& cpu, Decoder decoder)
-{
-    uint64_t imm = decoder.rs2();
-    uint64_t funct7 = decoder.funct7();
-
-    switch (funct7)
-    {
-    case CsrType::SFENCEVMA7:
-        sfencevma(cpu, decoder);
-        return;
-    case CsrType::HFENCEBVMA7:
-        hfencevma(cpu, decoder);
-        return;
-    case CsrType::HFENCEGVMA7:
-        hfencegvma(cpu, decoder);
-        return;
-    }
-
-    switch (imm)
-    {
-    case CsrType::ECALL:
-        ecall(cpu, decoder);
-        break;
-    case CsrType::EBREAK:
-        ebreak(cpu, decoder);
-        break;
-    case CsrType::RET:
-        switch (funct7)
-        {
-        case CsrType::URET7:
-            uret(cpu, decoder);
-            break;
-        case CsrType::SRET7:
-            sret(cpu, decoder);
-            break;
-        case CsrType::MRET7:
-            mret(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        }
-        break;
-    case CsrType::WFI:
-        switch (funct7)
-        {
-        case CsrType::WFI7:
-            wfi(cpu, decoder);
-            break;
-
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-    }
-}
-
 void csr::ecall(Cpu& cpu, Decoder decoder)
 {
     switch (cpu.mode)
@@ -132,6 +43,7 @@ void csr::sret(Cpu& cpu, Decoder decoder)
     cpu.pc = cpu.cregs.load(csr::Address::SEPC) - 4;
 
     cpu.mode = static_cast<cpu::Mode>(cpu.cregs.read_bit_sstatus(csr::Mask::SSTATUSBit::SPP));
+    cpu.cregs.interrupts_dirty.store(true, std::memory_order_relaxed);
 
     if (cpu.mode == cpu::Mode::User)
     {
@@ -156,6 +68,7 @@ void csr::mret(Cpu& cpu, Decoder decoder)
     cpu.pc = cpu.cregs.load(csr::Address::MEPC) - 4;
 
     cpu.mode = cpu.cregs.read_mpp_mode();
+    cpu.cregs.interrupts_dirty.store(true, std::memory_order_relaxed);
 
     if (cpu.mode != cpu::Mode::Machine)
     {
@@ -181,9 +94,14 @@ void csr::sfencevma(Cpu& cpu, Decoder decoder)
     if (cpu.cregs.read_bit_mstatus(Mask::MSTATUSBit::TVM) == 1 || cpu.mode == cpu::Mode::User)
     {
         cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
+        return;
     }
 
-    cpu.mmu.update();
+    // x0 as rs1 fences every address, x0 as rs2 every address space
+    Cpu::reg_name rs1 = decoder.rs1();
+    Cpu::reg_name rs2 = decoder.rs2();
+
+    cpu.mmu.fence(cpu.regs[rs1], cpu.regs[rs2], rs1 == 0, rs2 == 0);
 }
 
 void csr::hfencevma(Cpu& cpu, Decoder decoder)
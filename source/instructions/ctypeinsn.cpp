@@ -2,205 +2,6 @@
 
 #include "helper.hpp"
 
-void ctype::quadrant0(Cpu& cpu, Decoder decoder)
-{
-    switch (decoder.compressed_funct3())
-    {
-    case Q0::ADDI4SPN:
-        addi4spn(cpu, decoder);
-        break;
-    case Q0::FLD:
-        fld(cpu, decoder);
-        break;
-    case Q0::LW:
-        lw(cpu, decoder);
-        break;
-    case Q0::LD:
-        ld(cpu, decoder);
-        break;
-    case Q0::RESERVED:
-        reserved(cpu, decoder);
-        break;
-    case Q0::FSD:
-        fsd(cpu, decoder);
-        break;
-    case Q0::SW:
-        sw(cpu, decoder);
-        break;
-    case Q0::SD:
-        sd(cpu, decoder);
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    };
-}
-
-static void q1op4(Cpu& cpu, Decoder decoder)
-{
-    using namespace ctype;
-
-    switch (decoder.compressed_funct2())
-    {
-    case Q1::OP4::funct2::SRLI:
-        srli(cpu, decoder);
-        break;
-    case Q1::OP4::funct2::SRAI:
-        srai(cpu, decoder);
-        break;
-    case Q1::OP4::funct2::ANDI:
-        andi(cpu, decoder);
-        break;
-    case Q1::OP4::funct2::OP3: {
-        uint32_t val1 = (decoder.insn >> 12U) & 0x01U;
-        uint32_t val2 = (decoder.insn >> 5U) & 0x03U;
-
-        if (val1 == 0)
-        {
-            switch (val2)
-            {
-            case 0:
-                sub(cpu, decoder);
-                break;
-            case 1:
-                xor_(cpu, decoder);
-                break;
-            case 2:
-                or_(cpu, decoder);
-                break;
-            case 3:
-                and_(cpu, decoder);
-                break;
-            default:
-                break;
-            }
-        }
-        else
-        {
-            switch (val2)
-            {
-            case 0:
-                subw(cpu, decoder);
-                break;
-            case 1:
-                addw(cpu, decoder);
-                break;
-            default:
-                cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-                break;
-            }
-        }
-    }
-    break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-}
-
-void ctype::quadrant1(Cpu& cpu, Decoder decoder)
-{
-    switch (decoder.compressed_funct3())
-    {
-    case Q1::ADDI:
-        addi(cpu, decoder);
-        break;
-    case Q1::ADDIW:
-        addiw(cpu, decoder);
-        break;
-    case Q1::LI:
-        li(cpu, decoder);
-        break;
-    case Q1::OP03:
-        switch (static_cast<Q1::OP03fn>(decoder.rd()))
-        {
-        case Q1::OP03fn::NOP:
-            break;
-        case Q1::OP03fn::ADDI16SP:
-            addi16sp(cpu, decoder);
-            break;
-        default:
-            lui(cpu, decoder);
-            break;
-        }
-        break;
-    case Q1::OP04:
-        q1op4(cpu, decoder);
-        break;
-    case Q1::J:
-        j(cpu, decoder);
-        break;
-    case Q1::BEQZ:
-        beqz(cpu, decoder);
-        break;
-    case Q1::BNEZ:
-        bnez(cpu, decoder);
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    };
-}
-
-void ctype::quadrant2(Cpu& cpu, Decoder decoder)
-{
-    switch (decoder.compressed_funct3())
-    {
-    case Q2::SLLI:
-        slli(cpu, decoder);
-        break;
-    case Q2::FLDSP:
-        fldsp(cpu, decoder);
-        break;
-    case Q2::LWSP:
-        lwsp(cpu, decoder);
-        break;
-    case Q2::LDSP:
-        ldsp(cpu, decoder);
-        break;
-    case Q2::OP4: {
-        uint32_t val1 = (decoder.insn >> 12U) & 0x01U;
-        uint32_t val2 = (decoder.insn >> 2U) & 0x1fU;
-
-        if (val1 == 0)
-        {
-            if (val2 == 0)
-            {
-                jr(cpu, decoder);
-            }
-            else
-            {
-                mv(cpu, decoder);
-            }
-        }
-        else
-        {
-            if (val2 == 0)
-            {
-                jalr(cpu, decoder);
-            }
-            else
-            {
-                add(cpu, decoder);
-            }
-        }
-    }
-    break;
-    case Q2::FSDSP:
-        fsdsp(cpu, decoder);
-        break;
-    case Q2::SWSP:
-        swsp(cpu, decoder);
-        break;
-    case Q2::SDSP:
-        sdsp(cpu, decoder);
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-}
-
 void ctype::addi4spn(Cpu& cpu, Decoder decoder)
 {
     uint64_t rd = decoder.compressed_rd();
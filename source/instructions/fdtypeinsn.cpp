@@ -531,60 +531,31 @@ template <typename T> static void fsgnjx(Cpu& cpu, Decoder decoder)
     cpu.fregs[rd] = result;
 }
 
-template <typename T> static void fcvtsd(Cpu& cpu, Decoder decoder)
+template <typename T, typename I> static void fcvt_to_int(Cpu& cpu, Decoder decoder)
 {
     Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
     Cpu::reg_name rd = decoder.rd();
 
     T val = fdround<T>(cpu.fregs[rs1], cpu, decoder);
 
-    switch (static_cast<uint64_t>(decoder.rs2()))
+    if constexpr (sizeof(I) == 4)
     {
-    case FDType::FCVT0:
-        cpu.regs[rd] = SIGNEXTEND_CAST(fd_conv_check<int32_t>(val, cpu), int32_t);
-        break;
-    case FDType::FCVT1:
-        cpu.regs[rd] = SIGNEXTEND_CAST(fd_conv_check<uint32_t>(val, cpu), int32_t);
-        break;
-    case FDType::FCVT2:
-        cpu.regs[rd] = fd_conv_check<int64_t>(val, cpu);
-        break;
-    case FDType::FCVT3:
-        cpu.regs[rd] = fd_conv_check<uint64_t>(val, cpu);
-        break;
-    default:
-        [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
+        cpu.regs[rd] = SIGNEXTEND_CAST(fd_conv_check<I>(val, cpu), int32_t);
+    }
+    else
+    {
+        cpu.regs[rd] = fd_conv_check<I>(val, cpu);
     }
 }
 
-template <typename T> static void fcvtsdw(Cpu& cpu, Decoder decoder)
+template <typename T, typename I> static void fcvt_from_int(Cpu& cpu, Decoder decoder)
 {
     Cpu::reg_name rs1 = decoder.rs1();
-    Cpu::reg_name rs2 = decoder.rs2();
     Cpu::reg_name rd = decoder.rd();
 
     int64_t val = cpu.regs[rs1];
 
-    switch (static_cast<uint64_t>(decoder.rs2()))
-    {
-    case FDType::FCVT0:
-        cpu.fregs[rd] = static_cast<T>(static_cast<int32_t>(val));
-        break;
-    case FDType::FCVT1:
-        cpu.fregs[rd] = static_cast<T>(static_cast<uint32_t>(val));
-        break;
-    case FDType::FCVT2:
-        cpu.fregs[rd] = static_cast<T>(val);
-        break;
-    case FDType::FCVT3:
-        cpu.fregs[rd] = static_cast<T>(static_cast<uint64_t>(val));
-        break;
-    default:
-        [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
+    cpu.fregs[rd] = static_cast<T>(static_cast<I>(val));
 }
 
 template <typename T> static void fmvxwd(Cpu& cpu, Decoder decoder)
@@ -682,335 +653,85 @@ bool check_fs(Cpu& cpu)
 
 } // namespace fdimpl
 
-void fdtype::fs(Cpu& cpu, Decoder decoder)
-{
-    if (!fdimpl::check_fs(cpu)) [[unlikely]]
-    {
-        return;
-    }
-
-    switch (decoder.funct3())
-    {
-    case FDType::FSW:
-        fdimpl::fs<float>(cpu, decoder);
-        break;
-    case FDType::FSD:
-        fdimpl::fs<double>(cpu, decoder);
-        break;
-    default:
-        [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-
-    fdimpl::set_exceptions(cpu);
-}
-
-void fdtype::fl(Cpu& cpu, Decoder decoder)
-{
-    if (!fdimpl::check_fs(cpu)) [[unlikely]]
-    {
-        return;
-    }
-
-    switch (decoder.funct3())
-    {
-    case FDType::FLW:
-        fdimpl::fl<float>(cpu, decoder);
-        break;
-    case FDType::FLD:
-        fdimpl::fl<double>(cpu, decoder);
-        break;
-    default:
-        [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-
-    fdimpl::set_exceptions(cpu);
-}
-
-void fdtype::fmadd(Cpu& cpu, Decoder decoder)
-{
-    if (!fdimpl::check_fs(cpu)) [[unlikely]]
-    {
-        return;
-    }
-
-    switch (decoder.funct2())
-    {
-    case FDType::FMADDS:
-        fdimpl::fmadd<float>(cpu, decoder);
-        break;
-    case FDType::FMADDD:
-        fdimpl::fmadd<double>(cpu, decoder);
-        break;
-    default:
-        [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-
-    fdimpl::set_exceptions(cpu);
-}
-
-void fdtype::fmsub(Cpu& cpu, Decoder decoder)
-{
-    if (!fdimpl::check_fs(cpu)) [[unlikely]]
-    {
-        return;
-    }
-
-    switch (decoder.funct2())
-    {
-    case FDType::FMSUBS:
-        fdimpl::fmsub<float>(cpu, decoder);
-        break;
-    case FDType::FMSUBD:
-        fdimpl::fmsub<double>(cpu, decoder);
-        break;
-    default:
-        [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-
-    fdimpl::set_exceptions(cpu);
-}
-
-void fdtype::fnmadd(Cpu& cpu, Decoder decoder)
-{
-    if (!fdimpl::check_fs(cpu)) [[unlikely]]
-    {
-        return;
-    }
-
-    switch (decoder.funct2())
-    {
-    case FDType::FNMADDS:
-        fdimpl::fnmadd<float>(cpu, decoder);
-        break;
-    case FDType::FNMADDD:
-        fdimpl::fnmadd<double>(cpu, decoder);
-        break;
-    default:
-        [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-
-    fdimpl::set_exceptions(cpu);
-}
-
-void fdtype::fnmsub(Cpu& cpu, Decoder decoder)
+template <void (*impl)(Cpu&, Decoder)> static void fd_insn(Cpu& cpu, Decoder decoder)
 {
     if (!fdimpl::check_fs(cpu)) [[unlikely]]
     {
         return;
     }
 
-    switch (decoder.funct2())
-    {
-    case FDType::FNMSUBS:
-        fdimpl::fnmsub<float>(cpu, decoder);
-        break;
-    case FDType::FNMSUBD:
-        fdimpl::fnmsub<double>(cpu, decoder);
-        break;
-    default:
-        [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
+    impl(cpu, decoder);
 
     fdimpl::set_exceptions(cpu);
 }
 
-void fdtype::fother(Cpu& cpu, Decoder decoder)
-{
-    if (!fdimpl::check_fs(cpu)) [[unlikely]]
-    {
-        return;
-    }
-
-    switch (decoder.funct7())
-    {
-    case FDType::FADDS:
-        fdimpl::fadd<float>(cpu, decoder);
-        break;
-    case FDType::FADDD:
-        fdimpl::fadd<double>(cpu, decoder);
-        break;
-    case FDType::FSUBS:
-        fdimpl::fsub<float>(cpu, decoder);
-        break;
-    case FDType::FSUBD:
-        fdimpl::fsub<double>(cpu, decoder);
-        break;
-    case FDType::FMULS:
-        fdimpl::fmul<float>(cpu, decoder);
-        break;
-    case FDType::FMULD:
-        fdimpl::fmul<double>(cpu, decoder);
-        break;
-    case FDType::FDIVS:
-        fdimpl::fdiv<float>(cpu, decoder);
-        break;
-    case FDType::FDIVD:
-        fdimpl::fdiv<double>(cpu, decoder);
-        break;
-    case FDType::FSNGJS:
-        switch (decoder.funct3())
-        {
-        case FDType::FSGNJ:
-            fdimpl::fsgnj<float>(cpu, decoder);
-            break;
-        case FDType::FSGNJN:
-            fdimpl::fsgnjn<float>(cpu, decoder);
-            break;
-        case FDType::FSGNJX:
-            fdimpl::fsgnjx<float>(cpu, decoder);
-            break;
-        default:
-            [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case FDType::FSNGJD:
-        switch (decoder.funct3())
-        {
-        case FDType::FSGNJ:
-            fdimpl::fsgnj<double>(cpu, decoder);
-            break;
-        case FDType::FSGNJN:
-            fdimpl::fsgnjn<double>(cpu, decoder);
-            break;
-        case FDType::FSGNJX:
-            fdimpl::fsgnjx<double>(cpu, decoder);
-            break;
-        default:
-            [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case FDType::FMINMAXS:
-        switch (decoder.funct3())
-        {
-        case FDType::MIN:
-            fdimpl::fmin<float>(cpu, decoder);
-            break;
-        case FDType::MAX:
-            fdimpl::fmax<float>(cpu, decoder);
-            break;
-        default:
-            [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case FDType::FMINMAXD:
-        switch (decoder.funct3())
-        {
-        case FDType::MIN:
-            fdimpl::fmin<double>(cpu, decoder);
-            break;
-        case FDType::MAX:
-            fdimpl::fmax<double>(cpu, decoder);
-            break;
-        default:
-            [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case FDType::FCVTSD:
-        fdimpl::fcvt<float, double>(cpu, decoder);
-        break;
-    case FDType::FCVTDS:
-        fdimpl::fcvt<double, float>(cpu, decoder);
-        break;
-    case FDType::FSQRTS:
-        fdimpl::fsqrt<float>(cpu, decoder);
-        break;
-    case FDType::FSQRTD:
-        fdimpl::fsqrt<double>(cpu, decoder);
-        break;
-    case FDType::FCS:
-        switch (decoder.funct3())
-        {
-        case FDType::FLE:
-            fdimpl::fle<float>(cpu, decoder);
-            break;
-        case FDType::FLT:
-            fdimpl::flt<float>(cpu, decoder);
-            break;
-        case FDType::FEQ:
-            fdimpl::feq<float>(cpu, decoder);
-            break;
-        default:
-            [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case FDType::FCD:
-        switch (decoder.funct3())
-        {
-        case FDType::FLE:
-            fdimpl::fle<double>(cpu, decoder);
-            break;
-        case FDType::FLT:
-            fdimpl::flt<double>(cpu, decoder);
-            break;
-        case FDType::FEQ:
-            fdimpl::feq<double>(cpu, decoder);
-            break;
-        default:
-            [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case FDType::FCVTS:
-        fdimpl::fcvtsd<float>(cpu, decoder);
-        break;
-    case FDType::FCVTD:
-        fdimpl::fcvtsd<double>(cpu, decoder);
-        break;
-    case FDType::FCVTSW:
-        fdimpl::fcvtsdw<float>(cpu, decoder);
-        break;
-    case FDType::FCVTDW:
-        fdimpl::fcvtsdw<double>(cpu, decoder);
-        break;
-    case FDType::FMVXW:
-        switch (decoder.funct3())
-        {
-        case FDType::FMV:
-            fdimpl::fmvxwd<float>(cpu, decoder);
-            break;
-        case FDType::FCLASS:
-            fdimpl::fclass<float>(cpu, decoder);
-            break;
-        default:
-            [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case FDType::FMVXD:
-        switch (decoder.funct3())
-        {
-        case FDType::FMV:
-            fdimpl::fmvxwd<double>(cpu, decoder);
-            break;
-        case FDType::FCLASS:
-            fdimpl::fclass<double>(cpu, decoder);
-            break;
-        default:
-            [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case FDType::FMVWX:
-        fdimpl::fmvx<float>(cpu, decoder);
-        break;
-    case FDType::FMVDX:
-        fdimpl::fmvx<double>(cpu, decoder);
-        break;
-    default:
-        [[unlikely]] cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-
-    fdimpl::set_exceptions(cpu);
-}
+#define FD_INSN(name, ...)                                                                         \
+    void fdtype::name(Cpu& cpu, Decoder decoder)                                                   \
+    {                                                                                              \
+        fd_insn<fdimpl::__VA_ARGS__>(cpu, decoder);                                                \
+    }
+
+FD_INSN(flw, fl<float>)
+FD_INSN(fld, fl<double>)
+FD_INSN(fsw, fs<float>)
+FD_INSN(fsd, fs<double>)
+FD_INSN(fmadds, fmadd<float>)
+FD_INSN(fmaddd, fmadd<double>)
+FD_INSN(fmsubs, fmsub<float>)
+FD_INSN(fmsubd, fmsub<double>)
+FD_INSN(fnmadds, fnmadd<float>)
+FD_INSN(fnmaddd, fnmadd<double>)
+FD_INSN(fnmsubs, fnmsub<float>)
+FD_INSN(fnmsubd, fnmsub<double>)
+FD_INSN(fadds, fadd<float>)
+FD_INSN(faddd, fadd<double>)
+FD_INSN(fsubs, fsub<float>)
+FD_INSN(fsubd, fsub<double>)
+FD_INSN(fmuls, fmul<float>)
+FD_INSN(fmuld, fmul<double>)
+FD_INSN(fdivs, fdiv<float>)
+FD_INSN(fdivd, fdiv<double>)
+FD_INSN(fsqrts, fsqrt<float>)
+FD_INSN(fsqrtd, fsqrt<double>)
+FD_INSN(fsgnjs, fsgnj<float>)
+FD_INSN(fsgnjns, fsgnjn<float>)
+FD_INSN(fsgnjxs, fsgnjx<float>)
+FD_INSN(fsgnjd, fsgnj<double>)
+FD_INSN(fsgnjnd, fsgnjn<double>)
+FD_INSN(fsgnjxd, fsgnjx<double>)
+FD_INSN(fmins, fmin<float>)
+FD_INSN(fmaxs, fmax<float>)
+FD_INSN(fmind, fmin<double>)
+FD_INSN(fmaxd, fmax<double>)
+FD_INSN(fcvtsd, fcvt<float, double>)
+FD_INSN(fcvtds, fcvt<double, float>)
+FD_INSN(feqs, feq<float>)
+FD_INSN(flts, flt<float>)
+FD_INSN(fles, fle<float>)
+FD_INSN(feqd, feq<double>)
+FD_INSN(fltd, flt<double>)
+FD_INSN(fled, fle<double>)
+FD_INSN(fcvtws, fcvt_to_int<float, int32_t>)
+FD_INSN(fcvtwus, fcvt_to_int<float, uint32_t>)
+FD_INSN(fcvtls, fcvt_to_int<float, int64_t>)
+FD_INSN(fcvtlus, fcvt_to_int<float, uint64_t>)
+FD_INSN(fcvtwd, fcvt_to_int<double, int32_t>)
+FD_INSN(fcvtwud, fcvt_to_int<double, uint32_t>)
+FD_INSN(fcvtld, fcvt_to_int<double, int64_t>)
+FD_INSN(fcvtlud, fcvt_to_int<double, uint64_t>)
+FD_INSN(fcvtsw, fcvt_from_int<float, int32_t>)
+FD_INSN(fcvtswu, fcvt_from_int<float, uint32_t>)
+FD_INSN(fcvtsl, fcvt_from_int<float, int64_t>)
+FD_INSN(fcvtslu, fcvt_from_int<float, uint64_t>)
+FD_INSN(fcvtdw, fcvt_from_int<double, int32_t>)
+FD_INSN(fcvtdwu, fcvt_from_int<double, uint32_t>)
+FD_INSN(fcvtdl, fcvt_from_int<double, int64_t>)
+FD_INSN(fcvtdlu, fcvt_from_int<double, uint64_t>)
+FD_INSN(fmvxw, fmvxwd<float>)
+FD_INSN(fclasss, fclass<float>)
+FD_INSN(fmvxd, fmvxwd<double>)
+FD_INSN(fclassd, fclass<double>)
+FD_INSN(fmvwx, fmvx<float>)
+FD_INSN(fmvdx, fmvx<double>)
+
+#undef FD_INSN
@@ -1,36 +1,6 @@
 #include "i64insn.hpp"
 #include "helper.hpp"
 
-void i64::funct3(Cpu& cpu, Decoder decoder)
-{
-    switch (decoder.funct3())
-    {
-    case I64Type::ADDIW:
-        addiw(cpu, decoder);
-        break;
-    case I64Type::SLLIW:
-        slliw(cpu, decoder);
-        break;
-    case I64Type::SRIW:
-        switch (decoder.funct7())
-        {
-        case I64Type::SRLIW:
-            srliw(cpu, decoder);
-            break;
-        case I64Type::SRAIW:
-            sraiw(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-}
-
 void i64::addiw(Cpu& cpu, Decoder decoder)
 {
     int64_t imm = decoder.imm_i();
@@ -5,8 +5,6 @@
 
 namespace atomic
 {
-void funct3(Cpu& cpu, Decoder decoder);
-
 void amoaddw(Cpu& cpu, Decoder decoder);
 void amoswapw(Cpu& cpu, Decoder decoder);
 void lrw(Cpu& cpu, Decoder decoder);
@@ -5,8 +5,6 @@
 
 namespace btype
 {
-void funct3(Cpu& cpu, Decoder decoder);
-
 void beq(Cpu& cpu, Decoder decoder);
 void bne(Cpu& cpu, Decoder decoder);
 void blt(Cpu& cpu, Decoder decoder);
@@ -7,9 +7,6 @@ namespace csr
 {
 void init_handler_array();
 
-void funct3(Cpu& cpu, Decoder decoder);
-
-void environment(Cpu& cpu, Decoder decoder);
 void ecall(Cpu& cpu, Decoder decoder);
 void ebreak(Cpu& cpu, Decoder decoder);
 void uret(Cpu& cpu, Decoder decoder);
@@ -73,10 +73,6 @@ struct Q2
     };
 };
 
-void quadrant0(Cpu& cpu, Decoder decoder);
-void quadrant1(Cpu& cpu, Decoder decoder);
-void quadrant2(Cpu& cpu, Decoder decoder);
-
 // Q0
 
 void addi4spn(Cpu& cpu, Decoder decoder);
@@ -22,11 +22,72 @@ struct FClass
     };
 };
 
-void fs(Cpu& cpu, Decoder decoder);
-void fl(Cpu& cpu, Decoder decoder);
-void fmadd(Cpu& cpu, Decoder decoder);
-void fmsub(Cpu& cpu, Decoder decoder);
-void fnmadd(Cpu& cpu, Decoder decoder);
-void fnmsub(Cpu& cpu, Decoder decoder);
-void fother(Cpu& cpu, Decoder decoder);
+void flw(Cpu& cpu, Decoder decoder);
+void fld(Cpu& cpu, Decoder decoder);
+void fsw(Cpu& cpu, Decoder decoder);
+void fsd(Cpu& cpu, Decoder decoder);
+
+void fmadds(Cpu& cpu, Decoder decoder);
+void fmaddd(Cpu& cpu, Decoder decoder);
+void fmsubs(Cpu& cpu, Decoder decoder);
+void fmsubd(Cpu& cpu, Decoder decoder);
+void fnmadds(Cpu& cpu, Decoder decoder);
+void fnmaddd(Cpu& cpu, Decoder decoder);
+void fnmsubs(Cpu& cpu, Decoder decoder);
+void fnmsubd(Cpu& cpu, Decoder decoder);
+
+void fadds(Cpu& cpu, Decoder decoder);
+void faddd(Cpu& cpu, Decoder decoder);
+void fsubs(Cpu& cpu, Decoder decoder);
+void fsubd(Cpu& cpu, Decoder decoder);
+void fmuls(Cpu& cpu, Decoder decoder);
+void fmuld(Cpu& cpu, Decoder decoder);
+void fdivs(Cpu& cpu, Decoder decoder);
+void fdivd(Cpu& cpu, Decoder decoder);
+void fsqrts(Cpu& cpu, Decoder decoder);
+void fsqrtd(Cpu& cpu, Decoder decoder);
+
+void fsgnjs(Cpu& cpu, Decoder decoder);
+void fsgnjns(Cpu& cpu, Decoder decoder);
+void fsgnjxs(Cpu& cpu, Decoder decoder);
+void fsgnjd(Cpu& cpu, Decoder decoder);
+void fsgnjnd(Cpu& cpu, Decoder decoder);
+void fsgnjxd(Cpu& cpu, Decoder decoder);
+void fmins(Cpu& cpu, Decoder decoder);
+void fmaxs(Cpu& cpu, Decoder decoder);
+void fmind(Cpu& cpu, Decoder decoder);
+void fmaxd(Cpu& cpu, Decoder decoder);
+
+void fcvtsd(Cpu& cpu, Decoder decoder);
+void fcvtds(Cpu& cpu, Decoder decoder);
+void feqs(Cpu& cpu, Decoder decoder);
+void flts(Cpu& cpu, Decoder decoder);
+void fles(Cpu& cpu, Decoder decoder);
+void feqd(Cpu& cpu, Decoder decoder);
+void fltd(Cpu& cpu, Decoder decoder);
+void fled(Cpu& cpu, Decoder decoder);
+
+void fcvtws(Cpu& cpu, Decoder decoder);
+void fcvtwus(Cpu& cpu, Decoder decoder);
+void fcvtls(Cpu& cpu, Decoder decoder);
+void fcvtlus(Cpu& cpu, Decoder decoder);
+void fcvtwd(Cpu& cpu, Decoder decoder);
+void fcvtwud(Cpu& cpu, Decoder decoder);
+void fcvtld(Cpu& cpu, Decoder decoder);
+void fcvtlud(Cpu& cpu, Decoder decoder);
+void fcvtsw(Cpu& cpu, Decoder decoder);
+void fcvtswu(Cpu& cpu, Decoder decoder);
+void fcvtsl(Cpu& cpu, Decoder decoder);
+void fcvtslu(Cpu& cpu, Decoder decoder);
+void fcvtdw(Cpu& cpu, Decoder decoder);
+void fcvtdwu(Cpu& cpu, Decoder decoder);
+void fcvtdl(Cpu& cpu, Decoder decoder);
+void fcvtdlu(Cpu& cpu, Decoder decoder);
+
+void fmvxw(Cpu& cpu, Decoder decoder);
+void fclasss(Cpu& cpu, Decoder decoder);
+void fmvxd(Cpu& cpu, Decoder decoder);
+void fclassd(Cpu& cpu, Decoder decoder);
+void fmvwx(Cpu& cpu, Decoder decoder);
+void fmvdx(Cpu& cpu, Decoder decoder);
 } // namespace fdtype
@@ -5,8 +5,6 @@
 
 namespace i64
 {
-void funct3(Cpu& cpu, Decoder decoder);
-
 void addiw(Cpu& cpu, Decoder decoder);
 void slliw(Cpu& cpu, Decoder decoder);
 void srliw(Cpu& cpu, Decoder decoder);
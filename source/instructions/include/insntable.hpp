@@ -0,0 +1,242 @@
+#pragma once
+
+#include <cstdint>
+
+class Cpu;
+class Decoder;
+
+// X(name, mask, match, handler, flags)
+//
+// Every RV64GC encoding the emulator implements. An instruction matches an entry when
+// (insn & mask) == match, earlier entries win when several match.
+#define RV64GC_INSTRUCTIONS(X)                                                                     \
+    X(LUI, 0x0000007f, 0x00000037, lui::lui, ALU)                                                  \
+    X(AUIPC, 0x0000007f, 0x00000017, auipc::auipc, ALU)                                            \
+    X(JAL, 0x0000007f, 0x0000006f, jal::jal, CTRL)                                                 \
+    X(JALR, 0x0000707f, 0x00000067, jalr::jalr, CTRL)                                              \
+    X(BEQ, 0x0000707f, 0x00000063, btype::beq, CTRL)                                               \
+    X(BNE, 0x0000707f, 0x00001063, btype::bne, CTRL)                                               \
+    X(BLT, 0x0000707f, 0x00004063, btype::blt, CTRL)                                               \
+    X(BGE, 0x0000707f, 0x00005063, btype::bge, CTRL)                                               \
+    X(BLTU, 0x0000707f, 0x00006063, btype::bltu, CTRL)                                             \
+    X(BGEU, 0x0000707f, 0x00007063, btype::bgeu, CTRL)                                             \
+    X(LB, 0x0000707f, 0x00000003, load::lb, MEM)                                                   \
+    X(LH, 0x0000707f, 0x00001003, load::lh, MEM)                                                   \
+    X(LW, 0x0000707f, 0x00002003, load::lw, MEM)                                                   \
+    X(LD, 0x0000707f, 0x00003003, load::ld, MEM)                                                   \
+    X(LBU, 0x0000707f, 0x00004003, load::lbu, MEM)                                                 \
+    X(LHU, 0x0000707f, 0x00005003, load::lhu, MEM)                                                 \
+    X(LWU, 0x0000707f, 0x00006003, load::lwu, MEM)                                                 \
+    X(SB, 0x0000707f, 0x00000023, stype::sb, MEM)                                                  \
+    X(SH, 0x0000707f, 0x00001023, stype::sh, MEM)                                                  \
+    X(SW, 0x0000707f, 0x00002023, stype::sw, MEM)                                                  \
+    X(SD, 0x0000707f, 0x00003023, stype::sd, MEM)                                                  \
+    X(ADDI, 0x0000707f, 0x00000013, itype::addi, ALU)                                              \
+    X(SLTI, 0x0000707f, 0x00002013, itype::slti, ALU)                                              \
+    X(SLTIU, 0x0000707f, 0x00003013, itype::sltiu, ALU)                                            \
+    X(XORI, 0x0000707f, 0x00004013, itype::xori, ALU)                                              \
+    X(ORI, 0x0000707f, 0x00006013, itype::ori, ALU)                                                \
+    X(ANDI, 0x0000707f, 0x00007013, itype::andi, ALU)                                              \
+    X(SLLI, 0xfc00707f, 0x00001013, itype::slli, ALU)                                              \
+    X(SRLI, 0xfc00707f, 0x00005013, itype::srli, ALU)                                              \
+    X(SRAI, 0xfc00707f, 0x40005013, itype::srai, ALU)                                              \
+    X(ADD, 0xfe00707f, 0x00000033, rtype::add, ALU)                                                \
+    X(SUB, 0xfe00707f, 0x40000033, rtype::sub, ALU)                                                \
+    X(SLL, 0xfe00707f, 0x00001033, rtype::sll, ALU)                                                \
+    X(SLT, 0xfe00707f, 0x00002033, rtype::slt, ALU)                                                \
+    X(SLTU, 0xfe00707f, 0x00003033, rtype::sltu, ALU)                                              \
+    X(XOR, 0xfe00707f, 0x00004033, rtype::xor_, ALU)                                               \
+    X(SRL, 0xfe00707f, 0x00005033, rtype::srl, ALU)                                                \
+    X(SRA, 0xfe00707f, 0x40005033, rtype::sra, ALU)                                                \
+    X(OR, 0xfe00707f, 0x00006033, rtype::or_, ALU)                                                 \
+    X(AND, 0xfe00707f, 0x00007033, rtype::and_, ALU)                                               \
+    X(MUL, 0xfe00707f, 0x02000033, rtype::mul, ALU)                                                \
+    X(MULH, 0xfe00707f, 0x02001033, rtype::mulh, ALU)                                              \
+    X(MULHSU, 0xfe00707f, 0x02002033, rtype::mulhsu, ALU)                                          \
+    X(MULHU, 0xfe00707f, 0x02003033, rtype::mulhu, ALU)                                            \
+    X(DIV, 0xfe00707f, 0x02004033, rtype::div, ALU)                                                \
+    X(DIVU, 0xfe00707f, 0x02005033, rtype::divu, ALU)                                              \
+    X(REM, 0xfe00707f, 0x02006033, rtype::rem, ALU)                                                \
+    X(REMU, 0xfe00707f, 0x02007033, rtype::remu, ALU)                                              \
+    X(ADDIW, 0x0000707f, 0x0000001b, i64::addiw, ALU)                                              \
+    X(SLLIW, 0xfe00707f, 0x0000101b, i64::slliw, ALU)                                              \
+    X(SRLIW, 0xfe00707f, 0x0000501b, i64::srliw, ALU)                                              \
+    X(SRAIW, 0xfe00707f, 0x4000501b, i64::sraiw, ALU)                                              \
+    X(ADDW, 0xfe00707f, 0x0000003b, r64::addw, ALU)                                                \
+    X(SUBW, 0xfe00707f, 0x4000003b, r64::subw, ALU)                                                \
+    X(SLLW, 0xfe00707f, 0x0000103b, r64::sllw, ALU)                                                \
+    X(SRLW, 0xfe00707f, 0x0000503b, r64::srlw, ALU)                                                \
+    X(SRAW, 0xfe00707f, 0x4000503b, r64::sraw, ALU)                                                \
+    X(MULW, 0xfe00707f, 0x0200003b, r64::mulw, ALU)                                                \
+    X(DIVW, 0xfe00707f, 0x0200403b, r64::divw, ALU)                                                \
+    X(DIVUW, 0xfe00707f, 0x0200503b, r64::divuw, ALU)                                              \
+    X(REMW, 0xfe00707f, 0x0200603b, r64::remw, ALU)                                                \
+    X(REMUW, 0xfe00707f, 0x0200703b, r64::remuw, ALU)                                              \
+    X(FENCE, 0x0000707f, 0x0000000f, fence::fence, CTRL)                                           \
+    X(FENCE_I, 0x0000707f, 0x0000100f, fence::fence, CTRL)                                         \
+    X(ECALL, 0xffffffff, 0x00000073, csr::ecall, CTRL)                                             \
+    X(EBREAK, 0xffffffff, 0x00100073, csr::ebreak, CTRL)                                           \
+    X(URET, 0xffffffff, 0x00200073, csr::uret, CTRL)                                               \
+    X(SRET, 0xffffffff, 0x10200073, csr::sret, CTRL)                                               \
+    X(MRET, 0xffffffff, 0x30200073, csr::mret, CTRL)                                               \
+    X(WFI, 0xffffffff, 0x10500073, csr::wfi, CTRL)                                                 \
+    X(SFENCE_VMA, 0xfe007fff, 0x12000073, csr::sfencevma, CTRL)                                    \
+    X(HFENCE_VVMA, 0xfe007fff, 0x22000073, csr::hfencevma, CTRL)                                   \
+    X(HFENCE_GVMA, 0xfe007fff, 0xa2000073, csr::hfencegvma, CTRL)                                  \
+    X(CSRRW, 0x0000707f, 0x00001073, csr::csrw, CTRL)                                              \
+    X(CSRRS, 0x0000707f, 0x00002073, csr::csrs, CTRL)                                              \
+    X(CSRRC, 0x0000707f, 0x00003073, csr::csrc, CTRL)                                              \
+    X(CSRRWI, 0x0000707f, 0x00005073, csr::csrwi, CTRL)                                            \
+    X(CSRRSI, 0x0000707f, 0x00006073, csr::csrsi, CTRL)                                            \
+    X(CSRRCI, 0x0000707f, 0x00007073, csr::csrci, CTRL)                                            \
+    X(LR_W, 0xf9f0707f, 0x1000202f, atomic::lrw, MEM)                                              \
+    X(SC_W, 0xf800707f, 0x1800202f, atomic::scw, MEM)                                              \
+    X(AMOSWAP_W, 0xf800707f, 0x0800202f, atomic::amoswapw, MEM)                                    \
+    X(AMOADD_W, 0xf800707f, 0x0000202f, atomic::amoaddw, MEM)                                      \
+    X(AMOXOR_W, 0xf800707f, 0x2000202f, atomic::amoxorw, MEM)                                      \
+    X(AMOAND_W, 0xf800707f, 0x6000202f, atomic::amoandw, MEM)                                      \
+    X(AMOOR_W, 0xf800707f, 0x4000202f, atomic::amoorw, MEM)                                        \
+    X(AMOMIN_W, 0xf800707f, 0x8000202f, atomic::amominw, MEM)                                      \
+    X(AMOMAX_W, 0xf800707f, 0xa000202f, atomic::amomaxw, MEM)                                      \
+    X(AMOMINU_W, 0xf800707f, 0xc000202f, atomic::amominuw, MEM)                                    \
+    X(AMOMAXU_W, 0xf800707f, 0xe000202f, atomic::amomaxuw, MEM)                                    \
+    X(LR_D, 0xf9f0707f, 0x1000302f, atomic::lrd, MEM)                                              \
+    X(SC_D, 0xf800707f, 0x1800302f, atomic::scd, MEM)                                              \
+    X(AMOSWAP_D, 0xf800707f, 0x0800302f, atomic::amoswapd, MEM)                                    \
+    X(AMOADD_D, 0xf800707f, 0x0000302f, atomic::amoaddd, MEM)                                      \
+    X(AMOXOR_D, 0xf800707f, 0x2000302f, atomic::amoxord, MEM)                                      \
+    X(AMOAND_D, 0xf800707f, 0x6000302f, atomic::amoandd, MEM)                                      \
+    X(AMOOR_D, 0xf800707f, 0x4000302f, atomic::amoord, MEM)                                        \
+    X(AMOMIN_D, 0xf800707f, 0x8000302f, atomic::amomind, MEM)                                      \
+    X(AMOMAX_D, 0xf800707f, 0xa000302f, atomic::amomaxd, MEM)                                      \
+    X(AMOMINU_D, 0xf800707f, 0xc000302f, atomic::amominud, MEM)                                    \
+    X(AMOMAXU_D, 0xf800707f, 0xe000302f, atomic::amomaxud, MEM)                                    \
+    X(FLW, 0x0000707f, 0x00002007, fdtype::flw, MEM)                                               \
+    X(FLD, 0x0000707f, 0x00003007, fdtype::fld, MEM)                                               \
+    X(FSW, 0x0000707f, 0x00002027, fdtype::fsw, MEM)                                               \
+    X(FSD, 0x0000707f, 0x00003027, fdtype::fsd, MEM)                                               \
+    X(FMADD_S, 0x0600007f, 0x00000043, fdtype::fmadds, MEM)                                        \
+    X(FMSUB_S, 0x0600007f, 0x00000047, fdtype::fmsubs, MEM)                                        \
+    X(FNMSUB_S, 0x0600007f, 0x0000004b, fdtype::fnmsubs, MEM)                                      \
+    X(FNMADD_S, 0x0600007f, 0x0000004f, fdtype::fnmadds, MEM)                                      \
+    X(FMADD_D, 0x0600007f, 0x02000043, fdtype::fmaddd, MEM)                                        \
+    X(FMSUB_D, 0x0600007f, 0x02000047, fdtype::fmsubd, MEM)                                        \
+    X(FNMSUB_D, 0x0600007f, 0x0200004b, fdtype::fnmsubd, MEM)                                      \
+    X(FNMADD_D, 0x0600007f, 0x0200004f, fdtype::fnmaddd, MEM)                                      \
+    X(FADD_S, 0xfe00007f, 0x00000053, fdtype::fadds, MEM)                                          \
+    X(FSUB_S, 0xfe00007f, 0x08000053, fdtype::fsubs, MEM)                                          \
+    X(FMUL_S, 0xfe00007f, 0x10000053, fdtype::fmuls, MEM)                                          \
+    X(FDIV_S, 0xfe00007f, 0x18000053, fdtype::fdivs, MEM)                                          \
+    X(FSQRT_S, 0xfff0007f, 0x58000053, fdtype::fsqrts, MEM)                                        \
+    X(FSGNJ_S, 0xfe00707f, 0x20000053, fdtype::fsgnjs, MEM)                                        \
+    X(FSGNJN_S, 0xfe00707f, 0x20001053, fdtype::fsgnjns, MEM)                                      \
+    X(FSGNJX_S, 0xfe00707f, 0x20002053, fdtype::fsgnjxs, MEM)                                      \
+    X(FMIN_S, 0xfe00707f, 0x28000053, fdtype::fmins, MEM)                                          \
+    X(FMAX_S, 0xfe00707f, 0x28001053, fdtype::fmaxs, MEM)                                          \
+    X(FCVT_W_S, 0xfff0007f, 0xc0000053, fdtype::fcvtws, MEM)                                       \
+    X(FCVT_WU_S, 0xfff0007f, 0xc0100053, fdtype::fcvtwus, MEM)                                     \
+    X(FCVT_L_S, 0xfff0007f, 0xc0200053, fdtype::fcvtls, MEM)                                       \
+    X(FCVT_LU_S, 0xfff0007f, 0xc0300053, fdtype::fcvtlus, MEM)                                     \
+    X(FMV_X_W, 0xfff0707f, 0xe0000053, fdtype::fmvxw, MEM)                                         \
+    X(FCLASS_S, 0xfff0707f, 0xe0001053, fdtype::fclasss, MEM)                                      \
+    X(FEQ_S, 0xfe00707f, 0xa0002053, fdtype::feqs, MEM)                                            \
+    X(FLT_S, 0xfe00707f, 0xa0001053, fdtype::flts, MEM)                                            \
+    X(FLE_S, 0xfe00707f, 0xa0000053, fdtype::fles, MEM)                                            \
+    X(FCVT_S_W, 0xfff0007f, 0xd0000053, fdtype::fcvtsw, MEM)                                       \
+    X(FCVT_S_WU, 0xfff0007f, 0xd0100053, fdtype::fcvtswu, MEM)                                     \
+    X(FCVT_S_L, 0xfff0007f, 0xd0200053, fdtype::fcvtsl, MEM)                                       \
+    X(FCVT_S_LU, 0xfff0007f, 0xd0300053, fdtype::fcvtslu, MEM)                                     \
+    X(FMV_W_X, 0xfff0707f, 0xf0000053, fdtype::fmvwx, MEM)                                         \
+    X(FADD_D, 0xfe00007f, 0x02000053, fdtype::faddd, MEM)                                          \
+    X(FSUB_D, 0xfe00007f, 0x0a000053, fdtype::fsubd, MEM)                                          \
+    X(FMUL_D, 0xfe00007f, 0x12000053, fdtype::fmuld, MEM)                                          \
+    X(FDIV_D, 0xfe00007f, 0x1a000053, fdtype::fdivd, MEM)                                          \
+    X(FSQRT_D, 0xfff0007f, 0x5a000053, fdtype::fsqrtd, MEM)                                        \
+    X(FSGNJ_D, 0xfe00707f, 0x22000053, fdtype::fsgnjd, MEM)                                        \
+    X(FSGNJN_D, 0xfe00707f, 0x22001053, fdtype::fsgnjnd, MEM)                                      \
+    X(FSGNJX_D, 0xfe00707f, 0x22002053, fdtype::fsgnjxd, MEM)                                      \
+    X(FMIN_D, 0xfe00707f, 0x2a000053, fdtype::fmind, MEM)                                          \
+    X(FMAX_D, 0xfe00707f, 0x2a001053, fdtype::fmaxd, MEM)                                          \
+    X(FCVT_S_D, 0xfff0007f, 0x40100053, fdtype::fcvtsd, MEM)                                       \
+    X(FCVT_D_S, 0xfff0007f, 0x42000053, fdtype::fcvtds, MEM)                                       \
+    X(FEQ_D, 0xfe00707f, 0xa2002053, fdtype::feqd, MEM)                                            \
+    X(FLT_D, 0xfe00707f, 0xa2001053, fdtype::fltd, MEM)                                            \
+    X(FLE_D, 0xfe00707f, 0xa2000053, fdtype::fled, MEM)                                            \
+    X(FCLASS_D, 0xfff0707f, 0xe2001053, fdtype::fclassd, MEM)                                      \
+    X(FCVT_W_D, 0xfff0007f, 0xc2000053, fdtype::fcvtwd, MEM)                                       \
+    X(FCVT_WU_D, 0xfff0007f, 0xc2100053, fdtype::fcvtwud, MEM)                                     \
+    X(FCVT_L_D, 0xfff0007f, 0xc2200053, fdtype::fcvtld, MEM)                                       \
+    X(FCVT_LU_D, 0xfff0007f, 0xc2300053, fdtype::fcvtlud, MEM)                                     \
+    X(FCVT_D_W, 0xfff0007f, 0xd2000053, fdtype::fcvtdw, MEM)                                       \
+    X(FCVT_D_WU, 0xfff0007f, 0xd2100053, fdtype::fcvtdwu, MEM)                                     \
+    X(FCVT_D_L, 0xfff0007f, 0xd2200053, fdtype::fcvtdl, MEM)                                       \
+    X(FCVT_D_LU, 0xfff0007f, 0xd2300053, fdtype::fcvtdlu, MEM)                                     \
+    X(FMV_X_D, 0xfff0707f, 0xe2000053, fdtype::fmvxd, MEM)                                         \
+    X(FMV_D_X, 0xfff0707f, 0xf2000053, fdtype::fmvdx, MEM)                                         \
+    X(C_ADDI4SPN, 0xe003, 0x0000, ctype::addi4spn, ALU)                                            \
+    X(C_FLD, 0xe003, 0x2000, ctype::fld, MEM)                                                      \
+    X(C_LW, 0xe003, 0x4000, ctype::lw, MEM)                                                        \
+    X(C_LD, 0xe003, 0x6000, ctype::ld, MEM)                                                        \
+    X(C_FSD, 0xe003, 0xa000, ctype::fsd, MEM)                                                      \
+    X(C_SW, 0xe003, 0xc000, ctype::sw, MEM)                                                        \
+    X(C_SD, 0xe003, 0xe000, ctype::sd, MEM)                                                        \
+    X(C_ADDI, 0xe003, 0x0001, ctype::addi, ALU)                                                    \
+    X(C_ADDIW, 0xe003, 0x2001, ctype::addiw, ALU)                                                  \
+    X(C_LI, 0xe003, 0x4001, ctype::li, ALU)                                                        \
+    X(C_ADDI16SP, 0xef83, 0x6101, ctype::addi16sp, ALU)                                            \
+    X(C_LUI, 0xe003, 0x6001, ctype::lui, ALU)                                                      \
+    X(C_SRLI, 0xec03, 0x8001, ctype::srli, ALU)                                                    \
+    X(C_SRAI, 0xec03, 0x8401, ctype::srai, ALU)                                                    \
+    X(C_ANDI, 0xec03, 0x8801, ctype::andi, ALU)                                                    \
+    X(C_SUB, 0xfc63, 0x8c01, ctype::sub, ALU)                                                      \
+    X(C_XOR, 0xfc63, 0x8c21, ctype::xor_, ALU)                                                     \
+    X(C_OR, 0xfc63, 0x8c41, ctype::or_, ALU)                                                       \
+    X(C_AND, 0xfc63, 0x8c61, ctype::and_, ALU)                                                     \
+    X(C_SUBW, 0xfc63, 0x9c01, ctype::subw, ALU)                                                    \
+    X(C_ADDW, 0xfc63, 0x9c21, ctype::addw, ALU)                                                    \
+    X(C_J, 0xe003, 0xa001, ctype::j, CTRL)                                                         \
+    X(C_BEQZ, 0xe003, 0xc001, ctype::beqz, CTRL)                                                   \
+    X(C_BNEZ, 0xe003, 0xe001, ctype::bnez, CTRL)                                                   \
+    X(C_SLLI, 0xe003, 0x0002, ctype::slli, ALU)                                                    \
+    X(C_FLDSP, 0xe003, 0x2002, ctype::fldsp, MEM)                                                  \
+    X(C_LWSP, 0xe003, 0x4002, ctype::lwsp, MEM)                                                    \
+    X(C_LDSP, 0xe003, 0x6002, ctype::ldsp, MEM)                                                    \
+    X(C_JR, 0xf07f, 0x8002, ctype::jr, CTRL)                                                       \
+    X(C_MV, 0xf003, 0x8002, ctype::mv, ALU)                                                        \
+    X(C_EBREAK, 0xffff, 0x9002, ctype::ebreak, CTRL)                                               \
+    X(C_JALR, 0xf07f, 0x9002, ctype::jalr, CTRL)                                                   \
+    X(C_ADD, 0xf003, 0x9002, ctype::add, ALU)                                                      \
+    X(C_FSDSP, 0xe003, 0xa002, ctype::fsdsp, MEM)                                                  \
+    X(C_SWSP, 0xe003, 0xc002, ctype::swsp, MEM)                                                    \
+    X(C_SDSP, 0xe003, 0xe002, ctype::sdsp, MEM)
+
+namespace insntable
+{
+
+using insn_handler_t = void (*)(Cpu&, Decoder);
+
+enum Flags : uint8_t
+{
+    // Cannot raise an exception or access memory
+    ALU = 0,
+    MAY_TRAP = 1 << 0,
+    ENDS_BLOCK = 1 << 1,
+
+    MEM = MAY_TRAP,
+    // May redirect the pc, change the privilege mode or change translation
+    CTRL = MAY_TRAP | ENDS_BLOCK,
+};
+
+#define INSNTABLE_ID(name, mask, match, handler, flags) name,
+enum class InsnId : uint16_t
+{
+    RV64GC_INSTRUCTIONS(INSNTABLE_ID) ILLEGAL
+};
+#undef INSNTABLE_ID
+
+InsnId decode(uint32_t insn);
+insn_handler_t handler(InsnId id);
+uint8_t flags(InsnId id);
+
+void illegal(Cpu& cpu, Decoder decoder);
+} // namespace insntable
@@ -5,8 +5,6 @@
 
 namespace itype
 {
-void funct3(Cpu& cpu, Decoder decoder);
-
 void addi(Cpu& cpu, Decoder decoder);
 void slli(Cpu& cpu, Decoder decoder);
 void slti(Cpu& cpu, Decoder decoder);
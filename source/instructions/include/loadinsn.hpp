@@ -6,8 +6,6 @@
 namespace load
 {
 
-void funct3(Cpu& cpu, Decoder insn);
-
 void lb(Cpu& cpu, Decoder insn);
 void lh(Cpu& cpu, Decoder insn);
 void lw(Cpu& cpu, Decoder insn);
@@ -5,8 +5,6 @@
 
 namespace r64
 {
-void funct3(Cpu& cpu, Decoder decoder);
-
 void addw(Cpu& cpu, Decoder decoder);
 void mulw(Cpu& cpu, Decoder decoder);
 void subw(Cpu& cpu, Decoder decoder);
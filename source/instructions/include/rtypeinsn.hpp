@@ -5,8 +5,6 @@
 
 namespace rtype
 {
-void funct3(Cpu& cpu, Decoder decoder);
-
 void add(Cpu& cpu, Decoder decoder);
 void mul(Cpu& cpu, Decoder decoder);
 void sub(Cpu& cpu, Decoder decoder);
@@ -5,8 +5,6 @@
 
 namespace stype
 {
-void funct3(Cpu& cpu, Decoder decoder);
-
 void sb(Cpu& cpu, Decoder decoder);
 void sh(Cpu& cpu, Decoder decoder);
 void sw(Cpu& cpu, Decoder decoder);
@@ -0,0 +1,160 @@
+#include "insntable.hpp"
+#include "atomictype.hpp"
+#include "btypeinsn.hpp"
+#include "csrtypeinsn.hpp"
+#include "ctypeinsn.hpp"
+#include "decoder.hpp"
+#include "fdtypeinsn.hpp"
+#include "i64insn.hpp"
+#include "itypeinsn.hpp"
+#include "loadinsn.hpp"
+#include "otherinsn.hpp"
+#include "r64insn.hpp"
+#include "rtypeinsn.hpp"
+#include "stypeinsn.hpp"
+#include <array>
+#include <memory>
+#include <vector>
+
+namespace insntable
+{
+
+struct Entry
+{
+    uint32_t mask;
+    uint32_t match;
+    insn_handler_t handler;
+    uint8_t flags;
+};
+
+#define INSNTABLE_ENTRY(name, mask, match, handler, flags) {mask, match, handler, flags},
+static const Entry entries[] = {RV64GC_INSTRUCTIONS(INSNTABLE_ENTRY){0, 0, illegal, CTRL}};
+#undef INSNTABLE_ENTRY
+
+constexpr uint64_t entry_count = sizeof(entries) / sizeof(entries[0]);
+static_assert(entry_count == static_cast<uint64_t>(InsnId::ILLEGAL) + 1);
+
+// 32 bit instructions are indexed by opcode[6:2], funct3 and funct7, which tells apart all
+// of them except the few that also look at rs2 or the whole encoding
+constexpr uint64_t key_bits = 15;
+
+static uint32_t key(uint32_t insn)
+{
+    return ((insn >> 2U) & 0x1fU) | (((insn >> 12U) & 0x07U) << 5U) | ((insn >> 25U) << 8U);
+}
+
+struct Tables
+{
+    // Candidates for a key are candidates[first, first + count), in list order
+    struct Slot
+    {
+        uint16_t first;
+        uint16_t count;
+    };
+
+    std::array<InsnId, 1U << 16U> compressed;
+    std::array<Slot, 1U << key_bits> slots;
+    std::vector<InsnId> candidates;
+};
+
+static std::unique_ptr<Tables> build()
+{
+    auto tables = std::make_unique<Tables>();
+
+    // The all zero halfword is defined to be illegal, so the loop starts at 1
+    tables->compressed.fill(InsnId::ILLEGAL);
+
+    for (uint32_t insn = 1; insn < tables->compressed.size(); insn++)
+    {
+        if ((insn & 0x03U) == 0x03U)
+        {
+            continue;
+        }
+
+        for (uint64_t i = 0; i < entry_count - 1; i++)
+        {
+            if ((entries[i].match & 0x03U) != 0x03U && (insn & entries[i].mask) == entries[i].match)
+            {
+                tables->compressed[insn] = static_cast<InsnId>(i);
+                break;
+            }
+        }
+    }
+
+    std::vector<std::vector<InsnId>> per_key(tables->slots.size());
+
+    for (uint64_t i = 0; i < entry_count - 1; i++)
+    {
+        if ((entries[i].match & 0x03U) != 0x03U)
+        {
+            continue;
+        }
+
+        uint32_t key_mask = key(entries[i].mask);
+        uint32_t key_match = key(entries[i].match);
+
+        for (uint32_t k = 0; k < per_key.size(); k++)
+        {
+            if ((k & key_mask) == key_match)
+            {
+                per_key[k].push_back(static_cast<InsnId>(i));
+            }
+        }
+    }
+
+    for (uint32_t k = 0; k < per_key.size(); k++)
+    {
+        tables->slots[k] = {static_cast<uint16_t>(tables->candidates.size()),
+                            static_cast<uint16_t>(per_key[k].size())};
+        tables->candidates.insert(tables->candidates.end(), per_key[k].begin(), per_key[k].end());
+    }
+
+    return tables;
+}
+
+static const Tables& tables()
+{
+    static const std::unique_ptr<Tables> instance = build();
+
+    return *instance;
+}
+
+InsnId decode(uint32_t insn)
+{
+    const Tables& t = tables();
+
+    if ((insn & 0x03U) != 0x03U)
+    {
+        return t.compressed[insn & 0xffffU];
+    }
+
+    Tables::Slot slot = t.slots[key(insn)];
+
+    for (uint16_t i = slot.first; i < slot.first + slot.count; i++)
+    {
+        const Entry& entry = entries[static_cast<uint16_t>(t.candidates[i])];
+
+        if ((insn & entry.mask) == entry.match)
+        {
+            return t.candidates[i];
+        }
+    }
+
+    return InsnId::ILLEGAL;
+}
+
+insn_handler_t handler(InsnId id)
+{
+    return entries[static_cast<uint16_t>(id)].handler;
+}
+
+uint8_t flags(InsnId id)
+{
+    return entries[static_cast<uint16_t>(id)].flags;
+}
+
+void illegal(Cpu& cpu, Decoder decoder)
+{
+    cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
+}
+} // namespace insntable
@@ -1,50 +1,5 @@
 #include "itypeinsn.hpp"
 
-void itype::funct3(Cpu& cpu, Decoder decoder)
-{
-    switch (decoder.funct3())
-    {
-    case IType::ADDI:
-        addi(cpu, decoder);
-        break;
-    case IType::SLLI:
-        slli(cpu, decoder);
-        break;
-    case IType::SLTI:
-        slti(cpu, decoder);
-        break;
-    case IType::SLTIU:
-        sltiu(cpu, decoder);
-        break;
-    case IType::XORI:
-        xori(cpu, decoder);
-        break;
-    case IType::SRI:
-        switch (decoder.funct7() >> 1)
-        {
-        case IType::SRLI:
-            srli(cpu, decoder);
-            break;
-        case IType::SRAI:
-            srai(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case IType::ORI:
-        ori(cpu, decoder);
-        break;
-    case IType::ANDI:
-        andi(cpu, decoder);
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-}
-
 void itype::addi(Cpu& cpu, Decoder decoder)
 {
     int64_t imm = decoder.imm_i();
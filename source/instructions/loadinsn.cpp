@@ -1,37 +1,6 @@
 #include "loadinsn.hpp"
 #include "helper.hpp"
 
-void load::funct3(Cpu& cpu, Decoder decoder)
-{
-    switch (decoder.funct3())
-    {
-    case LOADType::LB:
-        load::lb(cpu, decoder);
-        break;
-    case LOADType::LH:
-        load::lh(cpu, decoder);
-        break;
-    case LOADType::LW:
-        load::lw(cpu, decoder);
-        break;
-    case LOADType::LD:
-        load::ld(cpu, decoder);
-        break;
-    case LOADType::LBU:
-        load::lbu(cpu, decoder);
-        break;
-    case LOADType::LHU:
-        load::lhu(cpu, decoder);
-        break;
-    case LOADType::LWU:
-        load::lwu(cpu, decoder);
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-}
-
 #define ASSIGN_IF_NO_EXCEPTION(rd, load_expr)                                                      \
     uint64_t _check_temp = (load_expr);                                                            \
     if (cpu.exc_val == exception::Exception::None) [[likely]]                                      \
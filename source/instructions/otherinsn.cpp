@@ -3,6 +3,10 @@
 
 void fence::fence(Cpu& cpu, Decoder decoder)
 {
+    if (decoder.funct3() == FenceType::FENCEI)
+    {
+        cpu.icache.flush();
+    }
 }
 
 void jal::jal(Cpu& cpu, Decoder decoder)
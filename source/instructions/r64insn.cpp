@@ -3,62 +3,6 @@
 #include "helper.hpp"
 #include <limits>
 
-void r64::funct3(Cpu& cpu, Decoder decoder)
-{
-    switch (decoder.funct3())
-    {
-    case R64Type::ADDSUBW:
-        switch (decoder.funct7())
-        {
-        case R64Type::ADDW:
-            addw(cpu, decoder);
-            break;
-        case R64Type::MULW:
-            mulw(cpu, decoder);
-            break;
-        case R64Type::SUBW:
-            subw(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case R64Type::DIVW:
-        divw(cpu, decoder);
-        break;
-    case R64Type::SLLW:
-        sllw(cpu, decoder);
-        break;
-    case R64Type::SRW:
-        switch (decoder.funct7())
-        {
-        case R64Type::SRLW:
-            srlw(cpu, decoder);
-            break;
-        case R64Type::DIVUW:
-            divuw(cpu, decoder);
-            break;
-        case R64Type::SRAW:
-            sraw(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case R64Type::REMW:
-        remw(cpu, decoder);
-        break;
-    case R64Type::REMUW:
-        remuw(cpu, decoder);
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-}
-
 void r64::addw(Cpu& cpu, Decoder decoder)
 {
     Cpu::reg_name rd = decoder.rd();
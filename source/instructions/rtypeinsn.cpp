@@ -3,134 +3,6 @@
 #include "helper.hpp"
 #include <limits>
 
-void rtype::funct3(Cpu& cpu, Decoder decoder)
-{
-    switch (decoder.funct3())
-    {
-    case RType::ADDMULSUB:
-        switch (decoder.funct7())
-        {
-        case RType::ADD:
-            add(cpu, decoder);
-            break;
-        case RType::MUL:
-            mul(cpu, decoder);
-            break;
-        case RType::SUB:
-            sub(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case RType::SLLMULH:
-        switch (decoder.funct7())
-        {
-        case RType::SLL:
-            sll(cpu, decoder);
-            break;
-        case RType::MULH:
-            mulh(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case RType::SLTMULHSU:
-        switch (decoder.funct7())
-        {
-        case RType::SLT:
-            slt(cpu, decoder);
-            break;
-        case RType::MULHSU:
-            mulhsu(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case RType::SLTUMULHU:
-        switch (decoder.funct7())
-        {
-        case RType::SLTU:
-            sltu(cpu, decoder);
-            break;
-        case RType::MULHU:
-            mulhu(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case RType::XORDIV:
-        switch (decoder.funct7())
-        {
-        case RType::XOR:
-            xor_(cpu, decoder);
-            break;
-        case RType::DIV:
-            div(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case RType::SR:
-        switch (decoder.funct7())
-        {
-        case RType::SRL:
-            srl(cpu, decoder);
-            break;
-        case RType::DIVU:
-            divu(cpu, decoder);
-            break;
-        case RType::SRA:
-            sra(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case RType::ORREM:
-        switch (decoder.funct7())
-        {
-        case RType::OR:
-            or_(cpu, decoder);
-            break;
-        case RType::REM:
-            rem(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    case RType::ANDREMU:
-        switch (decoder.funct7())
-        {
-        case RType::AND:
-            and_(cpu, decoder);
-            break;
-        case RType::REMU:
-            remu(cpu, decoder);
-            break;
-        default:
-            cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-            break;
-        }
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    };
-}
-
 void rtype::add(Cpu& cpu, Decoder decoder)
 {
     Cpu::reg_name rd = decoder.rd();
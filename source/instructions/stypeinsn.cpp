@@ -2,28 +2,6 @@
 
 #include "helper.hpp"
 
-void stype::funct3(Cpu& cpu, Decoder decoder)
-{
-    switch (decoder.funct3())
-    {
-    case SType::SB:
-        sb(cpu, decoder);
-        break;
-    case SType::SH:
-        sh(cpu, decoder);
-        break;
-    case SType::SW:
-        sw(cpu, decoder);
-        break;
-    case SType::SD:
-        sd(cpu, decoder);
-        break;
-    default:
-        cpu.set_exception(exception::Exception::IllegalInstruction, decoder.insn);
-        break;
-    }
-}
-
 void stype::sb(Cpu& cpu, Decoder decoder)
 {
     int64_t imm = decoder.imm_s();
@@ -1,52 +1,41 @@
+#include "clint.hpp"
 #include "cpu.hpp"
 #include "gpu.hpp"
 #include "interupt.hpp"
 #include "plic.hpp"
-#include "virtio.hpp"
 #include <fmt/core.h>
 
-interrupt::Interrupt::InterruptValue interrupt::get_pending_interrupt(Cpu& cpu)
+static bool interrupts_enabled(Cpu& cpu)
 {
     switch (cpu.mode)
     {
     case cpu::Mode::Machine:
-        if (cpu.cregs.read_bit_mstatus(csr::Mask::MSTATUSBit::MIE) == 0 && !cpu.sleep)
-        {
-            return interrupt::Interrupt::None;
-        }
-        break;
+        return cpu.cregs.read_bit_mstatus(csr::Mask::MSTATUSBit::MIE) == 1 || cpu.sleep;
     case cpu::Mode::Supervisor:
-        if (cpu.cregs.read_bit_sstatus(csr::Mask::SSTATUSBit::SIE) == 0 && !cpu.sleep)
-        {
-            return interrupt::Interrupt::None;
-        }
-        break;
+        return cpu.cregs.read_bit_sstatus(csr::Mask::SSTATUSBit::SIE) == 1 || cpu.sleep;
     default:
-        break;
+        return true;
+    }
+}
+
+interrupt::Interrupt::InterruptValue interrupt::get_pending_interrupt(Cpu& cpu)
+{
+    if (!interrupts_enabled(cpu))
+    {
+        return interrupt::Interrupt::None;
     }
 
 #if !CPU_TEST
-    std::optional<uint32_t> irqn;
+    std::unique_lock<std::mutex> lock = cpu.bus.lock_devices();
 
-    do
-    {
-        // A crude sorting method
-        if ((cpu.virtio_blk_device != nullptr) && (irqn = cpu.virtio_blk_device->is_interrupting()))
-            [[unlikely]]
-        {
-            break;
-        }
+    // Another hart may have sent an IPI or moved mtimecmp since the last tick
+    cpu.clint_device->update_interrupts(cpu);
 
-        if ((irqn = cpu.gpu_device->is_interrupting())) [[unlikely]]
-        {
-            break;
-        }
-    } while (false);
+    uint64_t context = PlicDevice::supervisor_context(cpu.hart_id);
 
-    if (irqn) [[unlikely]]
+    // The PLIC tells the harts it has an irq for, but another one may have claimed it since
+    if (cpu.plic_device->get_best_irq(context) != 0) [[unlikely]]
     {
-        cpu.plic_device.update_pending(*irqn);
-
         cpu.cregs.write_bit(csr::Address::MIP, csr::Mask::SEIP_BIT, 1);
     }
 #endif
@@ -94,9 +83,18 @@ interrupt::Interrupt::InterruptValue interrupt::get_pending_interrupt(Cpu& cpu)
     return interrupt::Interrupt::None;
 }
 
+bool interrupt::may_be_pending(Cpu& cpu)
+{
+    uint64_t pending = cpu.cregs.load(csr::Address::MIE) & cpu.cregs.load(csr::Address::MIP);
+
+    // Only this hart's own bits, devices and other harts notify it of anything new
+    return interrupts_enabled(cpu) && pending != 0;
+}
+
 void interrupt::process(Cpu& cpu, Interrupt::InterruptValue int_val)
 {
     cpu.sleep = false;
+    cpu.cregs.interrupts_dirty.store(true, std::memory_order_relaxed);
 
     uint64_t pc = cpu.pc;
     cpu::Mode mode = cpu.mode;
@@ -167,6 +165,7 @@ void interrupt::process(Cpu& cpu, Interrupt::InterruptValue int_val)
 void exception::process(Cpu& cpu)
 {
     cpu.sleep = false;
+    cpu.cregs.interrupts_dirty.store(true, std::memory_order_relaxed);
 
     uint64_t pc = cpu.pc;
     cpu::Mode mode = cpu.mode;
@@ -0,0 +1,782 @@
+#include "jit.hpp"
+#include "block.hpp"
+#include "cpu.hpp"
+#include "decoder.hpp"
+#include "helper.hpp"
+#include "insntable.hpp"
+#include <cstring>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define JIT_X86_64 1
+#include <sys/mman.h>
+#else
+#define JIT_X86_64 0
+#endif
+
+namespace jit
+{
+
+#if JIT_X86_64
+
+constexpr uint64_t code_buffer_size = SIZE_MIB(16);
+
+// Upper bound of the code a single guest instruction and its exit stub can produce
+constexpr uint64_t max_insn_code_size = 192;
+
+enum class Op
+{
+    Fallback,
+    Nop,
+    Li,
+    Addi,
+    Slti,
+    Sltiu,
+    Xori,
+    Ori,
+    Andi,
+    Slli,
+    Srli,
+    Srai,
+    Add,
+    Sub,
+    Sll,
+    Slt,
+    Sltu,
+    Xor,
+    Srl,
+    Or,
+    And,
+    Mul,
+    Addiw,
+    Slliw,
+    Srliw,
+    Sraiw,
+    Addw,
+    Subw,
+    Sllw,
+    Srlw,
+    Sraw,
+    Mulw,
+    Auipc,
+    Jal,
+    Jalr,
+    JrNoMask,
+    Beq,
+    Bne,
+    Blt,
+    Bge,
+    Bltu,
+    Bgeu,
+};
+
+struct Lowered
+{
+    Op op = Op::Fallback;
+    uint64_t rd = 0;
+    uint64_t rs1 = 0;
+    uint64_t rs2 = 0;
+    int64_t imm = 0;
+};
+
+static int64_t sign_extend(uint64_t value, uint32_t bits)
+{
+    uint64_t shift = 64 - bits;
+
+    return static_cast<int64_t>(value << shift) >> shift;
+}
+
+static Lowered lower(const icache::CachedInsn& cached)
+{
+    using insntable::InsnId;
+
+    Decoder decoder = Decoder(cached.insn);
+    uint32_t insn = cached.insn;
+    uint64_t rd = decoder.rd();
+    uint64_t rs1 = decoder.rs1();
+    uint64_t rs2 = decoder.rs2();
+    int64_t imm_i = decoder.imm_i();
+    uint64_t rs1_c = decoder.compressed_rs1();
+    uint64_t rs2_c = decoder.compressed_rs2();
+    uint64_t rs2_cr = (insn >> 2U) & 0x1fU;
+    int64_t imm6 = sign_extend(((insn >> 7U) & 0x20U) | ((insn >> 2U) & 0x1fU), 6);
+    int64_t shamt_c = static_cast<int64_t>(decoder.compressed_shamt());
+
+    switch (cached.id)
+    {
+    case InsnId::ADDI:
+        return {Op::Addi, rd, rs1, 0, imm_i};
+    case InsnId::SLLI:
+        return {Op::Slli, rd, rs1, 0, decoder.shamt()};
+    case InsnId::SLTI:
+        return {Op::Slti, rd, rs1, 0, imm_i};
+    case InsnId::SLTIU:
+        return {Op::Sltiu, rd, rs1, 0, imm_i};
+    case InsnId::XORI:
+        return {Op::Xori, rd, rs1, 0, imm_i};
+    case InsnId::SRLI:
+        return {Op::Srli, rd, rs1, 0, decoder.shamt()};
+    case InsnId::SRAI:
+        return {Op::Srai, rd, rs1, 0, decoder.shamt()};
+    case InsnId::ORI:
+        return {Op::Ori, rd, rs1, 0, imm_i};
+    case InsnId::ANDI:
+        return {Op::Andi, rd, rs1, 0, imm_i};
+    case InsnId::ADD:
+        return {Op::Add, rd, rs1, rs2};
+    case InsnId::MUL:
+        return {Op::Mul, rd, rs1, rs2};
+    case InsnId::SUB:
+        return {Op::Sub, rd, rs1, rs2};
+    case InsnId::SLL:
+        return {Op::Sll, rd, rs1, rs2};
+    case InsnId::SLT:
+        return {Op::Slt, rd, rs1, rs2};
+    case InsnId::SLTU:
+        return {Op::Sltu, rd, rs1, rs2};
+    case InsnId::XOR:
+        return {Op::Xor, rd, rs1, rs2};
+    // sra is left to the interpreter so that both modes agree bit for bit
+    case InsnId::SRL:
+        return {Op::Srl, rd, rs1, rs2};
+    case InsnId::OR:
+        return {Op::Or, rd, rs1, rs2};
+    case InsnId::AND:
+        return {Op::And, rd, rs1, rs2};
+    case InsnId::ADDIW:
+        return {Op::Addiw, rd, rs1, 0, imm_i};
+    case InsnId::SLLIW:
+        return {Op::Slliw, rd, rs1, 0, decoder.shamt()};
+    case InsnId::SRLIW:
+        return {Op::Srliw, rd, rs1, 0, decoder.shamt()};
+    case InsnId::SRAIW:
+        return {Op::Sraiw, rd, rs1, 0, decoder.shamt() & 0x1f};
+    case InsnId::ADDW:
+        return {Op::Addw, rd, rs1, rs2};
+    case InsnId::MULW:
+        return {Op::Mulw, rd, rs1, rs2};
+    case InsnId::SUBW:
+        return {Op::Subw, rd, rs1, rs2};
+    case InsnId::SLLW:
+        return {Op::Sllw, rd, rs1, rs2};
+    case InsnId::SRLW:
+        return {Op::Srlw, rd, rs1, rs2};
+    case InsnId::SRAW:
+        return {Op::Sraw, rd, rs1, rs2};
+    case InsnId::LUI:
+        return {Op::Li, rd, 0, 0, SIGNEXTEND_CAST2(insn & 0xfffff000U, int32_t)};
+    case InsnId::AUIPC:
+        return {Op::Auipc, rd, 0, 0, SIGNEXTEND_CAST2(insn & 0xfffff000U, int32_t)};
+    case InsnId::JAL:
+        return {Op::Jal, rd, 0, 0, static_cast<int64_t>(decoder.imm_j())};
+    case InsnId::JALR:
+        return {Op::Jalr, rd, rs1, 0, imm_i};
+    case InsnId::BEQ:
+        return {Op::Beq, 0, rs1, rs2, static_cast<int64_t>(decoder.imm_b())};
+    case InsnId::BNE:
+        return {Op::Bne, 0, rs1, rs2, static_cast<int64_t>(decoder.imm_b())};
+    case InsnId::BLT:
+        return {Op::Blt, 0, rs1, rs2, static_cast<int64_t>(decoder.imm_b())};
+    case InsnId::BGE:
+        return {Op::Bge, 0, rs1, rs2, static_cast<int64_t>(decoder.imm_b())};
+    case InsnId::BLTU:
+        return {Op::Bltu, 0, rs1, rs2, static_cast<int64_t>(decoder.imm_b())};
+    case InsnId::BGEU:
+        return {Op::Bgeu, 0, rs1, rs2, static_cast<int64_t>(decoder.imm_b())};
+    case InsnId::C_ADDI:
+        return {Op::Addi, rd, rd, 0, imm6};
+    case InsnId::C_ADDIW:
+        return rd != 0 ? Lowered{Op::Addiw, rd, rd, 0, imm6} : Lowered{};
+    case InsnId::C_LI:
+        return {Op::Li, rd, 0, 0, imm6};
+    case InsnId::C_ADDI16SP: {
+        uint64_t imm = ((insn >> 3U) & 0x200U) | ((insn >> 2U) & 0x10U) | ((insn << 1U) & 0x40U) |
+                       ((insn << 4U) & 0x180U) | ((insn << 3U) & 0x20U);
+
+        return {Op::Addi, Cpu::reg_abi_name::sp, Cpu::reg_abi_name::sp, 0, sign_extend(imm, 10)};
+    }
+    case InsnId::C_LUI: {
+        uint64_t imm = ((insn << 5U) & 0x20000U) | ((insn << 10U) & 0x1f000U);
+
+        return rd != 0 ? Lowered{Op::Li, rd, 0, 0, sign_extend(imm, 18)} : Lowered{Op::Nop};
+    }
+    case InsnId::C_SRLI:
+        return {Op::Srli, rs1_c, rs1_c, 0, shamt_c};
+    case InsnId::C_SRAI:
+        return {Op::Srai, rs1_c, rs1_c, 0, shamt_c};
+    case InsnId::C_ANDI:
+        return {Op::Andi, rs1_c, rs1_c, 0, imm6};
+    case InsnId::C_SUB:
+        return {Op::Sub, rs1_c, rs1_c, rs2_c};
+    case InsnId::C_XOR:
+        return {Op::Xor, rs1_c, rs1_c, rs2_c};
+    case InsnId::C_OR:
+        return {Op::Or, rs1_c, rs1_c, rs2_c};
+    case InsnId::C_AND:
+        return {Op::And, rs1_c, rs1_c, rs2_c};
+    case InsnId::C_SUBW:
+        return {Op::Subw, rs1_c, rs1_c, rs2_c};
+    case InsnId::C_ADDW:
+        return {Op::Addw, rs1_c, rs1_c, rs2_c};
+    case InsnId::C_J: {
+        uint64_t imm = ((insn >> 1U) & 0x800U) | ((insn << 2U) & 0x400U) | ((insn >> 1U) & 0x300U) |
+                       ((insn << 1U) & 0x80U) | ((insn >> 1U) & 0x40U) | ((insn << 3U) & 0x20U) |
+                       ((insn >> 7U) & 0x10U) | ((insn >> 2U) & 0xeU);
+
+        return {Op::Jal, 0, 0, 0, sign_extend(imm, 12)};
+    }
+    case InsnId::C_BEQZ:
+    case InsnId::C_BNEZ: {
+        uint64_t imm = ((insn >> 4U) & 0x100U) | ((insn << 1U) & 0xc0U) | ((insn << 3U) & 0x20U) |
+                       ((insn >> 7U) & 0x18U) | ((insn >> 2U) & 0x6U);
+        Op op = cached.id == InsnId::C_BEQZ ? Op::Beq : Op::Bne;
+
+        return {op, 0, rs1_c, 0, sign_extend(imm, 9)};
+    }
+    case InsnId::C_SLLI:
+        return {Op::Slli, rd, rd, 0, shamt_c};
+    case InsnId::C_JR:
+        return rd != 0 ? Lowered{Op::JrNoMask, 0, rd} : Lowered{};
+    case InsnId::C_MV:
+        return {Op::Add, rd, 0, rs2_cr};
+    // c.jalr and c.ebreak stay with the interpreter
+    case InsnId::C_ADD:
+        return {Op::Add, rd, rd, rs2_cr};
+    default:
+        return {};
+    }
+}
+
+class Emitter
+{
+  public:
+    Emitter(uint8_t* start, uint8_t* end) : cur(start), end(end)
+    {
+    }
+
+    bool has_space(uint64_t size) const
+    {
+        return cur + size <= end;
+    }
+
+    void u8(uint8_t value)
+    {
+        *cur++ = value;
+    }
+
+    void bytes(std::initializer_list<uint8_t> values)
+    {
+        for (uint8_t value : values)
+        {
+            u8(value);
+        }
+    }
+
+    void u32(uint32_t value)
+    {
+        memcpy(cur, &value, sizeof(value));
+        cur += sizeof(value);
+    }
+
+    void u64(uint64_t value)
+    {
+        memcpy(cur, &value, sizeof(value));
+        cur += sizeof(value);
+    }
+
+    // Host register numbers, only rax (0), rcx (1) and rdx (2) are used as scratch
+    void load_reg(uint8_t host, uint64_t guest)
+    {
+        if (guest == 0)
+        {
+            // xor host32, host32
+            bytes({0x31, static_cast<uint8_t>(0xc0 | (host << 3) | host)});
+            return;
+        }
+
+        // mov host, [rbx + guest * 8]
+        bytes({0x48, 0x8b, static_cast<uint8_t>(0x80 | (host << 3) | 3)});
+        u32(guest * sizeof(uint64_t));
+    }
+
+    void store_rax(uint64_t guest)
+    {
+        if (guest == 0)
+        {
+            return;
+        }
+
+        // mov [rbx + guest * 8], rax
+        bytes({0x48, 0x89, 0x83});
+        u32(guest * sizeof(uint64_t));
+    }
+
+    // lea host, [r14 + offset], r14 holds the virtual pc of the block entry
+    void lea_pc(uint8_t host, int32_t offset)
+    {
+        bytes({0x49, 0x8d, static_cast<uint8_t>(0x86 | (host << 3))});
+        u32(offset);
+    }
+
+    void store_pc_rax(int32_t pc_disp)
+    {
+        // mov [rbx + pc_disp], rax
+        bytes({0x48, 0x89, 0x83});
+        u32(pc_disp);
+    }
+
+    void alu_imm(uint8_t ext, int64_t imm)
+    {
+        // op rax, imm32
+        bytes({0x48, 0x81, static_cast<uint8_t>(0xc0 | (ext << 3))});
+        u32(static_cast<uint32_t>(imm));
+    }
+
+    void shift_imm(bool wide, uint8_t ext, uint64_t amount)
+    {
+        if (wide)
+        {
+            u8(0x48);
+        }
+
+        bytes({0xc1, static_cast<uint8_t>(0xc0 | (ext << 3)), static_cast<uint8_t>(amount)});
+    }
+
+    void shift_cl(bool wide, uint8_t ext)
+    {
+        if (wide)
+        {
+            u8(0x48);
+        }
+
+        bytes({0xd3, static_cast<uint8_t>(0xc0 | (ext << 3))});
+    }
+
+    void sign_extend_eax()
+    {
+        // movsxd rax, eax
+        bytes({0x48, 0x63, 0xc0});
+    }
+
+    void set_flag_rax(uint8_t cc)
+    {
+        // setcc al; movzx eax, al
+        bytes({0x0f, cc, 0xc0, 0x0f, 0xb6, 0xc0});
+    }
+
+    uint8_t* jne_rel32()
+    {
+        bytes({0x0f, 0x85});
+        uint8_t* patch = cur;
+        u32(0);
+
+        return patch;
+    }
+
+    void epilogue(uint32_t executed)
+    {
+        // mov eax, executed
+        u8(0xb8);
+        u32(executed);
+
+        // add rsp, 8; pop r14; pop r13; pop r12; pop rbx; ret
+        bytes({0x48, 0x83, 0xc4, 0x08, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3});
+    }
+
+  public:
+    uint8_t* cur;
+    uint8_t* end;
+};
+
+struct Exit
+{
+    uint8_t* patch;
+    uint32_t executed;
+    bool set_pc;
+    int32_t pc_offset;
+};
+
+Jit::~Jit()
+{
+    if (buffer != nullptr)
+    {
+        munmap(buffer, buffer_size);
+    }
+}
+
+bool Jit::init()
+{
+    if (buffer == nullptr)
+    {
+        void* mem = mmap(nullptr, code_buffer_size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (mem == MAP_FAILED)
+        {
+            return false;
+        }
+
+        buffer = static_cast<uint8_t*>(mem);
+        buffer_size = code_buffer_size;
+    }
+
+    used = 0;
+    enabled = true;
+
+    return true;
+}
+
+void Jit::flush()
+{
+    used = 0;
+}
+
+bool Jit::is_supported()
+{
+    return true;
+}
+
+compiled_block_t Jit::compile(Cpu& cpu, const block::Block& block)
+{
+    auto disp = [&](const void* member) {
+        return static_cast<int32_t>(reinterpret_cast<const uint8_t*>(member) -
+                                    reinterpret_cast<const uint8_t*>(cpu.regs.data()));
+    };
+
+    const int32_t regs_disp = static_cast<int32_t>(
+        reinterpret_cast<const uint8_t*>(cpu.regs.data()) - reinterpret_cast<const uint8_t*>(&cpu));
+    const int32_t pc_disp = disp(&cpu.pc);
+    const int32_t exc_disp = disp(&cpu.exc_val);
+    const int32_t generation_disp = disp(&cpu.icache.generation);
+
+    uint8_t* start = buffer + used;
+    Emitter e(start, buffer + buffer_size);
+
+    if (!e.has_space(64 + block.insns.size() * max_insn_code_size))
+    {
+        return nullptr;
+    }
+
+    std::vector<Exit> exits;
+
+    // push rbx; push r12; push r13; push r14; sub rsp, 8
+    e.bytes({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x48, 0x83, 0xec, 0x08});
+    // mov r12, rdi
+    e.bytes({0x49, 0x89, 0xfc});
+    // lea rbx, [rdi + regs_disp]
+    e.bytes({0x48, 0x8d, 0x9f});
+    e.u32(regs_disp);
+    // mov r14, [rbx + pc_disp]
+    e.bytes({0x4c, 0x8b, 0xb3});
+    e.u32(pc_disp);
+    // mov r13, [rbx + generation_disp]
+    e.bytes({0x4c, 0x8b, 0xab});
+    e.u32(generation_disp);
+
+    int32_t offset = 0;
+    bool pc_written = false;
+
+    for (uint64_t i = 0; i < block.insns.size(); i++)
+    {
+        const icache::CachedInsn& insn = block.insns[i];
+        Lowered l = lower(insn);
+        int32_t next = offset + insn.size;
+        bool last = i + 1 == block.insns.size();
+
+        switch (l.op)
+        {
+        case Op::Nop:
+            break;
+        case Op::Li:
+            // mov rax, imm32
+            e.bytes({0x48, 0xc7, 0xc0});
+            e.u32(static_cast<uint32_t>(l.imm));
+            e.store_rax(l.rd);
+            break;
+        case Op::Addi:
+        case Op::Xori:
+        case Op::Ori:
+        case Op::Andi: {
+            uint8_t ext = l.op == Op::Addi   ? 0
+                          : l.op == Op::Xori ? 6
+                          : l.op == Op::Ori  ? 1
+                                             : 4;
+            e.load_reg(0, l.rs1);
+            e.alu_imm(ext, l.imm);
+            e.store_rax(l.rd);
+            break;
+        }
+        case Op::Slti:
+        case Op::Sltiu:
+            e.load_reg(0, l.rs1);
+            e.alu_imm(7, l.imm);
+            e.set_flag_rax(l.op == Op::Slti ? 0x9c : 0x92);
+            e.store_rax(l.rd);
+            break;
+        case Op::Slli:
+        case Op::Srli:
+        case Op::Srai:
+        case Op::Slliw:
+        case Op::Srliw:
+        case Op::Sraiw: {
+            bool wide = l.op == Op::Slli || l.op == Op::Srli || l.op == Op::Srai;
+            uint8_t ext = (l.op == Op::Slli || l.op == Op::Slliw)   ? 4
+                          : (l.op == Op::Srli || l.op == Op::Srliw) ? 5
+                                                                    : 7;
+            e.load_reg(0, l.rs1);
+            e.shift_imm(wide, ext, l.imm & 0x3f);
+
+            if (!wide)
+            {
+                e.sign_extend_eax();
+            }
+
+            e.store_rax(l.rd);
+            break;
+        }
+        case Op::Addiw:
+            e.load_reg(0, l.rs1);
+            // add eax, imm32
+            e.bytes({0x81, 0xc0});
+            e.u32(static_cast<uint32_t>(l.imm));
+            e.sign_extend_eax();
+            e.store_rax(l.rd);
+            break;
+        case Op::Add:
+        case Op::Sub:
+        case Op::Xor:
+        case Op::Or:
+        case Op::And:
+        case Op::Addw:
+        case Op::Subw: {
+            bool wide = l.op != Op::Addw && l.op != Op::Subw;
+            uint8_t opcode = (l.op == Op::Add || l.op == Op::Addw)   ? 0x01
+                             : (l.op == Op::Sub || l.op == Op::Subw) ? 0x29
+                             : l.op == Op::Xor                       ? 0x31
+                             : l.op == Op::Or                        ? 0x09
+                                                                     : 0x21;
+            e.load_reg(0, l.rs1);
+            e.load_reg(1, l.rs2);
+
+            if (wide)
+            {
+                e.u8(0x48);
+            }
+
+            // op rax, rcx
+            e.bytes({opcode, 0xc8});
+
+            if (!wide)
+            {
+                e.sign_extend_eax();
+            }
+
+            e.store_rax(l.rd);
+            break;
+        }
+        case Op::Mul:
+        case Op::Mulw:
+            e.load_reg(0, l.rs1);
+            e.load_reg(1, l.rs2);
+
+            if (l.op == Op::Mul)
+            {
+                e.u8(0x48);
+            }
+
+            // imul rax, rcx
+            e.bytes({0x0f, 0xaf, 0xc1});
+
+            if (l.op == Op::Mulw)
+            {
+                e.sign_extend_eax();
+            }
+
+            e.store_rax(l.rd);
+            break;
+        case Op::Sll:
+        case Op::Srl:
+        case Op::Sllw:
+        case Op::Srlw:
+        case Op::Sraw: {
+            bool wide = l.op == Op::Sll || l.op == Op::Srl;
+            uint8_t ext = (l.op == Op::Sll || l.op == Op::Sllw)   ? 4
+                          : (l.op == Op::Srl || l.op == Op::Srlw) ? 5
+                                                                  : 7;
+            e.load_reg(0, l.rs1);
+            e.load_reg(1, l.rs2);
+            e.shift_cl(wide, ext);
+
+            if (!wide)
+            {
+                e.sign_extend_eax();
+            }
+
+            e.store_rax(l.rd);
+            break;
+        }
+        case Op::Slt:
+        case Op::Sltu:
+            e.load_reg(0, l.rs1);
+            e.load_reg(1, l.rs2);
+            // cmp rax, rcx
+            e.bytes({0x48, 0x39, 0xc8});
+            e.set_flag_rax(l.op == Op::Slt ? 0x9c : 0x92);
+            e.store_rax(l.rd);
+            break;
+        case Op::Auipc:
+            e.lea_pc(0, offset);
+            e.alu_imm(0, l.imm);
+            e.store_rax(l.rd);
+            break;
+        case Op::Jal:
+            if (l.rd != 0)
+            {
+                e.lea_pc(0, next);
+                e.store_rax(l.rd);
+            }
+
+            e.lea_pc(0, offset + static_cast<int32_t>(l.imm));
+            e.store_pc_rax(pc_disp);
+            pc_written = true;
+            break;
+        case Op::Jalr:
+        case Op::JrNoMask:
+            e.load_reg(1, l.rs1);
+            // mov rax, rcx
+            e.bytes({0x48, 0x89, 0xc8});
+            e.alu_imm(0, l.imm);
+
+            if (l.op == Op::Jalr)
+            {
+                // and rax, -2
+                e.bytes({0x48, 0x83, 0xe0, 0xfe});
+            }
+
+            e.store_pc_rax(pc_disp);
+
+            if (l.rd != 0)
+            {
+                e.lea_pc(0, next);
+                e.store_rax(l.rd);
+            }
+
+            pc_written = true;
+            break;
+        case Op::Beq:
+        case Op::Bne:
+        case Op::Blt:
+        case Op::Bge:
+        case Op::Bltu:
+        case Op::Bgeu: {
+            static constexpr uint8_t cmov[] = {0x44, 0x45, 0x4c, 0x4d, 0x42, 0x43};
+            e.load_reg(0, l.rs1);
+            e.load_reg(1, l.rs2);
+            // cmp rax, rcx
+            e.bytes({0x48, 0x39, 0xc8});
+            e.lea_pc(0, next);
+            e.lea_pc(2, offset + static_cast<int32_t>(l.imm));
+            // cmovcc rax, rdx
+            e.bytes({0x48, 0x0f, cmov[static_cast<int>(l.op) - static_cast<int>(Op::Beq)], 0xc2});
+            e.store_pc_rax(pc_disp);
+            pc_written = true;
+            break;
+        }
+        case Op::Fallback:
+            // The handler sees the pc of its own instruction, as with the interpreter
+            e.lea_pc(0, offset);
+            e.store_pc_rax(pc_disp);
+            // mov rdi, r12; mov esi, insn
+            e.bytes({0x4c, 0x89, 0xe7, 0xbe});
+            e.u32(insn.insn);
+            // mov rax, handler; call rax
+            e.bytes({0x48, 0xb8});
+            e.u64(reinterpret_cast<uint64_t>(insn.handler));
+            e.bytes({0xff, 0xd0});
+            // mov qword [rbx], 0
+            e.bytes({0x48, 0xc7, 0x03});
+            e.u32(0);
+            // mov rax, None; cmp [rbx + exc_disp], rax
+            e.bytes({0x48, 0xb8});
+            e.u64(exception::Exception::None);
+            e.bytes({0x48, 0x39, 0x83});
+            e.u32(exc_disp);
+            exits.push_back({e.jne_rel32(), static_cast<uint32_t>(i + 1), false, 0});
+
+            if (last)
+            {
+                // add qword [rbx + pc_disp], size
+                e.bytes({0x48, 0x83, 0x83});
+                e.u32(pc_disp);
+                e.u8(insn.size);
+                pc_written = true;
+            }
+            else
+            {
+                // mov rax, [rbx + generation_disp]; cmp rax, r13
+                e.bytes({0x48, 0x8b, 0x83});
+                e.u32(generation_disp);
+                e.bytes({0x4c, 0x39, 0xe8});
+                exits.push_back({e.jne_rel32(), static_cast<uint32_t>(i + 1), true, next});
+            }
+            break;
+        }
+
+        offset = next;
+    }
+
+    if (!pc_written)
+    {
+        e.lea_pc(0, offset);
+        e.store_pc_rax(pc_disp);
+    }
+
+    e.epilogue(block.insns.size());
+
+    for (const Exit& exit : exits)
+    {
+        int32_t rel = static_cast<int32_t>(e.cur - (exit.patch + sizeof(uint32_t)));
+        memcpy(exit.patch, &rel, sizeof(rel));
+
+        if (exit.set_pc)
+        {
+            e.lea_pc(0, exit.pc_offset);
+            e.store_pc_rax(pc_disp);
+        }
+
+        e.epilogue(exit.executed);
+    }
+
+    used = e.cur - buffer;
+
+    return reinterpret_cast<compiled_block_t>(start);
+}
+
+#else
+
+Jit::~Jit()
+{
+}
+
+bool Jit::init()
+{
+    return false;
+}
+
+void Jit::flush()
+{
+}
+
+bool Jit::is_supported()
+{
+    return false;
+}
+
+compiled_block_t Jit::compile(Cpu& cpu, const block::Block& block)
+{
+    return nullptr;
+}
+
+#endif
+
+} // namespace jit
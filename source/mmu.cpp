@@ -2,22 +2,220 @@
 #include "cpu.hpp"
 #include "cpu_config.hpp"
 #include "helper.hpp"
+#include "ram.hpp"
+#include <atomic>
+#include <cstring>
 #include <cassert>
-#include <limits>
 #include <utility>
 
 namespace mmu
 {
 
-Mmu::Mmu(Cpu& cpu) : cpu(cpu)
+Tlb::Tlb(uint64_t sets, uint64_t ways)
+    : ways(ways), set_mask(sets - 1), entries(sets * ways), next_victim(sets)
+{
+    assert((sets & (sets - 1)) == 0);
+}
+
+TLBEntry* Tlb::find(uint64_t virt_base, uint64_t asid)
+{
+    TLBEntry* set = &entries[((virt_base / page_size) & set_mask) * ways];
+
+    for (uint64_t i = 0; i < ways; i++)
+    {
+        if (set[i].virt_base == virt_base && (set[i].global || set[i].asid == asid))
+        {
+            return &set[i];
+        }
+    }
+
+    return nullptr;
+}
+
+TLBEntry& Tlb::replace(uint64_t virt_base)
+{
+    uint64_t set_index = (virt_base / page_size) & set_mask;
+    TLBEntry* set = &entries[set_index * ways];
+
+    // Empty ways are filled first, after that the set is replaced round robin
+    uint64_t way = next_victim[set_index];
+
+    for (uint64_t i = 0; i < ways; i++)
+    {
+        if (set[i].virt_base == tlb_invalid_base)
+        {
+            way = i;
+            break;
+        }
+    }
+
+    if (way == next_victim[set_index])
+    {
+        next_victim[set_index] = (way + 1) % ways;
+    }
+
+    set[way] = {};
+
+    return set[way];
+}
+
+void Tlb::insert(TLBEntry& entry, uint64_t virt_base)
+{
+    entry.virt_base = virt_base;
+
+    if (entry.page_mask != page_size - 1)
+    {
+        has_superpages = true;
+    }
+}
+
+void Tlb::flush()
+{
+    for (TLBEntry& entry : entries)
+    {
+        entry.virt_base = tlb_invalid_base;
+    }
+
+    has_superpages = false;
+}
+
+void Tlb::flush_asid(uint64_t asid)
+{
+    for (TLBEntry& entry : entries)
+    {
+        if (!entry.global && entry.asid == asid)
+        {
+            entry.virt_base = tlb_invalid_base;
+        }
+    }
+}
+
+void Tlb::flush_page(uint64_t virt_base, uint64_t asid, bool any_asid)
+{
+    // Without superpages only the set of the page can hold a match
+    uint64_t first = has_superpages ? 0 : ((virt_base / page_size) & set_mask) * ways;
+    uint64_t last = has_superpages ? entries.size() : first + ways;
+
+    for (uint64_t i = first; i < last; i++)
+    {
+        TLBEntry& entry = entries[i];
+
+        if (entry.virt_base == tlb_invalid_base ||
+            (entry.virt_base & ~entry.page_mask) != (virt_base & ~entry.page_mask))
+        {
+            continue;
+        }
+
+        if (any_asid || (!entry.global && entry.asid == asid))
+        {
+            entry.virt_base = tlb_invalid_base;
+        }
+    }
+}
+
+WalkCache::WalkCache(uint64_t size) : mask(size - 1), entries(size)
+{
+    assert((size & (size - 1)) == 0);
+}
+
+bool WalkCache::find(uint64_t pte_addr, uint64_t& pte)
+{
+    Entry& entry = entries[(pte_addr / 8) & mask];
+
+    if (entry.pte_addr != pte_addr)
+    {
+        return false;
+    }
+
+    pte = entry.pte;
+
+    return true;
+}
+
+void WalkCache::insert(uint64_t pte_addr, uint64_t pte)
+{
+    entries[(pte_addr / 8) & mask] = {pte_addr, pte};
+}
+
+void WalkCache::flush()
+{
+    for (Entry& entry : entries)
+    {
+        entry.pte_addr = tlb_invalid_base;
+    }
+}
+
+Mmu::Mmu(Cpu& cpu)
+    : itlb(ITLB_SETS, ITLB_WAYS), dtlb(DTLB_SETS, DTLB_WAYS), walk_cache(PWC_ENTRIES), cpu(cpu)
 {
     mode = Mode::Bare;
+    asid = 0;
 
     flush_tlb();
 }
 
+static uint64_t load_host(const uint8_t* host, uint64_t length)
+{
+    switch (length)
+    {
+    case 8:
+        return host[0];
+    case 16: {
+        uint16_t value;
+        memcpy(&value, host, sizeof(value));
+        return value;
+    }
+    case 32: {
+        uint32_t value;
+        memcpy(&value, host, sizeof(value));
+        return value;
+    }
+    case 64: {
+        uint64_t value;
+        memcpy(&value, host, sizeof(value));
+        return value;
+    }
+    default:
+        return 0;
+    }
+}
+
+static void store_host(uint8_t* host, uint64_t value, uint64_t length)
+{
+    switch (length)
+    {
+    case 8:
+        host[0] = value;
+        break;
+    case 16: {
+        uint16_t narrow = value;
+        memcpy(host, &narrow, sizeof(narrow));
+        break;
+    }
+    case 32: {
+        uint32_t narrow = value;
+        memcpy(host, &narrow, sizeof(narrow));
+        break;
+    }
+    case 64:
+        memcpy(host, &value, sizeof(value));
+        break;
+    default:
+        break;
+    }
+}
+
 uint64_t Mmu::load(uint64_t address, uint64_t length)
 {
+    uint64_t offset = address & (page_size - 1);
+    TLBEntry* entry = find_checked(address, AccessType::Load);
+
+    // Accesses that run into the next page take the slow path
+    if (entry != nullptr && entry->host != nullptr && offset + length / 8 <= page_size) [[likely]]
+    {
+        return load_host(entry->host + offset, length);
+    }
+
     uint64_t p_address = translate(address, AccessType::Load);
 
     if (cpu.exc_val != exception::Exception::None)
@@ -39,6 +237,11 @@ uint64_t Mmu::fetch(uint64_t address, uint64_t length)
         return 0;
     }
 
+    return fetch_physical(p_address, length);
+}
+
+uint64_t Mmu::fetch_physical(uint64_t p_address, uint64_t length)
+{
     uint64_t value = cpu.bus.load(cpu, p_address, length);
 
     if (cpu.exc_val == exception::Exception::LoadAccessFault)
@@ -51,6 +254,18 @@ uint64_t Mmu::fetch(uint64_t address, uint64_t length)
 
 void Mmu::store(uint64_t address, uint64_t value, uint64_t length)
 {
+    uint64_t offset = address & (page_size - 1);
+    TLBEntry* entry = find_checked(address, AccessType::Store);
+
+    if (entry != nullptr && entry->host != nullptr && offset + length / 8 <= page_size) [[likely]]
+    {
+        cpu.icache.invalidate(entry->phys_base | offset, length);
+        store_host(entry->host + offset, value, length);
+        cpu.dram_device->break_reservations(cpu.hart_id, entry->phys_base | offset);
+
+        return;
+    }
+
     uint64_t p_address = translate(address, AccessType::Store);
 
     if (cpu.exc_val != exception::Exception::None)
@@ -59,6 +274,43 @@ void Mmu::store(uint64_t address, uint64_t value, uint64_t length)
     }
 
     cpu.bus.store(cpu, p_address, value, length);
+    cpu.dram_device->break_reservations(cpu.hart_id, p_address);
+}
+
+uint8_t* Mmu::translate_host(uint64_t address, AccessType acces_type, uint64_t& p_address)
+{
+    uint64_t offset = address & (page_size - 1);
+    TLBEntry* entry = find_checked(address, acces_type);
+
+    if (entry != nullptr && entry->host != nullptr) [[likely]]
+    {
+        p_address = entry->phys_base | offset;
+
+        return entry->host + offset;
+    }
+
+    p_address = translate(address, acces_type);
+
+    if (cpu.exc_val != exception::Exception::None)
+    {
+        return nullptr;
+    }
+
+    RamDevice* ram = cpu.dram_device;
+
+    if (p_address < ram->base_addr || p_address + sizeof(uint64_t) > ram->end_addr)
+    {
+        return nullptr;
+    }
+
+    // The first store to a page goes past the RAM device, later ones hit the TLB until a
+    // snapshot flushes it
+    if (acces_type == AccessType::Store)
+    {
+        ram->dirty.mark(p_address - ram->base_addr);
+    }
+
+    return ram->data.data() + (p_address - ram->base_addr);
 }
 
 void Mmu::update()
@@ -69,9 +321,50 @@ void Mmu::update()
     uint64_t ppn = helper::read_bits(satp, 43, 0);
 
     this->mppn = ppn << 12ULL;
-    this->mode = static_cast<Mode::ModeValue>(mode);
+    this->asid = helper::read_bits(satp, 59, 44);
 
-    flush_tlb();
+    // Entries are tagged with their address space, so only a different paging scheme has to
+    // drop them, switching address spaces is left to sfence.vma like on hardware
+    if (this->mode != mode)
+    {
+        this->mode = static_cast<Mode::ModeValue>(mode);
+        flush_tlb();
+    }
+}
+
+uint64_t Mmu::get_context(AccessType acces_type)
+{
+    if (acces_type == AccessType::Instruction)
+    {
+        return cpu.mode;
+    }
+
+    // Everything the data permission checks depend on besides the entry itself
+    constexpr uint64_t mstatus_mask = (0x03ULL << 11ULL) |
+                                      (1ULL << static_cast<uint64_t>(csr::Mask::MSTATUSBit::MPRV)) |
+                                      (1ULL << static_cast<uint64_t>(csr::Mask::MSTATUSBit::SUM)) |
+                                      (1ULL << static_cast<uint64_t>(csr::Mask::MSTATUSBit::MXR));
+
+    return (cpu.cregs.regs[csr::Address::MSTATUS] & mstatus_mask) | cpu.mode;
+}
+
+TLBEntry* Mmu::find_checked(uint64_t address, AccessType acces_type)
+{
+    if (mode == Mode::Bare)
+    {
+        return nullptr;
+    }
+
+    Tlb& tlb = acces_type == AccessType::Instruction ? itlb : dtlb;
+    TLBEntry* entry = tlb.find(address & ~0xfffULL, asid);
+
+    if (entry == nullptr || entry->context != get_context(acces_type) ||
+        (entry->allowed & (1U << static_cast<uint32_t>(acces_type))) == 0)
+    {
+        return nullptr;
+    }
+
+    return entry;
 }
 
 uint32_t Mmu::get_levels()
@@ -142,8 +435,6 @@ void Mmu::set_cpu_error(uint64_t address, AccessType access_type)
         cpu.set_exception(exception::Exception::InstructionPageFault, address);
         break;
     }
-
-    flush_tlb();
 }
 
 bool Mmu::fetch_pte(uint64_t address, AccessType acces_type, cpu::Mode cpu_mode, TLBEntry& entry)
@@ -156,10 +447,21 @@ bool Mmu::fetch_pte(uint64_t address, AccessType acces_type, cpu::Mode cpu_mode,
     uint64_t a = mppn;
     int64_t i = levels - 1;
 
+    entry.global = false;
+
     for (; i >= 0; i--)
     {
         entry.pte_addr = a + vpn[i] * pte_size;
-        entry.pte = cpu.bus.load(cpu, entry.pte_addr, 64);
+
+        bool cached = walk_cache.find(entry.pte_addr, entry.pte);
+
+        if (!cached)
+        {
+            entry.pte = cpu.bus.load(cpu, entry.pte_addr, 64);
+        }
+
+        // A global bit in a non-leaf entry applies to everything below it
+        entry.global |= (entry.pte >> Pte::Global) & 1;
 
         entry.read = (entry.pte >> Pte::Read) & 1;
         entry.write = (entry.pte >> Pte::Write) & 1;
@@ -178,6 +480,11 @@ bool Mmu::fetch_pte(uint64_t address, AccessType acces_type, cpu::Mode cpu_mode,
             break;
         }
 
+        if (!cached)
+        {
+            walk_cache.insert(entry.pte_addr, entry.pte);
+        }
+
         a = ((entry.pte >> 10ULL) & 0xfffffffffffULL) * page_size;
     }
 
@@ -201,6 +508,8 @@ bool Mmu::fetch_pte(uint64_t address, AccessType acces_type, cpu::Mode cpu_mode,
     entry.user = (entry.pte >> Pte::User) & 1;
     entry.accessed = (entry.pte >> Pte::Accessed) & 1;
     entry.dirty = (entry.pte >> Pte::Dirty) & 1;
+    entry.asid = asid;
+    entry.page_mask = (page_size << (i * 9ULL)) - 1;
 
     if (i == 0)
     {
@@ -226,46 +535,34 @@ bool Mmu::fetch_pte(uint64_t address, AccessType acces_type, cpu::Mode cpu_mode,
 
 TLBEntry* Mmu::get_tlb_entry(uint64_t address, AccessType acces_type, cpu::Mode cpu_mode)
 {
-#if USE_TLB
+    Tlb& tlb = acces_type == AccessType::Instruction ? itlb : dtlb;
     uint64_t addr_masked = address & ~0xfffULL;
-    uint64_t oldest_tlb_age = 0;
-    int oldest_tlb_index = 0;
 
-    for (int i = 0; i < tlb_cache.size(); i++)
-    {
-        TLBEntry& entry = tlb_cache[i];
-
-        if (addr_masked == entry.virt_base)
-        {
-            entry.age = 0;
+#if USE_TLB
+    TLBEntry* cached = tlb.find(addr_masked, asid);
 
-            while (++i < tlb_cache.size())
-            {
-                ++tlb_cache[i].age;
-            }
+    if (cached != nullptr) [[likely]]
+    {
+        return cached;
+    }
 
-            return &entry;
-        }
+    TLBEntry& entry = tlb.replace(addr_masked);
 
-        ++entry.age;
+    if (fetch_pte(address, acces_type, cpu_mode, entry))
+    {
+        RamDevice* ram = cpu.dram_device;
 
-        if (entry.age > oldest_tlb_age)
+        if (entry.phys_base >= ram->base_addr && entry.phys_base + page_size <= ram->end_addr)
         {
-            oldest_tlb_age = entry.age;
-            oldest_tlb_index = i;
+            entry.host = ram->data.data() + (entry.phys_base - ram->base_addr);
         }
-    }
 
-    TLBEntry& entry = tlb_cache[oldest_tlb_index];
-
-    if (fetch_pte(address, acces_type, cpu_mode, entry))
-    {
-        entry.virt_base = addr_masked;
-        entry.age = 0;
+        tlb.insert(entry, addr_masked);
         return &entry;
     }
 #else
-    TLBEntry& entry = tlb_cache[0];
+    // The entry is left invalid so every access walks the page table
+    TLBEntry& entry = tlb.replace(addr_masked);
 
     if (fetch_pte(address, acces_type, cpu_mode, entry))
     {
@@ -278,14 +575,63 @@ TLBEntry* Mmu::get_tlb_entry(uint64_t address, AccessType acces_type, cpu::Mode
 
 void Mmu::flush_tlb()
 {
-    static constexpr uint32_t tlb_reset_age = std::numeric_limits<uint32_t>::max();
+    itlb.flush();
+    dtlb.flush();
+    walk_cache.flush();
+}
+
+void Mmu::fence(uint64_t address, uint64_t asid, bool any_address, bool any_asid)
+{
+    asid &= 0xffffULL;
+
+    if (any_address && any_asid)
+    {
+        flush_tlb();
+    }
+    else if (any_address)
+    {
+        // Non-leaf entries aren't tagged with the address spaces they serve, a fence for a
+        // single address only orders its leaf entry
+        walk_cache.flush();
+        itlb.flush_asid(asid);
+        dtlb.flush_asid(asid);
+    }
+    else
+    {
+        itlb.flush_page(address & ~0xfffULL, asid, any_asid);
+        dtlb.flush_page(address & ~0xfffULL, asid, any_asid);
+    }
+}
+
+bool Mmu::update_pte(TLBEntry& entry, uint64_t pte)
+{
+    RamDevice* ram = cpu.dram_device;
+
+    if (entry.pte_addr < ram->base_addr || entry.pte_addr + sizeof(uint64_t) > ram->end_addr)
+    {
+        // Page tables in device memory are not shared with other harts
+        cpu.bus.store(cpu, entry.pte_addr, pte, 64);
+        entry.pte = pte;
+
+        return true;
+    }
 
-    tlb_cache = {};
+    uint64_t offset = entry.pte_addr - ram->base_addr;
+    uint64_t expected = entry.pte;
 
-    for (TLBEntry& entry : tlb_cache)
+    if (!std::atomic_ref<uint64_t>(*reinterpret_cast<uint64_t*>(ram->data.data() + offset))
+             .compare_exchange_strong(expected, pte))
     {
-        entry.age = tlb_reset_age;
+        return false;
     }
+
+    ram->dirty.mark(offset);
+    cpu.icache.invalidate(entry.pte_addr, 64);
+    ram->break_reservations(cpu.hart_id, entry.pte_addr);
+
+    entry.pte = pte;
+
+    return true;
 }
 
 uint64_t Mmu::translate(uint64_t address, AccessType acces_type)
@@ -295,6 +641,13 @@ uint64_t Mmu::translate(uint64_t address, AccessType acces_type)
         return address;
     }
 
+    TLBEntry* checked = find_checked(address, acces_type);
+
+    if (checked != nullptr) [[likely]]
+    {
+        return checked->phys_base | (address & 0xfffULL);
+    }
+
     cpu::Mode cpu_mode = cpu.mode;
 
     if (acces_type != AccessType::Instruction &&
@@ -364,18 +717,34 @@ uint64_t Mmu::translate(uint64_t address, AccessType acces_type)
 
     if (!entry->accessed || (acces_type == AccessType::Store && !entry->dirty))
     {
-        entry->pte |= 1ULL << Pte::Accessed;
-        entry->accessed = true;
+        uint64_t pte = entry->pte | (1ULL << Pte::Accessed);
 
         if (acces_type == AccessType::Store)
         {
-            entry->pte |= 1ULL << Pte::Dirty;
-            entry->dirty = true;
+            pte |= 1ULL << Pte::Dirty;
+        }
+
+        if (!update_pte(*entry, pte))
+        {
+            // Another hart changed the entry since it was cached, walk the table again
+            entry->virt_base = tlb_invalid_base;
+            return translate(address, acces_type);
         }
 
-        cpu.bus.store(cpu, entry->pte_addr, entry->pte, 64);
+        entry->accessed = true;
+        entry->dirty |= acces_type == AccessType::Store;
+    }
+
+    uint64_t context = get_context(acces_type);
+
+    if (entry->context != context)
+    {
+        entry->context = context;
+        entry->allowed = 0;
     }
 
+    entry->allowed |= 1U << static_cast<uint32_t>(acces_type);
+
     return entry->phys_base | (address & 0xfffULL);
 }
 
@@ -1,27 +1,42 @@
 #include "clint.hpp"
 #include "cpu.hpp"
 #include "helper.hpp"
+#include "snapshot.hpp"
 #include <fmt/core.h>
 
+static uint64_t merge(uint64_t reg_value, uint64_t value, uint64_t offset, uint64_t length)
+{
+    if (length == 64)
+    {
+        return value;
+    }
+
+    uint64_t mask = (1ULL << length) - 1ULL;
+
+    reg_value &= ~(mask << (offset * 8));
+    reg_value |= (value & mask) << (offset * 8);
+
+    return reg_value;
+}
+
 uint64_t ClintDevice::load(Bus& bus, uint64_t address, uint64_t length)
 {
     uint64_t reg_value = 0;
     uint64_t offset = 0;
 
-    if (helper::value_in_range_inclusive(address, msip_addr, msip_addr + sizeof(msip)))
+    if (address >= msip_addr && address < msip_addr + sizeof(msip))
     {
-        reg_value = msip;
-        offset = address - msip_addr;
+        reg_value = msip[(address - msip_addr) / sizeof(msip[0])];
+        offset = (address - msip_addr) % sizeof(msip[0]);
     }
-    else if (helper::value_in_range_inclusive(address, mtimecmp_addr,
-                                              mtimecmp_addr + sizeof(mtimecmp)))
+    else if (address >= mtimecmp_addr && address < mtimecmp_addr + sizeof(mtimecmp))
     {
-        reg_value = mtimecmp;
-        offset = address - mtimecmp_addr;
+        reg_value = mtimecmp[(address - mtimecmp_addr) / sizeof(mtimecmp[0])];
+        offset = (address - mtimecmp_addr) % sizeof(mtimecmp[0]);
     }
     else if (helper::value_in_range_inclusive(address, mtime_addr, mtime_addr + sizeof(mtime)))
     {
-        reg_value = mtime;
+        reg_value = time_base + helper::get_milliseconds() * 1000;
         offset = address - mtime_addr;
     }
 
@@ -30,64 +45,57 @@ uint64_t ClintDevice::load(Bus& bus, uint64_t address, uint64_t length)
 
 void ClintDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t length)
 {
-    uint64_t reg_value = 0;
-    uint64_t offset = 0;
-
-    if (helper::value_in_range_inclusive(address, msip_addr, msip_addr + sizeof(msip)))
+    if (address >= msip_addr && address < msip_addr + sizeof(msip))
     {
-        reg_value = msip;
-        offset = address - msip_addr;
-    }
-    else if (helper::value_in_range_inclusive(address, mtimecmp_addr,
-                                              mtimecmp_addr + sizeof(mtimecmp)))
-    {
-        reg_value = mtimecmp;
-        offset = address - mtimecmp_addr;
-    }
-    else if (helper::value_in_range_inclusive(address, mtime_addr, mtime_addr + sizeof(mtime)))
-    {
-        reg_value = mtime;
-        offset = address - mtime_addr;
-    }
+        uint64_t hart_id = (address - msip_addr) / sizeof(msip[0]);
+        uint32_t& reg = msip[hart_id];
 
-    if (length != 64)
-    {
-        uint64_t mask = (1ULL << length) - 1ULL;
+        reg = merge(reg, value, (address - msip_addr) % sizeof(msip[0]), length);
 
-        reg_value &= ~(mask << (offset * 8));
-        reg_value |= (value & mask) << (offset * 8);
+        bus.notify_hart(hart_id);
     }
-    else
+    else if (address >= mtimecmp_addr && address < mtimecmp_addr + sizeof(mtimecmp))
     {
-        reg_value = value;
-    }
+        uint64_t hart_id = (address - mtimecmp_addr) / sizeof(mtimecmp[0]);
+        uint64_t& reg = mtimecmp[hart_id];
 
-    if (helper::value_in_range_inclusive(address, msip_addr, msip_addr + sizeof(msip)))
-    {
-        msip = reg_value;
-    }
-    else if (helper::value_in_range_inclusive(address, mtimecmp_addr,
-                                              mtimecmp_addr + sizeof(mtimecmp)))
-    {
-        mtimecmp = reg_value;
+        reg = merge(reg, value, (address - mtimecmp_addr) % sizeof(mtimecmp[0]), length);
+
+        bus.notify_hart(hart_id);
     }
     else if (helper::value_in_range_inclusive(address, mtime_addr, mtime_addr + sizeof(mtime)))
     {
-        mtime = reg_value;
+        mtime = merge(mtime, value, address - mtime_addr, length);
+
+        for (uint64_t hart_id = 0; hart_id < HARTS_MAX; hart_id++)
+        {
+            bus.notify_hart(hart_id);
+        }
     }
+
+    // The pending bits of the storing hart follow right away rather than at the next poll,
+    // a hart an IPI or a new mtimecmp is for picks them up when it is notified
+    bus.scheduler.schedule_in(this, 0);
 }
 
 void ClintDevice::tick(Cpu& cpu)
 {
-    mtime = helper::get_milliseconds() * 1000;
+    cpu.bus.scheduler.schedule_in(this, DEVICE_POLL_CYCLES);
+
+    mtime = time_base + helper::get_milliseconds() * 1000;
     cpu.cregs.store(csr::Address::TIME, mtime);
 
-    if (msip & 1)
+    update_interrupts(cpu);
+}
+
+void ClintDevice::update_interrupts(Cpu& cpu)
+{
+    if (msip[cpu.hart_id] & 1)
     {
         cpu.cregs.write_bit(csr::Address::MIP, csr::Mask::MSIP_BIT, 1);
     }
 
-    if (mtime >= mtimecmp)
+    if (mtime >= mtimecmp[cpu.hart_id])
     {
         cpu.cregs.write_bit(csr::Address::MIP, csr::Mask::MTIP_BIT, 1);
     }
@@ -107,10 +115,31 @@ uint64_t ClintDevice::get_end_address() const
     return end_addr;
 }
 
+void ClintDevice::save(snapshot::Writer& writer)
+{
+    writer.put(mtime);
+    writer.put(mtimecmp);
+    writer.put(msip);
+}
+
+void ClintDevice::restore(snapshot::Reader& reader)
+{
+    reader.get(mtime);
+    reader.get(mtimecmp);
+    reader.get(msip);
+
+    resume_time();
+}
+
+void ClintDevice::resume_time()
+{
+    time_base = mtime - helper::get_milliseconds() * 1000;
+}
+
 void ClintDevice::dump(std::ostream& stream) const
 {
-    stream << fmt::format("msip = 0x{:0>4x}\n", msip);
-    stream << fmt::format("mtimecmp = 0x{:0>8x}\n", mtimecmp);
+    stream << fmt::format("msip = 0x{:0>4x}\n", msip[0]);
+    stream << fmt::format("mtimecmp = 0x{:0>8x}\n", mtimecmp[0]);
     stream << fmt::format("mtime = 0x{:0>8x}", mtime);
 }
 
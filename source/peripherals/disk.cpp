@@ -0,0 +1,413 @@
+#include "disk.hpp"
+#include "helper.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace disk
+{
+
+static bool write_all(int fd, const void* data, uint64_t length, uint64_t offset)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    while (length != 0)
+    {
+        ssize_t count = pwrite(fd, bytes, length, offset);
+
+        if (count <= 0)
+        {
+            return false;
+        }
+
+        bytes += count;
+        length -= count;
+        offset += count;
+    }
+
+    return true;
+}
+
+Image::~Image()
+{
+    unmap();
+}
+
+bool Image::open(const char* path, Mode mode, const char* overlay_path)
+{
+    // With an overlay the image itself is never written
+    bool shared = mode == Mode::write_back && overlay_path == nullptr;
+    int new_fd = ::open(path, shared ? O_RDWR : O_RDONLY);
+
+    if (new_fd < 0)
+    {
+        return false;
+    }
+
+    struct stat file_stat = {};
+
+    if (fstat(new_fd, &file_stat) != 0)
+    {
+        close(new_fd);
+        return false;
+    }
+
+    uint64_t size = file_stat.st_size;
+    void* memory = nullptr;
+
+    if (size != 0)
+    {
+        // Overlay blocks are read into the mapping whatever the mode
+        int protection = mode == Mode::read_only && overlay_path == nullptr
+                             ? PROT_READ
+                             : PROT_READ | PROT_WRITE;
+        int flags = shared ? MAP_SHARED : MAP_PRIVATE | MAP_NORESERVE;
+
+        memory = mmap(nullptr, size, protection, flags, new_fd, 0);
+
+        if (memory == MAP_FAILED)
+        {
+            close(new_fd);
+            return false;
+        }
+    }
+
+    unmap();
+
+    fd = new_fd;
+    this->mode = mode;
+    this->path = std::filesystem::absolute(path).string();
+    this->overlay_path =
+        overlay_path != nullptr ? std::filesystem::absolute(overlay_path).string() : "";
+    data = std::span<uint8_t>(static_cast<uint8_t*>(memory), size);
+    dirty.resize(size);
+    changed.resize(size);
+
+    if (overlay_path != nullptr && !open_overlay(overlay_path))
+    {
+        unmap();
+        return false;
+    }
+
+    return true;
+}
+
+bool Image::open_overlay(const char* path)
+{
+    overlay_fd = ::open(path, write_back() ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+
+    if (overlay_fd < 0)
+    {
+        return false;
+    }
+
+    struct stat file_stat = {};
+
+    if (fstat(overlay_fd, &file_stat) != 0)
+    {
+        return false;
+    }
+
+    uint64_t file_size = file_stat.st_size;
+    uint64_t block_count = (size() + overlay_block_size - 1) / overlay_block_size;
+    uint64_t index_size = block_count * sizeof(uint64_t);
+    uint64_t blocks_start =
+        helper::align_up(sizeof(OverlayHeader) + index_size, overlay_block_size);
+
+    blocks.assign(block_count, 0);
+    loaded = std::make_unique<std::atomic<bool>[]>(block_count);
+
+    for (uint64_t block = 0; block < block_count; block++)
+    {
+        loaded[block] = true;
+    }
+
+    overlay_end = std::max(blocks_start, helper::align_up(file_size, overlay_block_size));
+
+    if (file_size == 0)
+    {
+        OverlayHeader header = {overlay_magic, overlay_version, overlay_block_size, size()};
+
+        // The index is a hole until blocks are added
+        return write_back() && write_all(overlay_fd, &header, sizeof(header), 0) &&
+               ftruncate(overlay_fd, blocks_start) == 0;
+    }
+
+    OverlayHeader header = {};
+
+    if (pread(overlay_fd, &header, sizeof(header), 0) != sizeof(header) ||
+        header.magic != overlay_magic || header.version != overlay_version ||
+        header.block_size != overlay_block_size || header.size != size() ||
+        pread(overlay_fd, blocks.data(), index_size, sizeof(header)) !=
+            static_cast<ssize_t>(index_size))
+    {
+        return false;
+    }
+
+    for (uint64_t block = 0; block < block_count; block++)
+    {
+        uint64_t offset = blocks[block];
+        uint64_t start = block * overlay_block_size;
+        uint64_t length = std::min<uint64_t>(overlay_block_size, size() - start);
+
+        loaded[block] = offset == 0;
+
+        if (offset != 0 && (offset < blocks_start || offset % overlay_block_size != 0 ||
+                            offset > file_size || length > file_size - offset))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Image::load_blocks(uint64_t offset, uint64_t length)
+{
+    uint64_t first = offset / overlay_block_size;
+    uint64_t end = (offset + length + overlay_block_size - 1) / overlay_block_size;
+
+    for (uint64_t block = first; block < end; block++)
+    {
+        if (!loaded[block].load(std::memory_order_acquire))
+        {
+            std::lock_guard<std::mutex> guard(overlay_lock);
+
+            if (!load_block(block))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool Image::load_block(uint64_t block)
+{
+    if (loaded[block].load(std::memory_order_relaxed))
+    {
+        return true;
+    }
+
+    uint64_t start = block * overlay_block_size;
+    uint64_t length = std::min<uint64_t>(overlay_block_size, size() - start);
+    uint64_t done = 0;
+
+    while (done < length)
+    {
+        ssize_t count =
+            pread(overlay_fd, data.data() + start + done, length - done, blocks[block] + done);
+
+        if (count <= 0)
+        {
+            return false;
+        }
+
+        done += count;
+    }
+
+    loaded[block].store(true, std::memory_order_release);
+
+    return true;
+}
+
+bool Image::add_block(uint64_t block)
+{
+    uint64_t start = block * overlay_block_size;
+    uint64_t length = std::min<uint64_t>(overlay_block_size, size() - start);
+
+    // The block starts out as the image has it
+    if (!write_all(overlay_fd, data.data() + start, length, overlay_end))
+    {
+        return false;
+    }
+
+    blocks[block] = overlay_end;
+    overlay_end += overlay_block_size;
+
+    // The index entry goes last, a crash before it only loses the block
+    return write_all(overlay_fd, &blocks[block], sizeof(uint64_t),
+                     sizeof(OverlayHeader) + block * sizeof(uint64_t));
+}
+
+void Image::unmap()
+{
+    if (!data.empty())
+    {
+        munmap(data.data(), data.size());
+        data = {};
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    if (overlay_fd >= 0)
+    {
+        close(overlay_fd);
+        overlay_fd = -1;
+    }
+
+    blocks.clear();
+    loaded.reset();
+    path.clear();
+    overlay_path.clear();
+}
+
+bool Image::is_open() const
+{
+    return fd >= 0;
+}
+
+uint64_t Image::size() const
+{
+    return data.size();
+}
+
+Mode Image::get_mode() const
+{
+    return mode;
+}
+
+bool Image::read_only() const
+{
+    return mode == Mode::read_only;
+}
+
+bool Image::write_back() const
+{
+    return mode == Mode::write_back;
+}
+
+const std::string& Image::get_path() const
+{
+    return path;
+}
+
+const std::string& Image::get_overlay_path() const
+{
+    return overlay_path;
+}
+
+bool Image::read(uint64_t offset, uint8_t* destination, uint64_t length)
+{
+    if (overlay_fd >= 0 && !load_blocks(offset, length))
+    {
+        return false;
+    }
+
+    memcpy(destination, data.data() + offset, length);
+
+    return true;
+}
+
+bool Image::write(uint64_t offset, const uint8_t* source, uint64_t length)
+{
+    if (read_only())
+    {
+        return false;
+    }
+
+    if (overlay_fd < 0)
+    {
+        memcpy(data.data() + offset, source, length);
+        mark_changed(offset, length);
+
+        return true;
+    }
+
+    uint64_t first = offset / overlay_block_size;
+    uint64_t end = (offset + length + overlay_block_size - 1) / overlay_block_size;
+
+    // Where the written blocks are in the overlay, taken under the lock
+    std::vector<uint64_t> block_offsets;
+
+    {
+        std::lock_guard<std::mutex> guard(overlay_lock);
+
+        for (uint64_t block = first; block < end; block++)
+        {
+            if (!load_block(block) || (write_back() && blocks[block] == 0 && !add_block(block)))
+            {
+                return false;
+            }
+
+            block_offsets.push_back(blocks[block]);
+        }
+    }
+
+    memcpy(data.data() + offset, source, length);
+    mark_changed(offset, length);
+
+    if (!write_back())
+    {
+        return true;
+    }
+
+    for (uint64_t block = first; block < end; block++)
+    {
+        uint64_t start = std::max(offset, block * overlay_block_size);
+        uint64_t stop = std::min(offset + length, (block + 1) * overlay_block_size);
+
+        if (!write_all(overlay_fd, data.data() + start, stop - start,
+                       block_offsets[block - first] + start % overlay_block_size))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Image::mark_changed(uint64_t offset, uint64_t length)
+{
+    if (!write_back())
+    {
+        dirty.mark_range(offset, length);
+        changed.mark_range(offset, length);
+    }
+}
+
+bool Image::flush()
+{
+    if (!write_back() || data.empty())
+    {
+        return true;
+    }
+
+    if (overlay_fd >= 0)
+    {
+        return fdatasync(overlay_fd) == 0;
+    }
+
+    return msync(data.data(), data.size(), MS_SYNC) == 0;
+}
+
+void Image::make_private()
+{
+    if (!write_back())
+    {
+        return;
+    }
+
+    // What the parent wrote so far is in the page cache, so the private mapping starts from it.
+    // With an overlay the mapping is private already and only the overlay file is written
+    bool mapped = true;
+
+    if (overlay_fd < 0 && !data.empty())
+    {
+        mapped = mmap(data.data(), data.size(), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, fd, 0) != MAP_FAILED;
+    }
+
+    // A shared mapping may still be there, refusing writes is all that keeps them off the file
+    mode = mapped ? Mode::discard : Mode::read_only;
+}
+} // namespace disk
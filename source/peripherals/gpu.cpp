@@ -2,6 +2,7 @@
 #include "cpu.hpp"
 #include "cpu_config.hpp"
 #include "helper.hpp"
+#include "snapshot.hpp"
 #include "terminal.hpp"
 #include <iostream>
 #include <optional>
@@ -85,7 +86,7 @@ uint64_t GpuDevice::load(Bus& bus, uint64_t address, uint64_t length)
                 if (lsr & cfg::lsr_dr)
                 {
                     lsr &= ~cfg::lsr_dr;
-                    dispatch_interrupt();
+                    dispatch_interrupt(bus);
                 }
 
                 return val;
@@ -195,7 +196,7 @@ void GpuDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t lengt
             }
             case cfg::ier:
                 ier = value;
-                dispatch_interrupt();
+                dispatch_interrupt(bus);
                 break;
             case cfg::fcr:
                 fcr = value;
@@ -216,42 +217,30 @@ void GpuDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t lengt
     }
 }
 
-std::optional<uint32_t> GpuDevice::is_interrupting()
-{
-    if (is_uart_interrupting)
-    {
-        is_uart_interrupting = false;
-        return cfg::uart_irqn;
-    }
-
-    return std::nullopt;
-}
-
-void GpuDevice::uart_putchar(uint8_t c)
+void GpuDevice::uart_putchar(Bus& bus, uint8_t c)
 {
     val = c;
     lsr |= cfg::lsr_dr;
-    dispatch_interrupt();
+    dispatch_interrupt(bus);
 }
 
-void GpuDevice::dispatch_interrupt()
+void GpuDevice::dispatch_interrupt(Bus& bus)
 {
     isr |= 0xc0;
 
-    if ((ier & cfg::ier_rdi) && (lsr & cfg::lsr_dr))
-    {
-        is_uart_interrupting = true;
-        return;
-    }
-    else if ((ier & cfg::ier_thri) && (lsr & cfg::lsr_temt))
+    if (((ier & cfg::ier_rdi) && (lsr & cfg::lsr_dr)) ||
+        ((ier & cfg::ier_thri) && (lsr & cfg::lsr_temt)))
     {
-        is_uart_interrupting = true;
-        return;
+        // Every reason to interrupt is a request of its own, like an edge
+        bus.set_irq_line(cfg::uart_irqn, true);
+        bus.set_irq_line(cfg::uart_irqn, false);
     }
 }
 
 void GpuDevice::tick(Cpu& cpu)
 {
+    cpu.bus.scheduler.schedule_in(this, DEVICE_POLL_CYCLES);
+
     uint64_t current_tick = helper::get_milliseconds();
 
     if (current_tick - last_tick > 10)
@@ -272,10 +261,10 @@ void GpuDevice::tick(Cpu& cpu)
                     switch (e.key.keysym.sym)
                     {
                     case SDLK_c:
-                        uart_putchar(0x3);
+                        uart_putchar(cpu.bus, 0x3);
                         break;
                     case SDLK_d:
-                        uart_putchar(0x4);
+                        uart_putchar(cpu.bus, 0x4);
                         break;
                     }
                 }
@@ -292,22 +281,22 @@ void GpuDevice::tick(Cpu& cpu)
                     {
                         if (isLetter)
                         {
-                            uart_putchar(SDL_toupper((char)keycode));
+                            uart_putchar(cpu.bus, SDL_toupper((char)keycode));
                         }
                         else
                         {
-                            uart_putchar((char)keycode);
+                            uart_putchar(cpu.bus, (char)keycode);
                         }
                     }
                     else
                     {
                         if (isLetter)
                         {
-                            uart_putchar(SDL_tolower((char)keycode));
+                            uart_putchar(cpu.bus, SDL_tolower((char)keycode));
                         }
                         else
                         {
-                            uart_putchar((char)keycode);
+                            uart_putchar(cpu.bus, (char)keycode);
                         }
                     }
                 }
@@ -371,6 +360,22 @@ void GpuDevice::resize_screen(uint16_t width, uint16_t height)
         SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_TARGET, width, height);
 }
 
+void GpuDevice::save(snapshot::Writer& writer)
+{
+    for (uint8_t reg : {dll, dlm, isr, ier, fcr, lcr, mcr, lsr, msr, scr, val})
+    {
+        writer.put(reg);
+    }
+}
+
+void GpuDevice::restore(snapshot::Reader& reader)
+{
+    for (uint8_t* reg : {&dll, &dlm, &isr, &ier, &fcr, &lcr, &mcr, &lsr, &msr, &scr, &val})
+    {
+        reader.get(*reg);
+    }
+}
+
 void GpuDevice::dump(std::ostream& stream) const
 {
 }
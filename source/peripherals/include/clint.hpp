@@ -2,6 +2,7 @@
 
 #include "bus.hpp"
 #include "cpu_config.hpp"
+#include <array>
 
 class ClintDevice : public BusDevice
 {
@@ -15,18 +16,34 @@ class ClintDevice : public BusDevice
   public:
     void tick(Cpu& cpu) override;
 
+    // Brings the MSIP and MTIP bits of the hart in line with msip and mtimecmp, against the
+    // mtime of the last tick
+    void update_interrupts(Cpu& cpu);
+
   public:
     uint64_t get_base_address() const override;
     uint64_t get_end_address() const override;
 
+    void save(snapshot::Writer& writer) override;
+    void restore(snapshot::Reader& reader) override;
+
+    // Continues mtime from its last value after the guest did not run for a while
+    void resume_time();
+
     void dump(std::ostream& stream) const override;
 
     std::string_view get_peripheral_name() const override;
 
   public:
     uint64_t mtime = 0;
-    uint64_t mtimecmp = 0;
-    uint32_t msip = 0;
+
+    // mtime runs off the host clock, which starts over with every process, so a restored
+    // guest keeps its time from here
+    uint64_t time_base = 0;
+
+    // One of each per hart, indexed by mhartid
+    std::array<uint64_t, HARTS_MAX> mtimecmp = {};
+    std::array<uint32_t, HARTS_MAX> msip = {};
 
   public:
     static constexpr uint64_t base_addr = 0x2000000ULL;
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "snapshot.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace disk
+{
+
+enum class Mode
+{
+    // Writes stay in memory and are gone at exit
+    discard,
+    // Writes go to the file through the page cache
+    write_back,
+    read_only,
+};
+
+// An overlay file starts with this header and the block index, one file offset per block of
+// the disk with 0 for blocks still read from the image. The blocks follow in the order they
+// were first written, each at a multiple of the block size
+struct OverlayHeader
+{
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t size;
+};
+
+constexpr std::array<char, 8> overlay_magic = {'R', 'V', 'O', 'V', 'R', 'L', 'A', 'Y'};
+constexpr uint32_t overlay_version = 1;
+
+// The first write to a block copies all of it to the overlay
+constexpr uint32_t overlay_block_size = 0x10000;
+
+// A disk mapped from its image file, the host only reads the parts the guest touches and the
+// image can be larger than RAM. With an overlay the image is mapped privately and only read, an
+// overlay block is read into the mapping when the guest first touches it and written back data
+// goes to the overlay as well
+class Image
+{
+  public:
+    Image() = default;
+    Image(const Image&) = delete;
+    Image& operator=(const Image&) = delete;
+    ~Image();
+
+    // Returns false if a file could not be opened or mapped, or the overlay belongs to an image
+    // of another size. A missing overlay is created when writing back
+    bool open(const char* path, Mode mode, const char* overlay_path = nullptr);
+
+    bool is_open() const;
+    uint64_t size() const;
+    Mode get_mode() const;
+    bool read_only() const;
+    bool write_back() const;
+
+    // Absolute, so a snapshot can open the files again from anywhere. Empty without an overlay
+    const std::string& get_path() const;
+    const std::string& get_overlay_path() const;
+
+    // The caller checks the range. Both fail when an overlay block could not be read, writing
+    // also on a read only disk or when a block could not be added to the overlay or written
+    bool read(uint64_t offset, uint8_t* destination, uint64_t length);
+    bool write(uint64_t offset, const uint8_t* source, uint64_t length);
+
+    // Waits for written back data to reach the file, returns false if it did not
+    bool flush();
+
+    // Writes from now on stay in this process, a forked child must not write the parent's file
+    void make_private();
+
+  public:
+    std::span<uint8_t> data;
+
+    // Pages written that did not reach the files, since the last snapshot and since the files
+    // were opened. A snapshot keeps only those, the rest is in the files
+    snapshot::DirtyPages dirty;
+    snapshot::DirtyPages changed;
+
+  private:
+    void unmap();
+
+    bool open_overlay(const char* path);
+    bool load_blocks(uint64_t offset, uint64_t length);
+    bool load_block(uint64_t block);
+    bool add_block(uint64_t block);
+    void mark_changed(uint64_t offset, uint64_t length);
+
+    int fd = -1;
+    Mode mode = Mode::discard;
+    std::string path;
+    std::string overlay_path;
+
+    int overlay_fd = -1;
+
+    // Overlay file offset of every block, 0 for the ones not in it. Every queue of a device
+    // reads and writes from its own thread, so blocks are loaded and added under the lock
+    std::vector<uint64_t> blocks;
+    uint64_t overlay_end = 0;
+    std::mutex overlay_lock;
+
+    // Whether the mapping has the block's data, which is only ever not the case for overlay
+    // blocks that were not touched yet
+    std::unique_ptr<std::atomic<bool>[]> loaded;
+};
+} // namespace disk
@@ -65,12 +65,15 @@ class GpuDevice : public BusDevice
 
   public:
     void tick(Cpu& cpu) override;
-    std::optional<uint32_t> is_interrupting() override;
 
   public:
     uint64_t get_base_address() const override;
     uint64_t get_end_address() const override;
 
+    // Only the UART registers, the screen is redrawn by the guest
+    void save(snapshot::Writer& writer) override;
+    void restore(snapshot::Reader& reader) override;
+
     void dump(std::ostream& stream) const override;
 
     std::string_view get_peripheral_name() const override;
@@ -96,7 +99,7 @@ class GpuDevice : public BusDevice
 
 #if !NATIVE_CLI && !CPU_TEST
   public:
-    void uart_putchar(uint8_t c);
+    void uart_putchar(Bus& bus, uint8_t c);
     void render_textbuffer();
     void resize_screen(uint16_t width, uint16_t height);
     void render_framebuffer();
@@ -130,13 +133,15 @@ class GpuDevice : public BusDevice
 #if __EMSCRIPTEN__
     pthread_t thread;
 #else
-    std::thread stdin_reader_thread;
+    std::unique_ptr<std::thread> stdin_reader_thread;
+
+    // For a forked child, the reader of the parent did not come along
+    void restart_stdin_reader();
 #endif
 #endif
 
   public:
-    void dispatch_interrupt();
-    bool is_uart_interrupting = false;
+    void dispatch_interrupt(Bus& bus);
 
   public:
     uint8_t dll = 0;
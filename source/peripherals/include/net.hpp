@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace net
+{
+
+// The virtio_net_hdr in front of every frame, backends that can carry it pass it along so
+// partial checksums are only ever completed where they have to be
+struct Header
+{
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+    uint16_t num_buffers;
+};
+
+static_assert(sizeof(Header) == 12);
+
+constexpr uint8_t hdr_f_needs_csum = 0x1;
+constexpr uint8_t hdr_f_data_valid = 0x2;
+
+// Ethernet frames go up to this, the header not included
+constexpr uint32_t frame_max = 0x10000;
+
+struct Packet
+{
+    Header header;
+    std::vector<uint8_t> frame;
+};
+
+// Where the frames of the network device go to and come from. Both sides are polled from the
+// device, a backend never blocks and drops what it cannot take like a network would
+class Backend
+{
+  public:
+    virtual ~Backend() = default;
+
+    virtual void send(const Header& header, std::span<const uint8_t> frame) = 0;
+
+    // Returns false when nothing is waiting
+    virtual bool receive(Packet& packet) = 0;
+
+    // A forked child starts over with what the backend keeps per process
+    virtual void forked()
+    {
+    }
+};
+
+// A network of its own for the guest, 10.0.2.0/24 with the guest at 10.0.2.15. The gateway at
+// 10.0.2.2 answers ARP and ping. The guest's UDP and TCP connections are made from host sockets,
+// to the host's loopback when they are for the gateway
+std::unique_ptr<Backend> open_user();
+
+// Frames go over a Unix seqpacket socket to another emulator, the first one to open the path
+// listens on it and the second connects
+std::unique_ptr<Backend> open_socket(const char* path);
+
+// An existing TAP interface of the host, or a new one when allowed to create it
+std::unique_ptr<Backend> open_tap(const char* name);
+
+// The socket and TAP backends are only there on Linux hosts
+bool is_supported(std::string_view spec);
+
+// user, socket:PATH or tap:NAME. Returns nothing if the backend could not be opened
+std::unique_ptr<Backend> open(std::string_view spec);
+
+// Fills in the checksum a partial one left to the device
+void complete_checksum(Header& header, std::span<uint8_t> frame);
+
+// The ones' complement sum the internet checksums are made of, folded but not inverted
+uint16_t checksum(std::span<const uint8_t> data, uint32_t sum = 0);
+} // namespace net
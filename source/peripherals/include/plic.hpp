@@ -14,27 +14,55 @@ class PlicDevice : public BusDevice
     void store(Bus& bus, uint64_t address, uint64_t value, uint64_t length) override;
 
   public:
-    void update_pending(uint64_t irq);
+    // A request from a rising line, the harts it goes to are told right away
+    void update_pending(Bus& bus, uint64_t irq);
+
     void clear_pending(uint64_t irq);
-    void update_claim(uint64_t irq);
-    bool is_enabled(uint64_t context, uint64_t irq);
+
+    // Hands the context its best irq and takes the request away from every other context
+    uint32_t claim(uint64_t context);
+
+    // Completes the irq, a line still up makes a new request
+    void complete(Bus& bus, uint64_t irq);
+
+    // The pending, enabled irq of the highest priority above the threshold, 0 if none
+    uint32_t get_best_irq(uint64_t context) const;
+    bool is_enabled(uint64_t context, uint64_t irq) const;
+
+  private:
+    // Tells every hart with an irq waiting for its supervisor context
+    void notify_harts(Bus& bus);
 
   public:
     uint64_t get_base_address() const override;
     uint64_t get_end_address() const override;
 
+    void save(snapshot::Writer& writer) override;
+    void restore(snapshot::Reader& reader) override;
+
     void dump(std::ostream& stream) const override;
 
     std::string_view get_peripheral_name() const override;
 
+  public:
+    // Every hart has a machine and a supervisor context, in that order
+    static constexpr uint64_t contexts = HARTS_MAX * 2;
+
+    static constexpr uint64_t supervisor_context(uint64_t hart_id)
+    {
+        return hart_id * 2 + 1;
+    }
+
   public:
     std::array<uint32_t, 1024> prioprity = {};
     std::array<uint32_t, 32> pending = {};
-    std::array<uint32_t, 64> enable = {};
-    std::array<uint32_t, 2> treshold = {};
-    std::array<uint32_t, 2> claim = {};
+    std::array<uint32_t, contexts * 32> enable = {};
+    std::array<uint32_t, contexts> treshold = {};
 
   public:
+    static constexpr uint64_t context_offset = 0x1000ULL;
+    static constexpr uint64_t enable_context_offset = 0x80ULL;
+
     static constexpr uint64_t base_addr = 0xC000000ULL;
 
     static constexpr uint64_t source_prio_addr = base_addr;
@@ -44,15 +72,14 @@ class PlicDevice : public BusDevice
     static constexpr uint64_t pending_end_addr = base_addr + 0x107fULL;
 
     static constexpr uint64_t enable_addr = base_addr + 0x2000ULL;
-    static constexpr uint64_t enable_end_addr = base_addr + 0x20ffULL;
+    static constexpr uint64_t enable_end_addr = enable_addr + enable_context_offset * contexts - 1;
 
     static constexpr uint64_t treshold_claim_addr = base_addr + 0x200000ULL;
-    static constexpr uint64_t treshold_claim_end_addr = base_addr + 0x201007ULL;
+    static constexpr uint64_t treshold_claim_end_addr =
+        treshold_claim_addr + context_offset * (contexts - 1) + 7;
 
-    static constexpr uint64_t end_addr = base_addr + 0x208000ULL;
+    static constexpr uint64_t end_addr = treshold_claim_addr + context_offset * contexts;
 
   public:
-    static constexpr uint64_t context_offset = 0x1000ULL;
-
     static constexpr std::string_view peripheral_name = "PLIC";
 };
\ No newline at end of file
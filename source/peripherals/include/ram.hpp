@@ -1,9 +1,15 @@
 #pragma once
 
 #include "bus.hpp"
+#include "cpu_config.hpp"
+#include "snapshot.hpp"
+#include <array>
+#include <atomic>
 #include <filesystem>
 #include <memory>
+#include <optional>
 #include <ostream>
+#include <span>
 #include <string_view>
 
 class RamDevice : public BusDevice
@@ -11,7 +17,9 @@ class RamDevice : public BusDevice
   public:
     RamDevice(uint64_t rom_start_address, uint64_t rom_end_offset);
     RamDevice(uint64_t rom_start_address, uint64_t rom_end_offset, std::vector<uint8_t> data);
-    virtual ~RamDevice() = default;
+    RamDevice(const RamDevice&) = delete;
+    RamDevice& operator=(const RamDevice&) = delete;
+    virtual ~RamDevice();
 
     uint64_t load(Bus& bus, uint64_t address, uint64_t length) override;
     void store(Bus& bus, uint64_t address, uint64_t value, uint64_t length) override;
@@ -19,10 +27,40 @@ class RamDevice : public BusDevice
   public:
     void set_data(std::vector<uint8_t> data);
 
+    // Places the whole file at offset into RAM, returns its size or nothing if it could not be
+    // read or does not fit
+    std::optional<uint64_t> load_file(const char* path, uint64_t offset);
+
+    // Places length bytes of an open file at offset into RAM, the caller checks that they fit
+    bool map_file_range(int fd, uint64_t offset, uint64_t file_offset, uint64_t length);
+
+    // Zeroes a range, whole pages go back to untouched anonymous memory instead of being written
+    bool clear_range(uint64_t offset, uint64_t length);
+
+  public:
+    // Every hart holds at most one lr reservation, on the 8 byte granule the lr read. Releasing
+    // returns the granule, unless another hart stored to it in the meantime
+    void reserve(uint64_t hart_id, uint64_t address);
+    uint64_t release(uint64_t hart_id);
+
+    // Called on every store to memory, so the common case of no other hart holding a
+    // reservation is a single load
+    void break_reservations(uint64_t hart_id, uint64_t address)
+    {
+        if ((reserved_harts.load(std::memory_order_relaxed) & ~(1ULL << hart_id)) != 0) [[unlikely]]
+        {
+            break_other_reservations(hart_id, address);
+        }
+    }
+
   public:
     uint64_t get_base_address() const override;
     uint64_t get_end_address() const override;
 
+    // Restored pages are mapped from the snapshot copy on write
+    void save(snapshot::Writer& writer) override;
+    void restore(snapshot::Reader& reader) override;
+
     void dump(std::ostream& stream) const override;
     std::string_view get_peripheral_name() const override;
 
@@ -34,5 +72,29 @@ class RamDevice : public BusDevice
     std::string_view peripheral_name = "RAM Segment";
 
   public:
-    std::vector<uint8_t> data;
+    // An anonymous mapping, the host only commits the pages the guest touches
+    std::span<uint8_t> data;
+
+    // Stores through the TLB skip the device, but never before one went through it or the MMU
+    // marked the page. Snapshots flush the TLB after taking the marks
+    snapshot::DirtyPages dirty;
+
+  private:
+    void map(uint64_t size);
+
+    uint64_t mapping_size = 0;
+
+  private:
+    void break_other_reservations(uint64_t hart_id, uint64_t address);
+
+    static constexpr uint64_t no_reservation = ~0ULL;
+
+    // Each on its own cache line, harts write their own one on every lr
+    struct alignas(64) Reservation
+    {
+        std::atomic<uint64_t> granule = no_reservation;
+    };
+
+    std::array<Reservation, HARTS_MAX> reservations;
+    std::atomic<uint64_t> reserved_harts = 0;
 };
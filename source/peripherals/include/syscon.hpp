@@ -25,6 +25,12 @@ class SysconDevice : public BusDevice
 
     static constexpr uint64_t reboot_addr = 0x7777;
 
+    // Saves a snapshot when the emulator was given a path for one, the guest goes on
+    static constexpr uint64_t snapshot_addr = 0x3333;
+
+    // Starts serving forked copies of the machine when the emulator runs as a fork server
+    static constexpr uint64_t fork_server_addr = 0x4444;
+
     static constexpr uint64_t base_addr = poweroff_addr;
 
     static constexpr uint64_t end_addr = reboot_addr;
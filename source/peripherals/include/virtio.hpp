@@ -2,11 +2,21 @@
 
 #include "bus.hpp"
 #include "cpu_config.hpp"
+#include "disk.hpp"
+#include "snapshot.hpp"
 #include <array>
-#include <limits>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string_view>
+#include <thread>
 #include <vector>
 
+class RamDevice;
+
 namespace virtio
 {
 
@@ -27,35 +37,72 @@ constexpr uint64_t driver_features = 0x20;
 constexpr uint64_t driver_features_sel = 0x24;
 constexpr uint64_t guest_page_size = 0x28;
 constexpr uint64_t queue_sel = 0x30;
-constexpr uint64_t queue_notify_reset = std::numeric_limits<uint32_t>::max();
 constexpr uint64_t queue_num_max = 0x34;
 constexpr uint64_t queue_num = 0x38;
 constexpr uint64_t queue_align = 0x3c;
 constexpr uint64_t queue_pfn = 0x40;
+constexpr uint64_t queue_ready = 0x44;
 constexpr uint64_t queue_notify = 0x50;
 constexpr uint64_t interrupt_status = 0x60;
 constexpr uint64_t interrupt_ack = 0x64;
 constexpr uint64_t status = 0x70;
+constexpr uint64_t queue_desc_low = 0x80;
+constexpr uint64_t queue_desc_high = 0x84;
+constexpr uint64_t queue_driver_low = 0x90;
+constexpr uint64_t queue_driver_high = 0x94;
+constexpr uint64_t queue_device_low = 0xa0;
+constexpr uint64_t queue_device_high = 0xa4;
+constexpr uint64_t config_generation = 0xfc;
 constexpr uint64_t config = 0x100;
 
 constexpr uint32_t magic = 0x74726976;
 constexpr uint32_t version_legacy = 0x1;
+constexpr uint32_t version_modern = 0x2;
 constexpr uint32_t vendor = 0x554D4551;
 constexpr uint32_t blk_dev = 0x02;
 
 constexpr uint16_t virtqueue_max_size = 0x400;
 constexpr uint16_t virtqueue_align = 0x1000;
 
+// Cycles between checks for finished requests while some are in flight
 constexpr uint32_t disk_delay = 0x1f4;
 constexpr uint32_t sector_size = 0x200;
 
 constexpr uint8_t blk_t_in = 0x0;
 constexpr uint8_t blk_t_out = 0x1;
+constexpr uint8_t blk_t_flush = 0x4;
+
+constexpr uint32_t blk_header_size = 16;
+
+constexpr uint32_t blk_f_seg_max = 1 << 2;
+constexpr uint32_t blk_f_ro = 1 << 5;
+constexpr uint32_t blk_f_flush = 1 << 9;
+constexpr uint32_t blk_f_mq = 1 << 12;
+constexpr uint32_t ring_f_indirect_desc = 1 << 28;
+constexpr uint32_t ring_f_event_idx = 1 << 29;
+
+// In the upper half of the features
+constexpr uint32_t f_version_1 = 1 << 0;
+constexpr uint32_t f_in_order = 1 << 3;
+
+constexpr uint32_t blk_queue_count = VIRTIO_BLK_QUEUES;
+constexpr uint64_t blk_config_num_queues = 0x22;
+constexpr uint64_t blk_config_size = 0x24;
+
+// Data segments a request may have, without it Linux sends one per request
+constexpr uint32_t blk_seg_max = 0x80;
+constexpr uint64_t blk_config_seg_max = 0xc;
 
 constexpr uint16_t desc_f_next = 0x1;
 constexpr uint16_t desc_f_write = 0x2;
+constexpr uint16_t desc_f_indirect = 0x4;
+
+constexpr uint16_t avail_f_no_interrupt = 0x1;
+constexpr uint16_t used_f_no_notify = 0x1;
 
 constexpr uint8_t blk_s_ok = 0x0;
+constexpr uint8_t blk_s_ioerr = 0x1;
+constexpr uint8_t blk_s_unsupp = 0x2;
 }; // namespace cfg
 
 struct VRingAvail
@@ -83,52 +130,204 @@ struct Virtq
     uint64_t used;
 };
 
-class VirtioBlkDevice : public BusDevice
+// A virtqueue as the transport sets it up, devices keep what they need per queue next to it
+struct Queue
+{
+    Virtq vq = {};
+
+    // The legacy interface places the rings from this page on
+    uint32_t pfn = 0;
+    uint32_t ready = 0;
+
+    // Next avail ring entry to take, and the used ring index
+    uint16_t last_avail = 0;
+    uint16_t used_idx = 0;
+};
+
+// The MMIO transport every virtio device has, registers, feature negotiation and the rings.
+// Devices bring their queues and config space
+class MmioDevice : public BusDevice
 {
   public:
-    VirtioBlkDevice(std::vector<uint8_t> data);
-    virtual ~VirtioBlkDevice();
+    MmioDevice(uint64_t base_addr, uint32_t irqn, uint32_t device_type);
 
     uint64_t load(Bus& bus, uint64_t address, uint64_t length) override;
     void store(Bus& bus, uint64_t address, uint64_t value, uint64_t length) override;
 
-  public:
-    void tick(Cpu& cpu) override;
-    std::optional<uint32_t> is_interrupting() override;
-
   public:
     uint64_t get_base_address() const override;
     uint64_t get_end_address() const override;
 
     void dump(std::ostream& stream) const override;
 
-    std::string_view get_peripheral_name() const override;
-
   public:
-    void reset();
-    void update();
-    VirtqDesc load_desc(Cpu& cpu, uint64_t address);
-    void access_disk(Cpu& cpu);
+    // Nothing past the last queue
+    virtual Queue* get_queue(uint32_t index) = 0;
+    virtual std::span<uint8_t> get_config() = 0;
 
-  public:
-    uint16_t id = 0;
-    uint64_t clock = 0;
-    uint64_t notify_clock = 0;
+    // What the guest sees after writing 0 to status
+    virtual void reset();
 
-    Virtq vq = {};
-    uint16_t queue_sel = 0;
+    void update(Queue& queue);
+    Queue* selected_queue();
+    void store_queue(Queue& queue, uint64_t address, uint64_t value);
+    // Also needs the rings in guest RAM, nothing else is used for them
+    bool queue_ready(Cpu& cpu, const Queue& queue) const;
+
+    bool load_desc(Cpu& cpu, uint64_t address, VirtqDesc& desc);
+    // Empty when a descriptor is not in guest RAM
+    std::vector<VirtqDesc> read_chain(Cpu& cpu, Queue& queue, uint16_t head);
+
+    // The avail ring index and the chain head at a position of the ring
+    uint16_t avail_idx(Cpu& cpu, const Queue& queue);
+    uint16_t avail_entry(Cpu& cpu, const Queue& queue, uint16_t position);
+
+    // Adds a finished chain to the used ring, the guest only sees it once published
+    void push_used(Cpu& cpu, Queue& queue, uint16_t head, uint32_t written);
+
+    // Makes the chains pushed since the used index was old_idx visible and raises the interrupt
+    // if the guest asked for one
+    void publish_used(Cpu& cpu, Queue& queue, uint16_t old_idx);
+
+    // Whether the guest should notify about new chains, with the event index this is only a
+    // request to hear about the next one
+    void set_notifications(Cpu& cpu, Queue& queue, bool enabled);
+
+    bool negotiated(uint32_t feature) const;
+
+    void save_transport(snapshot::Writer& writer);
+    void restore_transport(snapshot::Reader& reader);
+    void save_queue(snapshot::Writer& writer, const Queue& queue);
+    void restore_queue(snapshot::Reader& reader, Queue& queue);
+
+    // Host memory for a range of guest RAM, or nothing when it is not all in RAM
+    static uint8_t* guest_ram(RamDevice& ram, uint64_t address, uint64_t length);
+
+  public:
+    uint32_t queue_sel = 0;
     std::array<uint32_t, 2> host_features = {};
     std::array<uint32_t, 2> guest_features = {};
     uint32_t host_features_sel = 0;
     uint32_t guest_features_sel = 0;
     uint32_t guest_page_size = 0;
-    uint32_t queue_pfn = 0;
-    uint32_t queue_notify = 0;
     uint8_t isr = 0;
     uint8_t status = 0;
-    std::array<uint8_t, 8> config = {};
 
-    std::vector<uint8_t> rfsimg;
+  public:
+    const uint64_t mmio_base;
+    const uint32_t irqn;
+    const uint32_t device_type;
+};
+
+class BlkWorker;
+
+// Guest RAM a request reads or fills, resolved to host memory when the chain is walked
+struct BlkSegment
+{
+    uint8_t* host;
+    uint64_t ram_offset;
+    uint32_t length;
+};
+
+// What the used ring needs once a request is done
+struct BlkCompletion
+{
+    uint16_t head;
+    uint8_t status;
+    uint32_t written;
+    uint64_t status_addr;
+};
+
+struct BlkRequest
+{
+    uint32_t type;
+    uint64_t sector;
+    std::vector<BlkSegment> segments;
+    BlkCompletion completion;
+};
+
+// One request queue of the block device, queues are independent of each other down to their
+// workers
+struct BlkQueue : Queue
+{
+    std::unique_ptr<BlkWorker> worker;
+    std::vector<BlkCompletion> completed;
+};
+
+class VirtioBlkDevice;
+
+// Moves request data between the disk and guest RAM in bulk, away from the hart threads. The
+// used ring is left to the device, which takes the finished requests when it is ticked
+class BlkWorker
+{
+  public:
+    BlkWorker(VirtioBlkDevice& device, RamDevice& ram);
+    ~BlkWorker();
+
+    void submit(BlkRequest request);
+    void take_completed(std::vector<BlkCompletion>& completions);
+
+    bool busy();
+    void wait_idle();
+
+  private:
+    void run();
+    void transfer(BlkRequest& request);
+
+    VirtioBlkDevice& device;
+    RamDevice& ram;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<BlkRequest> pending;
+    std::vector<BlkCompletion> completed;
+    uint64_t in_flight = 0;
+    bool quit = false;
+
+    std::thread thread;
+};
+
+class VirtioBlkDevice : public MmioDevice
+{
+  public:
+    VirtioBlkDevice();
+    virtual ~VirtioBlkDevice();
+
+    // Returns false if the image could not be opened, the device has no disk then
+    bool open_disk(const char* path, disk::Mode mode, const char* overlay_path = nullptr);
+
+  public:
+    void tick(Cpu& cpu) override;
+
+  public:
+    void save(snapshot::Writer& writer) override;
+    void restore(snapshot::Reader& reader) override;
+
+    std::string_view get_peripheral_name() const override;
+
+  public:
+    Queue* get_queue(uint32_t index) override;
+    std::span<uint8_t> get_config() override;
+    void reset() override;
+
+    void access_disk(Cpu& cpu, BlkQueue& queue);
+    BlkRequest read_request(Cpu& cpu, BlkQueue& queue, uint16_t head);
+    void retire(Cpu& cpu, BlkQueue& queue);
+
+    // Waits for the workers and keeps what they finished for the used rings, nothing touches
+    // the disk or guest RAM behind the caller's back afterwards
+    void quiesce();
+
+    // For a forked child, the worker threads did not come along. Needs a quiesce beforehand
+    void forget_worker();
+
+  public:
+    std::array<uint8_t, cfg::blk_config_size> config = {};
+
+    disk::Image disk;
+
+    std::array<BlkQueue, cfg::blk_queue_count> queues;
 
   public:
     static constexpr uint64_t base_addr = cfg::virtio_base_address;
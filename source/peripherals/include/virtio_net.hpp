@@ -0,0 +1,113 @@
+#pragma once
+
+#include "net.hpp"
+#include "virtio.hpp"
+#include <array>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace virtio
+{
+
+namespace cfg
+{
+constexpr uint64_t virtio_net_base_address = 0x10002000ULL;
+
+constexpr uint64_t virtio_net_irqn = 0x02;
+
+constexpr uint32_t net_dev = 0x01;
+
+constexpr uint32_t net_f_csum = 1 << 0;
+constexpr uint32_t net_f_guest_csum = 1 << 1;
+constexpr uint32_t net_f_mac = 1 << 5;
+constexpr uint32_t net_f_mrg_rxbuf = 1 << 15;
+constexpr uint32_t net_f_status = 1 << 16;
+
+constexpr uint64_t net_config_status = 0x6;
+constexpr uint64_t net_config_size = 0x8;
+
+constexpr uint16_t net_s_link_up = 0x1;
+
+constexpr uint32_t net_rx_queue = 0;
+constexpr uint32_t net_tx_queue = 1;
+constexpr uint32_t net_queue_count = 2;
+
+// Legacy drivers leave num_buffers out unless they take mergeable buffers
+constexpr uint32_t net_header_legacy_size = 10;
+
+// Cycles between polls of the backend, nothing tells the device a frame came in
+constexpr uint32_t net_delay = 0x1000;
+
+constexpr std::array<uint8_t, 6> net_default_mac = {0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
+}; // namespace cfg
+
+// Guest RAM a received frame goes to, the chains it takes are numbered in ring order
+struct NetSegment
+{
+    uint8_t* host;
+    uint64_t ram_offset;
+    uint32_t length;
+    uint32_t buffer;
+};
+
+// An ethernet card whose frames go through a backend on the host. The guest may leave TCP and
+// UDP checksums to it and gets frames spread over as many receive buffers as they need
+class VirtioNetDevice : public MmioDevice
+{
+  public:
+    VirtioNetDevice();
+    virtual ~VirtioNetDevice();
+
+    // Without one the link is down, the guest's frames are dropped and none arrive
+    void set_backend(std::unique_ptr<net::Backend> new_backend);
+    void set_mac(const std::array<uint8_t, 6>& mac);
+
+  public:
+    void tick(Cpu& cpu) override;
+
+  public:
+    void save(snapshot::Writer& writer) override;
+    void restore(snapshot::Reader& reader) override;
+
+    std::string_view get_peripheral_name() const override;
+
+  public:
+    Queue* get_queue(uint32_t index) override;
+    std::span<uint8_t> get_config() override;
+    void reset() override;
+
+    void transmit(Cpu& cpu);
+    void receive(Cpu& cpu);
+
+    // Returns false while the guest has not made room for the packet, a packet that can never
+    // fit is dropped
+    bool deliver(Cpu& cpu, net::Packet& packet);
+
+    uint32_t header_size() const;
+
+  public:
+    std::array<uint8_t, cfg::net_config_size> config = {};
+
+    std::array<Queue, cfg::net_queue_count> queues;
+
+    std::unique_ptr<net::Backend> backend;
+
+    // A packet that came in while the guest had no room for it, the backend is not asked for
+    // more until it is delivered
+    net::Packet rx_packet;
+    bool rx_pending = false;
+
+    // Kept around so frames do not allocate
+    std::vector<uint8_t> tx_frame;
+    std::vector<NetSegment> rx_segments;
+    std::vector<uint16_t> rx_heads;
+
+  public:
+    static constexpr uint64_t base_addr = cfg::virtio_net_base_address;
+
+    static constexpr uint64_t end_addr = base_addr + cfg::virtio_size;
+
+    static constexpr std::string_view peripheral_name = "VIRTIO NET";
+};
+} // namespace virtio
@@ -2,9 +2,14 @@
 #include "cpu_config.hpp"
 #include "gpu.hpp"
 #include "helper.hpp"
+#include "snapshot.hpp"
+#include <cerrno>
+#include <chrono>
 #include <iostream>
 #include <optional>
 #include <termios.h>
+#include <thread>
+#include <unistd.h>
 
 namespace gpu
 {
@@ -34,12 +39,27 @@ GpuDevice::GpuDevice(const char* screen_title, const char* font_path, uint32_t w
     tcsetattr(0, TCSAFLUSH, &term);
 
 #if !CPU_TEST && !__EMSCRIPTEN__
-    stdin_reader_thread = std::thread(&GpuDevice::stdin_reader, this);
+    stdin_reader_thread = std::make_unique<std::thread>(&GpuDevice::stdin_reader, this);
 #elif __EMSCRIPTEN__
     pthread_create(&thread, nullptr, emscripten_thread, this);
 #endif
 }
 
+#if !__EMSCRIPTEN__
+void GpuDevice::restart_stdin_reader()
+{
+    thread_done = false;
+
+    // The old handle names a thread that does not exist here, it can be neither joined nor
+    // destroyed, so it is let go
+    stdin_reader_thread.release();
+
+#if !CPU_TEST
+    stdin_reader_thread = std::make_unique<std::thread>(&GpuDevice::stdin_reader, this);
+#endif
+}
+#endif
+
 GpuDevice::~GpuDevice()
 {
     thread_done = true;
@@ -59,7 +79,7 @@ uint64_t GpuDevice::load(Bus& bus, uint64_t address, uint64_t length)
         if (lsr & cfg::lsr_dr)
         {
             lsr &= ~cfg::lsr_dr;
-            dispatch_interrupt();
+            dispatch_interrupt(bus);
         }
 
         return val;
@@ -96,7 +116,7 @@ void GpuDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t lengt
     }
     case cfg::ier:
         ier = value;
-        dispatch_interrupt();
+        dispatch_interrupt(bus);
         break;
     case cfg::fcr:
         fcr = value;
@@ -115,55 +135,79 @@ void GpuDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t lengt
     }
 }
 
-std::optional<uint32_t> GpuDevice::is_interrupting()
-{
-    if (is_uart_interrupting)
-    {
-        is_uart_interrupting = false;
-        return cfg::uart_irqn;
-    }
-
-    return std::nullopt;
-}
-
 void GpuDevice::stdin_reader()
 {
+    // Straight from the descriptor, a forked child could find a stdio lock held by a reader
+    // thread that did not come along
     while (!thread_done)
     {
-        char c = fgetc(stdin);
+        char c = '\0';
+        ssize_t count = read(STDIN_FILENO, &c, 1);
 
-        if (c != EOF)
+        if (count == 1)
         {
-            read_char.store(c, std::memory_order::release);
+            // Piped input comes faster than the guest polls, each character waits for the one
+            // before it to be taken
+            char empty = '\0';
+
+            while (!thread_done && !read_char.compare_exchange_weak(empty, c))
+            {
+                empty = '\0';
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+        else if (count == 0 || errno != EINTR)
+        {
+            break;
         }
     }
 }
 
-void GpuDevice::dispatch_interrupt()
+void GpuDevice::dispatch_interrupt(Bus& bus)
 {
     isr |= 0xc0;
 
-    if ((ier & cfg::ier_rdi) && (lsr & cfg::lsr_dr))
+    if (((ier & cfg::ier_rdi) && (lsr & cfg::lsr_dr)) ||
+        ((ier & cfg::ier_thri) && (lsr & cfg::lsr_temt)))
     {
-        is_uart_interrupting = true;
-        return;
-    }
-    else if ((ier & cfg::ier_thri) && (lsr & cfg::lsr_temt))
-    {
-        is_uart_interrupting = true;
-        return;
+        // Every reason to interrupt is a request of its own, like an edge
+        bus.set_irq_line(cfg::uart_irqn, true);
+        bus.set_irq_line(cfg::uart_irqn, false);
     }
 }
 
 void GpuDevice::tick(Cpu& cpu)
 {
+    cpu.bus.scheduler.schedule_in(this, DEVICE_POLL_CYCLES);
+
+    if (lsr & cfg::lsr_dr)
+    {
+        return;
+    }
+
     char c = read_char.exchange('\0');
 
     if (c != '\0')
     {
         val = c;
         lsr |= cfg::lsr_dr;
-        dispatch_interrupt();
+        dispatch_interrupt(cpu.bus);
+    }
+}
+
+void GpuDevice::save(snapshot::Writer& writer)
+{
+    for (uint8_t reg : {dll, dlm, isr, ier, fcr, lcr, mcr, lsr, msr, scr, val})
+    {
+        writer.put(reg);
+    }
+}
+
+void GpuDevice::restore(snapshot::Reader& reader)
+{
+    for (uint8_t* reg : {&dll, &dlm, &isr, &ier, &fcr, &lcr, &mcr, &lsr, &msr, &scr, &val})
+    {
+        reader.get(*reg);
     }
 }
 
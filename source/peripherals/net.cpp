@@ -0,0 +1,1328 @@
+#include "net.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#if __linux__
+#include <linux/if_tun.h>
+#include <net/if.h>
+#endif
+
+namespace net
+{
+
+// Writing to a socket the other end closed raises SIGPIPE, which is turned off per call where
+// there is MSG_NOSIGNAL and per socket elsewhere
+#ifdef MSG_NOSIGNAL
+constexpr int send_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+constexpr int send_flags = MSG_DONTWAIT;
+#endif
+
+// Makes a socket from socket or accept non-blocking and closed on exec, the flags doing that
+// as they create it are Linux only. Returns -1 and closes it on failure
+static int prepare_socket(int fd)
+{
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0 ||
+        fcntl(fd, F_SETFD, FD_CLOEXEC) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+#ifdef SO_NOSIGPIPE
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+
+    return fd;
+}
+
+// Network byte order, the frames are the guest's and may be unaligned
+static uint16_t load_be16(const uint8_t* data)
+{
+    return (data[0] << 8) | data[1];
+}
+
+static uint32_t load_be32(const uint8_t* data)
+{
+    return (static_cast<uint32_t>(load_be16(data)) << 16) | load_be16(data + 2);
+}
+
+static void store_be16(uint8_t* data, uint16_t value)
+{
+    data[0] = value >> 8;
+    data[1] = value & 0xff;
+}
+
+static void store_be32(uint8_t* data, uint32_t value)
+{
+    store_be16(data, value >> 16);
+    store_be16(data + 2, value & 0xffff);
+}
+
+uint16_t checksum(std::span<const uint8_t> data, uint32_t sum)
+{
+    uint64_t total = sum;
+    size_t i = 0;
+
+    for (; i + 1 < data.size(); i += 2)
+    {
+        total += load_be16(data.data() + i);
+    }
+
+    if (i < data.size())
+    {
+        total += data[i] << 8;
+    }
+
+    while (total >> 16)
+    {
+        total = (total & 0xffff) + (total >> 16);
+    }
+
+    return total;
+}
+
+void complete_checksum(Header& header, std::span<uint8_t> frame)
+{
+    if ((header.flags & hdr_f_needs_csum) == 0)
+    {
+        return;
+    }
+
+    uint64_t field = static_cast<uint64_t>(header.csum_start) + header.csum_offset;
+
+    // The field already holds the pseudo header's sum, the rest is summed over it
+    if (header.csum_start < frame.size() && field + sizeof(uint16_t) <= frame.size())
+    {
+        store_be16(frame.data() + field, ~checksum(frame.subspan(header.csum_start)));
+    }
+
+    header.flags &= ~hdr_f_needs_csum;
+}
+
+// Other hosts lack seqpacket Unix sockets and TAP interfaces
+#if __linux__
+class SocketBackend : public Backend
+{
+  public:
+    ~SocketBackend() override;
+
+    bool open(const char* path);
+
+    void send(const Header& header, std::span<const uint8_t> frame) override;
+    bool receive(Packet& packet) override;
+
+    void forked() override;
+
+  private:
+    // Connects to the other end, or listens when there is none yet
+    bool connect_or_listen();
+
+    // Takes a waiting peer when listening
+    bool connected();
+    void hang_up();
+
+    std::string path;
+    int listen_fd = -1;
+    int peer_fd = -1;
+};
+
+static int seqpacket_socket()
+{
+    int fd = prepare_socket(socket(AF_UNIX, SOCK_SEQPACKET, 0));
+
+    // Bursts are dropped once the buffers are full, larger ones lose less
+    int buffer_size = 0x100000;
+
+    if (fd >= 0)
+    {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    }
+
+    return fd;
+}
+
+SocketBackend::~SocketBackend()
+{
+    if (listen_fd >= 0)
+    {
+        close(listen_fd);
+        unlink(path.c_str());
+    }
+
+    if (peer_fd >= 0)
+    {
+        close(peer_fd);
+    }
+}
+
+bool SocketBackend::open(const char* path)
+{
+    this->path = path;
+
+    return this->path.size() < sizeof(sockaddr_un::sun_path) && connect_or_listen();
+}
+
+bool SocketBackend::connect_or_listen()
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size());
+
+    int fd = seqpacket_socket();
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+    {
+        peer_fd = fd;
+        return true;
+    }
+
+    // Nobody listens on a path left behind by an emulator that is gone
+    if (errno == ECONNREFUSED)
+    {
+        unlink(path.c_str());
+    }
+    else if (errno != ENOENT)
+    {
+        close(fd);
+        return false;
+    }
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(fd, 1) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    listen_fd = fd;
+
+    return true;
+}
+
+bool SocketBackend::connected()
+{
+    if (peer_fd < 0 && listen_fd >= 0)
+    {
+        peer_fd = prepare_socket(accept(listen_fd, nullptr, nullptr));
+    }
+
+    return peer_fd >= 0;
+}
+
+void SocketBackend::hang_up()
+{
+    close(peer_fd);
+    peer_fd = -1;
+
+    // The side that connected takes over the path if the listening one went away
+    if (listen_fd < 0)
+    {
+        connect_or_listen();
+    }
+}
+
+void SocketBackend::send(const Header& header, std::span<const uint8_t> frame)
+{
+    if (!connected())
+    {
+        return;
+    }
+
+    std::array<iovec, 2> parts = {{{const_cast<Header*>(&header), sizeof(Header)},
+                                   {const_cast<uint8_t*>(frame.data()), frame.size()}}};
+
+    msghdr message = {};
+    message.msg_iov = parts.data();
+    message.msg_iovlen = parts.size();
+
+    if (sendmsg(peer_fd, &message, send_flags) < 0 && errno == EPIPE)
+    {
+        hang_up();
+    }
+}
+
+bool SocketBackend::receive(Packet& packet)
+{
+    if (!connected())
+    {
+        return false;
+    }
+
+    packet.frame.resize(frame_max);
+
+    std::array<iovec, 2> parts = {{{&packet.header, sizeof(Header)},
+                                   {packet.frame.data(), packet.frame.size()}}};
+
+    msghdr message = {};
+    message.msg_iov = parts.data();
+    message.msg_iovlen = parts.size();
+
+    ssize_t length = recvmsg(peer_fd, &message, MSG_DONTWAIT);
+
+    if (length == 0 || (length < 0 && errno != EAGAIN && errno != EINTR))
+    {
+        hang_up();
+        return false;
+    }
+
+    if (length < static_cast<ssize_t>(sizeof(Header)))
+    {
+        return false;
+    }
+
+    packet.frame.resize(length - sizeof(Header));
+
+    return true;
+}
+
+void SocketBackend::forked()
+{
+    // The peer and the path stay with the parent, the child's link is down for good
+    if (listen_fd >= 0)
+    {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+
+    if (peer_fd >= 0)
+    {
+        close(peer_fd);
+        peer_fd = -1;
+    }
+}
+
+std::unique_ptr<Backend> open_socket(const char* path)
+{
+    auto backend = std::make_unique<SocketBackend>();
+
+    if (!backend->open(path))
+    {
+        return {};
+    }
+
+    return backend;
+}
+
+class TapBackend : public Backend
+{
+  public:
+    ~TapBackend() override;
+
+    bool open(const char* name);
+
+    void send(const Header& header, std::span<const uint8_t> frame) override;
+    bool receive(Packet& packet) override;
+
+    void forked() override;
+
+  private:
+    int fd = -1;
+};
+
+TapBackend::~TapBackend()
+{
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+bool TapBackend::open(const char* name)
+{
+    fd = ::open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    ifreq request = {};
+    request.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+    strncpy(request.ifr_name, name, IFNAMSIZ - 1);
+
+    // The kernel takes the guest's partial checksums as they are and may hand it some
+    int header_size = sizeof(Header);
+
+    return ioctl(fd, TUNSETIFF, &request) == 0 && ioctl(fd, TUNSETVNETHDRSZ, &header_size) == 0 &&
+           ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM) == 0;
+}
+
+void TapBackend::send(const Header& header, std::span<const uint8_t> frame)
+{
+    if (fd < 0)
+    {
+        return;
+    }
+
+    std::array<iovec, 2> parts = {{{const_cast<Header*>(&header), sizeof(Header)},
+                                   {const_cast<uint8_t*>(frame.data()), frame.size()}}};
+
+    // A full queue drops the frame
+    [[maybe_unused]] ssize_t written = writev(fd, parts.data(), parts.size());
+}
+
+bool TapBackend::receive(Packet& packet)
+{
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    packet.frame.resize(frame_max);
+
+    std::array<iovec, 2> parts = {{{&packet.header, sizeof(Header)},
+                                   {packet.frame.data(), packet.frame.size()}}};
+
+    ssize_t length = readv(fd, parts.data(), parts.size());
+
+    if (length < static_cast<ssize_t>(sizeof(Header)))
+    {
+        return false;
+    }
+
+    packet.frame.resize(length - sizeof(Header));
+
+    return true;
+}
+
+void TapBackend::forked()
+{
+    // Children would take each other's frames from the interface, their link is down instead
+    close(fd);
+    fd = -1;
+}
+
+std::unique_ptr<Backend> open_tap(const char* name)
+{
+    auto backend = std::make_unique<TapBackend>();
+
+    if (!backend->open(name))
+    {
+        return {};
+    }
+
+    return backend;
+}
+#else
+std::unique_ptr<Backend> open_socket([[maybe_unused]] const char* path)
+{
+    return {};
+}
+
+std::unique_ptr<Backend> open_tap([[maybe_unused]] const char* name)
+{
+    return {};
+}
+#endif
+
+namespace user
+{
+constexpr std::array<uint8_t, 6> gateway_mac = {0x52, 0x55, 0x0a, 0x00, 0x02, 0x02};
+
+constexpr uint32_t network = 0x0a000200;
+constexpr uint32_t netmask = 0xffffff00;
+constexpr uint32_t gateway = 0x0a000202;
+constexpr uint32_t guest = 0x0a00020f;
+
+constexpr uint16_t ethertype_ipv4 = 0x0800;
+constexpr uint16_t ethertype_arp = 0x0806;
+
+constexpr uint8_t protocol_icmp = 1;
+constexpr uint8_t protocol_tcp = 6;
+constexpr uint8_t protocol_udp = 17;
+
+constexpr uint32_t eth_size = 14;
+constexpr uint32_t arp_size = 28;
+constexpr uint32_t ip_size = 20;
+constexpr uint32_t udp_size = 8;
+constexpr uint32_t tcp_size = 20;
+
+constexpr uint8_t icmp_echo_reply = 0;
+constexpr uint8_t icmp_echo_request = 8;
+
+constexpr uint8_t tcp_fin = 0x01;
+constexpr uint8_t tcp_syn = 0x02;
+constexpr uint8_t tcp_rst = 0x04;
+constexpr uint8_t tcp_psh = 0x08;
+constexpr uint8_t tcp_ack = 0x10;
+
+constexpr uint8_t tcp_option_end = 0;
+constexpr uint8_t tcp_option_nop = 1;
+constexpr uint8_t tcp_option_mss = 2;
+constexpr uint32_t tcp_mss_size = 4;
+
+// What a SYN without the option allows, and the most a frame of ours carries
+constexpr uint16_t tcp_mss_default = 536;
+constexpr uint16_t tcp_mss_max = 1460;
+
+// Guest data kept for a host socket that does not take it yet, this is also the window offered
+constexpr uint32_t tcp_buffer = 0xffff;
+
+// Host sockets kept open for UDP, the least recently used one goes first
+constexpr size_t flow_limit = 64;
+
+// TCP connections open at once, further ones are refused
+constexpr size_t connection_limit = 256;
+} // namespace user
+
+// One guest port talking to one remote address and port over a host socket
+struct Flow
+{
+    uint16_t guest_port;
+    uint32_t address;
+    uint16_t port;
+    int fd;
+    uint64_t last_used;
+};
+
+// A guest connection carried on by a host socket. The link to the guest does not lose frames, so
+// nothing is sent twice and data from the host is only read as far as the guest's window goes
+struct Connection
+{
+    uint16_t guest_port;
+    uint32_t address;
+    uint16_t port;
+    int fd;
+
+    // The host socket connected and the guest acknowledged the SYN-ACK
+    bool connected = false;
+    bool established = false;
+
+    // Either side closed its half, the guest's once its FIN was taken in order
+    bool guest_fin = false;
+    bool host_fin = false;
+    bool closed = false;
+
+    // Next byte expected from the guest, next byte to send it and the first it has not acknowledged
+    uint32_t guest_next;
+    uint32_t next;
+    uint32_t acked;
+
+    uint32_t guest_window;
+    uint16_t mss;
+    uint32_t advertised = user::tcp_buffer;
+
+    // Guest data the host socket has not taken yet
+    std::vector<uint8_t> pending;
+};
+
+// Sequence numbers wrap, a is after b when it is less than half the space ahead
+static bool sequence_after(uint32_t a, uint32_t b)
+{
+    return static_cast<int32_t>(a - b) > 0;
+}
+
+class UserBackend : public Backend
+{
+  public:
+    ~UserBackend() override;
+
+    void send(const Header& header, std::span<const uint8_t> frame) override;
+    bool receive(Packet& packet) override;
+
+    void forked() override;
+
+  private:
+    void arp(std::span<const uint8_t> frame);
+    void ipv4(std::span<const uint8_t> frame);
+    void icmp(uint32_t destination, std::span<const uint8_t> message);
+    void udp(uint32_t destination, std::span<const uint8_t> datagram);
+    void tcp(uint32_t destination, std::span<const uint8_t> segment);
+
+    Flow* open_flow(uint16_t guest_port, uint32_t address, uint16_t port);
+    void poll_flows();
+    void close_flows();
+
+    // Answers a segment no connection takes with a reset
+    void refuse(uint32_t source, std::span<const uint8_t> segment);
+    void open_connection(uint32_t address, std::span<const uint8_t> segment);
+    void segment_in(Connection& connection, std::span<const uint8_t> segment);
+    void send_segment(Connection& connection, uint8_t flags, std::span<const uint8_t> data = {});
+    void flush_pending(Connection& connection);
+    void read_host(Connection& connection);
+    void poll_connections();
+    void close_connections();
+
+    // Queues an IPv4 packet for the guest, its transport checksum is filled in here
+    void reply_ipv4(uint32_t source, uint8_t protocol, std::vector<uint8_t> payload);
+
+    std::deque<std::vector<uint8_t>> replies;
+    std::vector<Flow> flows;
+    std::vector<Connection> connections;
+    uint64_t clock = 0;
+    uint32_t initial_sequence = 0x1000;
+
+    // Taken from what the guest sends
+    std::array<uint8_t, 6> guest_mac = {};
+    uint32_t guest_address = user::guest;
+
+    uint16_t ip_id = 0;
+};
+
+UserBackend::~UserBackend()
+{
+    close_flows();
+    close_connections();
+}
+
+void UserBackend::send([[maybe_unused]] const Header& header, std::span<const uint8_t> frame)
+{
+    // Checksums the guest left partial are not looked at, nothing here checks them
+    if (frame.size() < user::eth_size)
+    {
+        return;
+    }
+
+    std::copy_n(frame.begin() + 6, guest_mac.size(), guest_mac.begin());
+
+    uint16_t ethertype = load_be16(frame.data() + 12);
+
+    if (ethertype == user::ethertype_arp)
+    {
+        arp(frame.subspan(user::eth_size));
+    }
+    else if (ethertype == user::ethertype_ipv4)
+    {
+        ipv4(frame.subspan(user::eth_size));
+    }
+}
+
+void UserBackend::arp(std::span<const uint8_t> frame)
+{
+    // Only IPv4 over ethernet requests for the gateway get an answer
+    if (frame.size() < user::arp_size || load_be16(frame.data()) != 1 ||
+        load_be16(frame.data() + 2) != user::ethertype_ipv4 || load_be16(frame.data() + 6) != 1 ||
+        load_be32(frame.data() + 24) != user::gateway)
+    {
+        return;
+    }
+
+    std::vector<uint8_t> reply(user::eth_size + user::arp_size);
+    uint8_t* message = reply.data() + user::eth_size;
+
+    std::copy(guest_mac.begin(), guest_mac.end(), reply.begin());
+    std::copy(user::gateway_mac.begin(), user::gateway_mac.end(), reply.begin() + 6);
+    store_be16(reply.data() + 12, user::ethertype_arp);
+
+    // The request with the addresses swapped and the gateway's filled in
+    std::copy_n(frame.begin(), 6, message);
+    store_be16(message + 6, 2);
+    std::copy(user::gateway_mac.begin(), user::gateway_mac.end(), message + 8);
+    store_be32(message + 14, user::gateway);
+    std::copy_n(frame.begin() + 8, 10, message + 18);
+
+    replies.push_back(std::move(reply));
+}
+
+void UserBackend::ipv4(std::span<const uint8_t> packet)
+{
+    if (packet.size() < user::ip_size || (packet[0] >> 4) != 4)
+    {
+        return;
+    }
+
+    uint32_t header_size = (packet[0] & 0xf) * 4;
+    uint32_t total_size = load_be16(packet.data() + 2);
+
+    // Fragments are not put back together
+    if (header_size < user::ip_size || total_size < header_size || total_size > packet.size() ||
+        (load_be16(packet.data() + 6) & 0x3fff) != 0)
+    {
+        return;
+    }
+
+    guest_address = load_be32(packet.data() + 12);
+
+    uint8_t protocol = packet[9];
+    uint32_t destination = load_be32(packet.data() + 16);
+    std::span<const uint8_t> payload = packet.subspan(header_size, total_size - header_size);
+
+    // The rest of the guest's own network is empty
+    if ((destination & user::netmask) == user::network && destination != user::gateway)
+    {
+        return;
+    }
+
+    switch (protocol)
+    {
+    case user::protocol_icmp:
+        icmp(destination, payload);
+        break;
+    case user::protocol_udp:
+        udp(destination, payload);
+        break;
+    case user::protocol_tcp:
+        tcp(destination, payload);
+        break;
+    default:
+        break;
+    }
+}
+
+void UserBackend::icmp(uint32_t destination, std::span<const uint8_t> message)
+{
+    // The gateway answers pings, the host is not asked
+    if (destination != user::gateway || message.size() < 8 ||
+        message[0] != user::icmp_echo_request)
+    {
+        return;
+    }
+
+    std::vector<uint8_t> reply(message.begin(), message.end());
+    reply[0] = user::icmp_echo_reply;
+
+    reply_ipv4(destination, user::protocol_icmp, std::move(reply));
+}
+
+void UserBackend::udp(uint32_t destination, std::span<const uint8_t> datagram)
+{
+    if (datagram.size() < user::udp_size)
+    {
+        return;
+    }
+
+    uint16_t length = load_be16(datagram.data() + 4);
+
+    if (length < user::udp_size || length > datagram.size())
+    {
+        return;
+    }
+
+    Flow* flow =
+        open_flow(load_be16(datagram.data()), destination, load_be16(datagram.data() + 2));
+
+    if (flow != nullptr)
+    {
+        [[maybe_unused]] ssize_t sent = ::send(flow->fd, datagram.data() + user::udp_size,
+                                               length - user::udp_size, MSG_DONTWAIT);
+    }
+}
+
+void UserBackend::tcp(uint32_t destination, std::span<const uint8_t> segment)
+{
+    if (segment.size() < user::tcp_size || (segment[12] >> 4) * 4U < user::tcp_size ||
+        (segment[12] >> 4) * 4U > segment.size())
+    {
+        return;
+    }
+
+    uint16_t guest_port = load_be16(segment.data());
+    uint16_t port = load_be16(segment.data() + 2);
+    uint8_t flags = segment[13];
+
+    auto connection = std::find_if(connections.begin(), connections.end(), [&](auto& connection) {
+        return connection.guest_port == guest_port && connection.address == destination &&
+               connection.port == port && !connection.closed;
+    });
+
+    if (connection != connections.end())
+    {
+        segment_in(*connection, segment);
+    }
+    else if ((flags & (user::tcp_syn | user::tcp_ack | user::tcp_rst)) == user::tcp_syn &&
+             connections.size() < user::connection_limit)
+    {
+        open_connection(destination, segment);
+    }
+    else if ((flags & user::tcp_rst) == 0)
+    {
+        refuse(destination, segment);
+    }
+
+    std::erase_if(connections, [](const Connection& connection) { return connection.closed; });
+}
+
+void UserBackend::refuse(uint32_t source, std::span<const uint8_t> segment)
+{
+    uint8_t flags = segment[13];
+    uint32_t data_offset = (segment[12] >> 4) * 4;
+    uint32_t sequence_length = segment.size() - data_offset + ((flags & user::tcp_syn) != 0) +
+                               ((flags & user::tcp_fin) != 0);
+
+    std::vector<uint8_t> reply(user::tcp_size);
+
+    store_be16(reply.data(), load_be16(segment.data() + 2));
+    store_be16(reply.data() + 2, load_be16(segment.data()));
+
+    if (flags & user::tcp_ack)
+    {
+        store_be32(reply.data() + 4, load_be32(segment.data() + 8));
+        reply[13] = user::tcp_rst;
+    }
+    else
+    {
+        store_be32(reply.data() + 8, load_be32(segment.data() + 4) + sequence_length);
+        reply[13] = user::tcp_rst | user::tcp_ack;
+    }
+
+    reply[12] = (user::tcp_size / 4) << 4;
+
+    reply_ipv4(source, user::protocol_tcp, std::move(reply));
+}
+
+void UserBackend::open_connection(uint32_t address, std::span<const uint8_t> segment)
+{
+    uint16_t port = load_be16(segment.data() + 2);
+
+    // The gateway stands for the host itself
+    sockaddr_in remote = {};
+    remote.sin_family = AF_INET;
+    remote.sin_port = htons(port);
+    remote.sin_addr.s_addr = htonl(address == user::gateway ? INADDR_LOOPBACK : address);
+
+    int fd = prepare_socket(socket(AF_INET, SOCK_STREAM, 0));
+
+    if (fd < 0 || (connect(fd, reinterpret_cast<sockaddr*>(&remote), sizeof(remote)) != 0 &&
+                   errno != EINPROGRESS))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        refuse(address, segment);
+        return;
+    }
+
+    Connection connection = {};
+    connection.guest_port = load_be16(segment.data());
+    connection.address = address;
+    connection.port = port;
+    connection.fd = fd;
+    connection.guest_next = load_be32(segment.data() + 4) + 1;
+    connection.acked = initial_sequence;
+    connection.next = initial_sequence;
+    connection.guest_window = load_be16(segment.data() + 14);
+    connection.mss = user::tcp_mss_default;
+
+    initial_sequence += 0x01000193;
+
+    // Only the segment size is looked for, window scaling is left off as the SYN-ACK does not
+    // offer it either
+    uint32_t data_offset = (segment[12] >> 4) * 4;
+
+    for (uint32_t i = user::tcp_size; i < data_offset && segment[i] != user::tcp_option_end;)
+    {
+        if (segment[i] == user::tcp_option_nop)
+        {
+            i++;
+            continue;
+        }
+
+        if (i + 1 >= data_offset || segment[i + 1] < 2)
+        {
+            break;
+        }
+
+        if (segment[i] == user::tcp_option_mss && segment[i + 1] == user::tcp_mss_size &&
+            i + user::tcp_mss_size <= data_offset)
+        {
+            connection.mss = std::min(load_be16(segment.data() + i + 2), user::tcp_mss_max);
+        }
+
+        i += segment[i + 1];
+    }
+
+    // The SYN-ACK goes out once the host socket is connected
+    connections.push_back(std::move(connection));
+}
+
+void UserBackend::segment_in(Connection& connection, std::span<const uint8_t> segment)
+{
+    uint32_t sequence = load_be32(segment.data() + 4);
+    uint32_t acknowledged = load_be32(segment.data() + 8);
+    uint8_t flags = segment[13];
+    std::span<const uint8_t> data = segment.subspan((segment[12] >> 4) * 4);
+
+    if (flags & user::tcp_rst)
+    {
+        close(connection.fd);
+        connection.closed = true;
+        return;
+    }
+
+    if (flags & user::tcp_syn)
+    {
+        // The guest tries again before it saw the SYN-ACK
+        if (connection.connected && !connection.established)
+        {
+            send_segment(connection, user::tcp_syn | user::tcp_ack);
+        }
+
+        return;
+    }
+
+    if (!connection.connected || (flags & user::tcp_ack) == 0)
+    {
+        return;
+    }
+
+    if (sequence_after(acknowledged, connection.acked) &&
+        !sequence_after(acknowledged, connection.next))
+    {
+        connection.acked = acknowledged;
+        connection.established = true;
+    }
+
+    if (!connection.established)
+    {
+        return;
+    }
+
+    connection.guest_window = load_be16(segment.data() + 14);
+
+    bool fin = (flags & user::tcp_fin) != 0;
+
+    if (data.empty() && !fin)
+    {
+        // A window that opened again lets more of the host's data through
+        read_host(connection);
+    }
+    else if (sequence != connection.guest_next || connection.guest_fin)
+    {
+        // Out of order or already taken, the guest hears what is expected instead
+        send_segment(connection, user::tcp_ack);
+    }
+    else
+    {
+        size_t taken = std::min<size_t>(data.size(), user::tcp_buffer - connection.pending.size());
+
+        connection.pending.insert(connection.pending.end(), data.begin(), data.begin() + taken);
+        connection.guest_next += taken;
+
+        if (fin && taken == data.size())
+        {
+            connection.guest_fin = true;
+            connection.guest_next++;
+        }
+
+        flush_pending(connection);
+
+        if (!connection.closed)
+        {
+            send_segment(connection, user::tcp_ack);
+        }
+    }
+
+    if (!connection.closed && connection.guest_fin && connection.host_fin &&
+        connection.acked == connection.next && connection.pending.empty())
+    {
+        close(connection.fd);
+        connection.closed = true;
+    }
+}
+
+void UserBackend::send_segment(Connection& connection, uint8_t flags, std::span<const uint8_t> data)
+{
+    bool syn = (flags & user::tcp_syn) != 0;
+    uint32_t header_size = user::tcp_size + (syn ? user::tcp_mss_size : 0);
+
+    std::vector<uint8_t> reply(header_size + data.size());
+
+    connection.advertised = user::tcp_buffer - connection.pending.size();
+
+    store_be16(reply.data(), connection.port);
+    store_be16(reply.data() + 2, connection.guest_port);
+    store_be32(reply.data() + 4, syn ? connection.acked : connection.next);
+    store_be32(reply.data() + 8, connection.guest_next);
+    reply[12] = (header_size / 4) << 4;
+    reply[13] = flags;
+    store_be16(reply.data() + 14, connection.advertised);
+
+    if (syn)
+    {
+        reply[user::tcp_size] = user::tcp_option_mss;
+        reply[user::tcp_size + 1] = user::tcp_mss_size;
+        store_be16(reply.data() + user::tcp_size + 2, user::tcp_mss_max);
+    }
+
+    std::copy(data.begin(), data.end(), reply.begin() + header_size);
+
+    reply_ipv4(connection.address, user::protocol_tcp, std::move(reply));
+}
+
+void UserBackend::flush_pending(Connection& connection)
+{
+    while (!connection.pending.empty())
+    {
+        ssize_t sent = ::send(connection.fd, connection.pending.data(), connection.pending.size(),
+                              send_flags);
+
+        if (sent < 0)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+            {
+                send_segment(connection, user::tcp_rst | user::tcp_ack);
+                close(connection.fd);
+                connection.closed = true;
+            }
+
+            return;
+        }
+
+        connection.pending.erase(connection.pending.begin(), connection.pending.begin() + sent);
+    }
+
+    if (connection.guest_fin)
+    {
+        shutdown(connection.fd, SHUT_WR);
+    }
+}
+
+void UserBackend::read_host(Connection& connection)
+{
+    std::vector<uint8_t> data(connection.mss);
+
+    while (connection.established && !connection.host_fin)
+    {
+        uint32_t in_flight = connection.next - connection.acked;
+
+        if (in_flight >= connection.guest_window)
+        {
+            return;
+        }
+
+        size_t length = std::min<size_t>(connection.mss, connection.guest_window - in_flight);
+        ssize_t received = recv(connection.fd, data.data(), length, MSG_DONTWAIT);
+
+        if (received > 0)
+        {
+            send_segment(connection, user::tcp_ack | user::tcp_psh,
+                         std::span(data).first(received));
+            connection.next += received;
+        }
+        else if (received == 0)
+        {
+            send_segment(connection, user::tcp_fin | user::tcp_ack);
+            connection.next++;
+            connection.host_fin = true;
+        }
+        else
+        {
+            if (errno != EAGAIN && errno != EINTR)
+            {
+                send_segment(connection, user::tcp_rst | user::tcp_ack);
+                close(connection.fd);
+                connection.closed = true;
+            }
+
+            return;
+        }
+    }
+}
+
+void UserBackend::poll_connections()
+{
+    std::vector<pollfd> waiting;
+
+    for (const Connection& connection : connections)
+    {
+        short events = POLLIN;
+
+        if (!connection.connected || !connection.pending.empty())
+        {
+            events |= POLLOUT;
+        }
+
+        waiting.push_back({connection.fd, events, 0});
+    }
+
+    if (waiting.empty() || poll(waiting.data(), waiting.size(), 0) <= 0)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < waiting.size(); i++)
+    {
+        Connection& connection = connections[i];
+        short events = waiting[i].revents;
+
+        if (events == 0)
+        {
+            continue;
+        }
+
+        if (!connection.connected)
+        {
+            int error = 0;
+            socklen_t error_size = sizeof(error);
+
+            getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &error_size);
+
+            if (error != 0)
+            {
+                send_segment(connection, user::tcp_rst | user::tcp_ack);
+                close(connection.fd);
+                connection.closed = true;
+
+                continue;
+            }
+
+            connection.connected = true;
+            send_segment(connection, user::tcp_syn | user::tcp_ack);
+            connection.next++;
+
+            continue;
+        }
+
+        flush_pending(connection);
+
+        // The guest may be waiting on a window that was almost closed
+        if (!connection.closed && connection.advertised < user::tcp_buffer / 2 &&
+            connection.pending.size() < user::tcp_buffer / 2)
+        {
+            send_segment(connection, user::tcp_ack);
+        }
+
+        if (!connection.closed)
+        {
+            read_host(connection);
+        }
+    }
+
+    std::erase_if(connections, [](const Connection& connection) { return connection.closed; });
+}
+
+void UserBackend::close_connections()
+{
+    for (const Connection& connection : connections)
+    {
+        close(connection.fd);
+    }
+
+    connections.clear();
+}
+
+Flow* UserBackend::open_flow(uint16_t guest_port, uint32_t address, uint16_t port)
+{
+    auto flow = std::find_if(flows.begin(), flows.end(), [&](const Flow& flow) {
+        return flow.guest_port == guest_port && flow.address == address && flow.port == port;
+    });
+
+    if (flow != flows.end())
+    {
+        flow->last_used = clock++;
+        return &*flow;
+    }
+
+    if (flows.size() == user::flow_limit)
+    {
+        auto oldest = std::min_element(flows.begin(), flows.end(), [](auto& a, auto& b) {
+            return a.last_used < b.last_used;
+        });
+
+        close(oldest->fd);
+        flows.erase(oldest);
+    }
+
+    // The gateway stands for the host itself
+    sockaddr_in remote = {};
+    remote.sin_family = AF_INET;
+    remote.sin_port = htons(port);
+    remote.sin_addr.s_addr = htonl(address == user::gateway ? INADDR_LOOPBACK : address);
+
+    int fd = prepare_socket(socket(AF_INET, SOCK_DGRAM, 0));
+
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&remote), sizeof(remote)) != 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    flows.push_back({guest_port, address, port, fd, clock++});
+
+    return &flows.back();
+}
+
+void UserBackend::poll_flows()
+{
+    std::vector<pollfd> waiting;
+
+    for (const Flow& flow : flows)
+    {
+        waiting.push_back({flow.fd, POLLIN, 0});
+    }
+
+    if (waiting.empty() || poll(waiting.data(), waiting.size(), 0) <= 0)
+    {
+        return;
+    }
+
+    // What fits into one frame, a larger datagram is cut short
+    std::vector<uint8_t> datagram(frame_max - user::eth_size - user::ip_size);
+
+    for (size_t i = 0; i < waiting.size(); i++)
+    {
+        if ((waiting[i].revents & POLLIN) == 0)
+        {
+            continue;
+        }
+
+        const Flow& flow = flows[i];
+        ssize_t length;
+
+        while ((length = recv(flow.fd, datagram.data() + user::udp_size,
+                              datagram.size() - user::udp_size, MSG_DONTWAIT)) >= 0)
+        {
+            std::vector<uint8_t> reply(datagram.begin(),
+                                       datagram.begin() + user::udp_size + length);
+
+            store_be16(reply.data(), flow.port);
+            store_be16(reply.data() + 2, flow.guest_port);
+            store_be16(reply.data() + 4, reply.size());
+
+            reply_ipv4(flow.address, user::protocol_udp, std::move(reply));
+        }
+    }
+}
+
+void UserBackend::close_flows()
+{
+    for (const Flow& flow : flows)
+    {
+        close(flow.fd);
+    }
+
+    flows.clear();
+}
+
+void UserBackend::reply_ipv4(uint32_t source, uint8_t protocol, std::vector<uint8_t> payload)
+{
+    std::vector<uint8_t> frame(user::eth_size + user::ip_size + payload.size());
+    uint8_t* ip = frame.data() + user::eth_size;
+    uint8_t* transport = ip + user::ip_size;
+
+    std::copy(guest_mac.begin(), guest_mac.end(), frame.begin());
+    std::copy(user::gateway_mac.begin(), user::gateway_mac.end(), frame.begin() + 6);
+    store_be16(frame.data() + 12, user::ethertype_ipv4);
+
+    ip[0] = 0x45;
+    store_be16(ip + 2, user::ip_size + payload.size());
+    store_be16(ip + 4, ip_id++);
+    ip[8] = 64;
+    ip[9] = protocol;
+    store_be32(ip + 12, source);
+    store_be32(ip + 16, guest_address);
+    store_be16(ip + 10, ~checksum({ip, user::ip_size}));
+
+    std::copy(payload.begin(), payload.end(), transport);
+
+    std::span<const uint8_t> message(transport, payload.size());
+
+    if (protocol == user::protocol_icmp)
+    {
+        store_be16(transport + 2, 0);
+        store_be16(transport + 2, ~checksum(message));
+    }
+    else
+    {
+        // The pseudo header, the addresses are summed straight from the IP header
+        uint32_t pseudo = checksum({ip + 12, 8}) + protocol + payload.size();
+        uint8_t* field = transport + (protocol == user::protocol_udp ? 6 : 16);
+
+        store_be16(field, 0);
+
+        uint16_t sum = ~checksum(message, pseudo);
+
+        // An all zero UDP checksum would mean there is none
+        store_be16(field, sum == 0 && protocol == user::protocol_udp ? 0xffff : sum);
+    }
+
+    replies.push_back(std::move(frame));
+}
+
+bool UserBackend::receive(Packet& packet)
+{
+    if (replies.empty())
+    {
+        poll_flows();
+        poll_connections();
+    }
+
+    if (replies.empty())
+    {
+        return false;
+    }
+
+    // Every checksum was computed here
+    packet.header = {};
+    packet.frame = std::move(replies.front());
+    replies.pop_front();
+
+    return true;
+}
+
+void UserBackend::forked()
+{
+    // The parent's sockets would get the child's answers
+    close_flows();
+    close_connections();
+    replies.clear();
+}
+
+std::unique_ptr<Backend> open_user()
+{
+    return std::make_unique<UserBackend>();
+}
+
+bool is_supported([[maybe_unused]] std::string_view spec)
+{
+#if __linux__
+    return true;
+#else
+    return !spec.starts_with("socket:") && !spec.starts_with("tap:");
+#endif
+}
+
+std::unique_ptr<Backend> open(std::string_view spec)
+{
+    if (spec == "user")
+    {
+        return open_user();
+    }
+
+    if (spec.starts_with("socket:"))
+    {
+        return open_socket(std::string(spec.substr(7)).c_str());
+    }
+
+    if (spec.starts_with("tap:"))
+    {
+        return open_tap(std::string(spec.substr(4)).c_str());
+    }
+
+    return {};
+}
+} // namespace net
@@ -1,5 +1,7 @@
 #include "plic.hpp"
 #include "helper.hpp"
+#include "snapshot.hpp"
+#include <bit>
 #include <fmt/core.h>
 #include <iostream>
 
@@ -35,7 +37,7 @@ uint64_t PlicDevice::load(Bus& bus, uint64_t address, uint64_t length)
         }
         else if (offset == 4)
         {
-            return claim[context];
+            return claim(context);
         }
     }
 
@@ -49,6 +51,8 @@ void PlicDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t leng
         uint64_t idx = (address - source_prio_addr) / sizeof(prioprity[0]);
 
         prioprity[idx] = value;
+
+        notify_harts(bus);
     }
     else if (helper::value_in_range_inclusive(address, pending_addr, pending_end_addr))
     {
@@ -61,6 +65,8 @@ void PlicDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t leng
         uint64_t idx = (address - enable_addr) / sizeof(enable[0]);
 
         enable[idx] = value;
+
+        notify_harts(bus);
     }
     else if (helper::value_in_range_inclusive(address, treshold_claim_addr,
                                               treshold_claim_end_addr))
@@ -71,41 +77,94 @@ void PlicDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t leng
         if (offset == 0)
         {
             treshold[context] = value;
+
+            notify_harts(bus);
         }
         else if (offset == 4)
         {
-            clear_pending(value);
+            complete(bus, value);
         }
     }
 }
 
-void PlicDevice::update_pending(uint64_t irq)
+void PlicDevice::update_pending(Bus& bus, uint64_t irq)
 {
-    uint64_t idx = irq / sizeof(pending[0]);
+    uint64_t idx = (irq % prioprity.size()) / (sizeof(pending[0]) * 8);
+    uint64_t offset = (irq % prioprity.size()) % (sizeof(pending[0]) * 8);
 
-    pending[idx] |= 1U << irq;
+    pending[idx] |= 1U << offset;
 
-    update_claim(irq);
+    notify_harts(bus);
 }
 
 void PlicDevice::clear_pending(uint64_t irq)
 {
-    uint64_t idx = irq / sizeof(pending[0]);
+    uint64_t idx = (irq % prioprity.size()) / (sizeof(pending[0]) * 8);
+    uint64_t offset = (irq % prioprity.size()) % (sizeof(pending[0]) * 8);
 
-    pending[idx] &= ~(1U << irq);
+    pending[idx] &= ~(1U << offset);
+}
 
-    update_claim(0);
+uint32_t PlicDevice::claim(uint64_t context)
+{
+    uint32_t irq = get_best_irq(context);
+
+    // Whoever claims first gets the irq, any other context reads 0 for it from now on
+    clear_pending(irq);
+
+    return irq;
 }
 
-void PlicDevice::update_claim(uint64_t irq)
+void PlicDevice::complete(Bus& bus, uint64_t irq)
 {
-    if (is_enabled(1, irq) || irq == 0)
+    if (irq < 64 && ((bus.get_irq_lines() >> irq) & 1) != 0)
+    {
+        update_pending(bus, irq);
+    }
+    else
     {
-        claim[1] = irq;
+        // The hart took only one of the irqs waiting for it
+        notify_harts(bus);
     }
 }
 
-bool PlicDevice::is_enabled(uint64_t context, uint64_t irq)
+uint32_t PlicDevice::get_best_irq(uint64_t context) const
+{
+    uint32_t best_irq = 0;
+    uint32_t best_prioprity = treshold[context];
+
+    for (uint64_t idx = 0; idx < pending.size(); idx++)
+    {
+        uint32_t candidates = pending[idx] & enable[context * pending.size() + idx];
+
+        // Ties go to the lowest irq, irq 0 does not exist
+        for (; candidates != 0; candidates &= candidates - 1)
+        {
+            uint32_t irq = idx * sizeof(pending[0]) * 8 + std::countr_zero(candidates);
+
+            if (irq != 0 && prioprity[irq] > best_prioprity)
+            {
+                best_irq = irq;
+                best_prioprity = prioprity[irq];
+            }
+        }
+    }
+
+    return best_irq;
+}
+
+void PlicDevice::notify_harts(Bus& bus)
+{
+    for (uint64_t context = 1; context < contexts; context += 2)
+    {
+        if (get_best_irq(context) != 0)
+        {
+            bus.notify_hart(context / 2);
+        }
+    }
+}
+
+bool PlicDevice::is_enabled(uint64_t context, uint64_t irq) const
 {
     uint64_t idx = (irq % prioprity.size()) / (sizeof(prioprity[0]) * 8);
     uint64_t offset = (irq % prioprity.size()) % (sizeof(prioprity[0]) * 8);
@@ -123,6 +182,22 @@ uint64_t PlicDevice::get_end_address() const
     return end_addr;
 }
 
+void PlicDevice::save(snapshot::Writer& writer)
+{
+    writer.put(prioprity);
+    writer.put(pending);
+    writer.put(enable);
+    writer.put(treshold);
+}
+
+void PlicDevice::restore(snapshot::Reader& reader)
+{
+    reader.get(prioprity);
+    reader.get(pending);
+    reader.get(enable);
+    reader.get(treshold);
+}
+
 void PlicDevice::dump(std::ostream& stream) const
 {
 }
@@ -1,14 +1,24 @@
 #include "ram.hpp"
 #include "helper.hpp"
+#include <algorithm>
+#include <bit>
 #include <cstdlib>
+#include <fcntl.h>
 #include <fstream>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Also the huge page size, so the mapping can always be backed by huge pages
+constexpr uint64_t mapping_granule = SIZE_MIB(2);
 
 RamDevice::RamDevice(uint64_t rom_start_address, uint64_t rom_end_offset)
 {
     base_addr = rom_start_address;
     end_addr = rom_start_address + rom_end_offset;
 
-    data.resize(end_addr - base_addr);
+    map(end_addr - base_addr);
 }
 
 RamDevice::RamDevice(uint64_t rom_start_address, uint64_t rom_end_offset, std::vector<uint8_t> data)
@@ -16,10 +26,44 @@ RamDevice::RamDevice(uint64_t rom_start_address, uint64_t rom_end_offset, std::v
     base_addr = rom_start_address;
     end_addr = rom_start_address + rom_end_offset;
 
-    this->data.resize(end_addr - base_addr);
+    map(end_addr - base_addr);
     set_data(std::move(data));
 }
 
+RamDevice::~RamDevice()
+{
+    munmap(data.data(), mapping_size);
+}
+
+void RamDevice::map(uint64_t size)
+{
+    mapping_size = (size + mapping_granule - 1) & ~(mapping_granule - 1);
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    void* memory = MAP_FAILED;
+
+#if RAM_HUGETLB && defined(MAP_HUGETLB)
+    memory = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+#endif
+
+    if (memory == MAP_FAILED)
+    {
+        memory = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+        if (memory == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+
+#if RAM_TRANSPARENT_HUGEPAGES && defined(MADV_HUGEPAGE)
+        madvise(memory, mapping_size, MADV_HUGEPAGE);
+#endif
+    }
+
+    data = std::span<uint8_t>(static_cast<uint8_t*>(memory), size);
+    dirty.resize(size);
+}
+
 uint64_t RamDevice::load(Bus& bus, uint64_t address, uint64_t length)
 {
     address -= base_addr;
@@ -46,10 +90,111 @@ void RamDevice::set_data(std::vector<uint8_t> data)
     memcpy(this->data.data(), data.data(), data.size());
 }
 
+std::optional<uint64_t> RamDevice::load_file(const char* path, uint64_t offset)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return {};
+    }
+
+    struct stat file_stat = {};
+    bool loaded = fstat(fd, &file_stat) == 0 && offset + file_stat.st_size <= data.size() &&
+                  map_file_range(fd, offset, 0, file_stat.st_size);
+
+    close(fd);
+
+    if (!loaded)
+    {
+        return {};
+    }
+
+    return file_stat.st_size;
+}
+
+bool RamDevice::map_file_range(int fd, uint64_t offset, uint64_t file_offset, uint64_t length)
+{
+    return helper::map_file_range(data.data() + offset, fd, file_offset, length);
+}
+
+bool RamDevice::clear_range(uint64_t offset, uint64_t length)
+{
+    return helper::clear_range(data.data() + offset, length);
+}
+
+void RamDevice::save(snapshot::Writer& writer)
+{
+    writer.put_sparse(data, dirty);
+}
+
+void RamDevice::restore(snapshot::Reader& reader)
+{
+    snapshot::Reader::Sparse sparse = reader.get_sparse();
+
+    if (!reader.good() || sparse.size != data.size())
+    {
+        reader.fail();
+        return;
+    }
+
+    if (sparse.complete && !clear_range(0, data.size()))
+    {
+        reader.fail();
+        return;
+    }
+
+    for (const auto& run : sparse.runs)
+    {
+        if (run.zero ? !clear_range(run.offset, run.length)
+                     : !map_file_range(reader.get_fd(), run.offset, run.file_offset, run.length))
+        {
+            reader.fail();
+            return;
+        }
+    }
+}
+
+void RamDevice::reserve(uint64_t hart_id, uint64_t address)
+{
+    reservations[hart_id].granule.store(address & ~7ULL);
+    reserved_harts.fetch_or(1ULL << hart_id);
+}
+
+uint64_t RamDevice::release(uint64_t hart_id)
+{
+    uint64_t granule = reservations[hart_id].granule.exchange(no_reservation);
+
+    reserved_harts.fetch_and(~(1ULL << hart_id));
+
+    return granule;
+}
+
+void RamDevice::break_other_reservations(uint64_t hart_id, uint64_t address)
+{
+    uint64_t harts = reserved_harts.load(std::memory_order_relaxed) & ~(1ULL << hart_id);
+    uint64_t granule = address & ~7ULL;
+
+    while (harts != 0)
+    {
+        uint64_t hart = std::countr_zero(harts);
+        harts &= harts - 1;
+
+        uint64_t expected = granule;
+
+        if (reservations[hart].granule.compare_exchange_strong(expected, no_reservation))
+        {
+            reserved_harts.fetch_and(~(1ULL << hart));
+        }
+    }
+}
+
 void RamDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t length)
 {
     address -= base_addr;
 
+    dirty.mark(address);
+
     switch (length)
     {
     case 8:
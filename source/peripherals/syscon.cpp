@@ -1,4 +1,6 @@
 #include "syscon.hpp"
+#include "fork_server.hpp"
+#include "snapshot.hpp"
 #include <cstdlib>
 
 uint64_t SysconDevice::load(Bus& bus, uint64_t address, uint64_t length)
@@ -16,6 +18,14 @@ void SysconDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t le
     {
         std::exit(0);
     }
+    else if (value == snapshot_addr)
+    {
+        snapshot::request();
+    }
+    else if (value == fork_server_addr)
+    {
+        fork_server::request();
+    }
 }
 
 void SysconDevice::dump(std::ostream& stream) const
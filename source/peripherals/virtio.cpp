@@ -2,124 +2,315 @@
 #include "cpu.hpp"
 #include "cpu_config.hpp"
 #include "helper.hpp"
+#include "ram.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <string>
 
 namespace virtio
 {
-VirtioBlkDevice::VirtioBlkDevice(std::vector<uint8_t> data) : rfsimg(std::move(data))
+MmioDevice::MmioDevice(uint64_t base_addr, uint32_t irqn, uint32_t device_type)
+    : mmio_base(base_addr), irqn(irqn), device_type(device_type)
 {
-    queue_notify = cfg::queue_notify_reset;
+    // What the rings can do, the same for every device
+    host_features[0] = cfg::ring_f_indirect_desc | cfg::ring_f_event_idx;
+    host_features[1] = cfg::f_in_order;
 
-    vq.align = cfg::virtqueue_align;
+#if !VIRTIO_MMIO_LEGACY
+    host_features[1] |= cfg::f_version_1;
+#endif
+}
 
-    config[1] = 0x20;
-    config[2] = 0x03;
+void MmioDevice::reset()
+{
+    for (uint32_t index = 0; Queue* queue = get_queue(index); index++)
+    {
+        queue->vq = {};
+        queue->vq.align = cfg::virtqueue_align;
+        queue->pfn = 0;
+        queue->ready = 0;
+        queue->last_avail = 0;
+        queue->used_idx = 0;
+    }
 
-    host_features[1] = 1 << 3;
+    isr = 0;
+}
 
-    reset();
+void MmioDevice::update(Queue& queue)
+{
+    Virtq& vq = queue.vq;
+
+    // The modern interface is told where each ring is instead
+    if (queue.pfn == 0)
+    {
+        return;
+    }
+
+    vq.desc = static_cast<uint64_t>(queue.pfn) * guest_page_size;
+    vq.avail = vq.desc + vq.num * sizeof(VirtqDesc);
+    // The avail ring ends with the used event index
+    vq.used = helper::align_up(vq.avail + offsetof(VRingAvail, ring) +
+                                   vq.num * sizeof(VRingAvail::ring[0]) + sizeof(uint16_t),
+                               vq.align);
 }
 
-VirtioBlkDevice::~VirtioBlkDevice()
+Queue* MmioDevice::selected_queue()
 {
+    return get_queue(queue_sel);
 }
 
-void VirtioBlkDevice::reset()
+uint8_t* MmioDevice::guest_ram(RamDevice& ram, uint64_t address, uint64_t length)
 {
-    id = 0;
-    isr = 0;
+    if (address < ram.base_addr || address - ram.base_addr > ram.data.size() ||
+        length > ram.data.size() - (address - ram.base_addr))
+    {
+        return nullptr;
+    }
+
+    return ram.data.data() + (address - ram.base_addr);
 }
 
-void VirtioBlkDevice::update()
+// Rings and descriptors are only looked for in guest RAM. Ticks hold the bus device lock, through
+// the bus a guest could point them at a device and have the hart take the lock again
+template <typename T>
+static T load_ring(Cpu& cpu, uint64_t address)
 {
-    vq.desc = queue_pfn * guest_page_size;
-    vq.avail = vq.desc + vq.num * sizeof(VirtqDesc);
-    vq.used = helper::align_up(
-        vq.avail + offsetof(VRingAvail, ring) + vq.num * sizeof(VRingAvail::ring[0]), vq.align);
+    T value = 0;
+
+    if (uint8_t* host = MmioDevice::guest_ram(*cpu.dram_device, address, sizeof(T)))
+    {
+        memcpy(&value, host, sizeof(T));
+    }
+
+    return value;
 }
 
-VirtqDesc VirtioBlkDevice::load_desc(Cpu& cpu, uint64_t address)
+template <typename T>
+static void store_ring(Cpu& cpu, uint64_t address, T value)
 {
-    VirtqDesc desc;
-    desc.addr = cpu.bus.load(cpu, address, 64);
-    desc.len = cpu.bus.load(cpu, address + 8, 32);
-    desc.flags = cpu.bus.load(cpu, address + 12, 16);
-    desc.next = cpu.bus.load(cpu, address + 14, 16);
+    RamDevice& ram = *cpu.dram_device;
 
-    return desc;
+    if (uint8_t* host = MmioDevice::guest_ram(ram, address, sizeof(T)))
+    {
+        memcpy(host, &value, sizeof(T));
+        ram.dirty.mark(address - ram.base_addr);
+    }
 }
 
-void VirtioBlkDevice::access_disk(Cpu& cpu)
+bool MmioDevice::queue_ready(Cpu& cpu, const Queue& queue) const
 {
-    uint64_t desc = vq.desc;
-    uint64_t avail = vq.avail;
-    uint64_t used = vq.used;
+    const Virtq& vq = queue.vq;
+    RamDevice& ram = *cpu.dram_device;
+
+    // The avail ring ends with the used event index and the used ring with the avail one
+    return queue.ready != 0 && vq.num != 0 &&
+           guest_ram(ram, vq.desc, vq.num * sizeof(VirtqDesc)) != nullptr &&
+           guest_ram(ram, vq.avail, offsetof(VRingAvail, ring) + (vq.num + 1) * sizeof(uint16_t)) !=
+               nullptr &&
+           guest_ram(ram, vq.used, 4 + vq.num * 8 + sizeof(uint16_t)) != nullptr;
+}
 
-    uint64_t queue_size = vq.num;
+bool MmioDevice::load_desc(Cpu& cpu, uint64_t address, VirtqDesc& desc)
+{
+    uint8_t* host = guest_ram(*cpu.dram_device, address, sizeof(VirtqDesc));
 
-    uint16_t idx = cpu.bus.load(cpu, avail + offsetof(VRingAvail, idx), 16);
-    uint16_t desc_offset = cpu.bus.load(cpu, avail + 4 + (idx % queue_size) * sizeof(uint16_t), 16);
+    if (host == nullptr)
+    {
+        return false;
+    }
 
-    VirtqDesc desc0 = load_desc(cpu, desc + sizeof(VirtqDesc) * desc_offset);
-    VirtqDesc desc1 = load_desc(cpu, desc + sizeof(VirtqDesc) * desc0.next);
-    VirtqDesc desc2 = load_desc(cpu, desc + sizeof(VirtqDesc) * desc1.next);
+    memcpy(&desc, host, sizeof(VirtqDesc));
 
-    uint32_t blk_req_type = cpu.bus.load(cpu, desc0.addr, 32);
-    uint64_t blk_req_sector = cpu.bus.load(cpu, desc0.addr + 8, 64);
+    return true;
+}
 
-    if (blk_req_type == cfg::blk_t_out)
+std::vector<VirtqDesc> MmioDevice::read_chain(Cpu& cpu, Queue& queue, uint16_t head)
+{
+    const Virtq& vq = queue.vq;
+    std::vector<VirtqDesc> chain;
+
+    uint64_t table = vq.desc;
+    uint64_t table_size = vq.num;
+    uint64_t steps = 0;
+    uint16_t index = head;
+
+    // A chain longer than its table can only be a loop
+    while (steps++ < table_size)
     {
-        for (uint32_t i = 0; i < desc1.len; i++)
+        VirtqDesc desc;
+
+        // The whole request fails with a descriptor outside of RAM
+        if (!load_desc(cpu, table + sizeof(VirtqDesc) * (index % table_size), desc))
         {
-            rfsimg[blk_req_sector * cfg::sector_size + i] = cpu.bus.load(cpu, desc1.addr + i, 8);
+            return {};
         }
+
+        // The rest of the chain is in a table of its own, which cannot point to another one
+        if ((desc.flags & cfg::desc_f_indirect) != 0 && table == vq.desc &&
+            negotiated(cfg::ring_f_indirect_desc))
+        {
+            table = desc.addr;
+            table_size = desc.len / sizeof(VirtqDesc);
+            steps = 0;
+            index = 0;
+
+            continue;
+        }
+
+        chain.push_back(desc);
+
+        if ((desc.flags & cfg::desc_f_next) == 0)
+        {
+            break;
+        }
+
+        index = desc.next;
+    }
+
+    return chain;
+}
+
+uint16_t MmioDevice::avail_idx(Cpu& cpu, const Queue& queue)
+{
+    return load_ring<uint16_t>(cpu, queue.vq.avail + offsetof(VRingAvail, idx));
+}
+
+uint16_t MmioDevice::avail_entry(Cpu& cpu, const Queue& queue, uint16_t position)
+{
+    const Virtq& vq = queue.vq;
+
+    return load_ring<uint16_t>(
+        cpu, vq.avail + offsetof(VRingAvail, ring) + (position % vq.num) * sizeof(uint16_t));
+}
+
+void MmioDevice::push_used(Cpu& cpu, Queue& queue, uint16_t head, uint32_t written)
+{
+    const Virtq& vq = queue.vq;
+    uint64_t element = vq.used + 4 + (queue.used_idx % vq.num) * 8;
+
+    store_ring<uint32_t>(cpu, element, head);
+    store_ring<uint32_t>(cpu, element + 4, written);
+
+    queue.used_idx++;
+}
+
+void MmioDevice::publish_used(Cpu& cpu, Queue& queue, uint16_t old_idx)
+{
+    const Virtq& vq = queue.vq;
+    uint16_t id = queue.used_idx;
+
+    store_ring<uint16_t>(cpu, vq.used + 2, id);
+
+    bool interrupt;
+
+    if (negotiated(cfg::ring_f_event_idx))
+    {
+        // Only when the used index went past the one the guest asked to hear about
+        uint16_t used_event = load_ring<uint16_t>(
+            cpu, vq.avail + offsetof(VRingAvail, ring) + vq.num * sizeof(VRingAvail::ring[0]));
+
+        interrupt = static_cast<uint16_t>(id - used_event - 1) < static_cast<uint16_t>(id - old_idx);
     }
     else
     {
-        for (uint32_t i = 0; i < desc1.len; i++)
-        {
-            uint8_t byte = rfsimg[blk_req_sector * cfg::sector_size + i];
+        uint16_t flags = load_ring<uint16_t>(cpu, vq.avail + offsetof(VRingAvail, flags));
+
+        interrupt = (flags & cfg::avail_f_no_interrupt) == 0;
+    }
+
+    if (interrupt)
+    {
+        isr |= 0x1;
+    }
+}
+
+void MmioDevice::set_notifications(Cpu& cpu, Queue& queue, bool enabled)
+{
+    const Virtq& vq = queue.vq;
 
-            cpu.bus.store(cpu, desc1.addr + i, byte, 8);
+    if (negotiated(cfg::ring_f_event_idx))
+    {
+        // The avail event index after the used ring, a stale one already passed means none
+        if (enabled)
+        {
+            store_ring<uint16_t>(cpu, vq.used + 4 + vq.num * 8, queue.last_avail);
         }
     }
+    else
+    {
+        store_ring<uint16_t>(cpu, vq.used, enabled ? 0 : cfg::used_f_no_notify);
+    }
+}
 
-    cpu.bus.store(cpu, desc2.addr, cfg::blk_s_ok, 8);
-    cpu.bus.store(cpu, used + 4 + ((id % queue_size) * 8), desc_offset, 16);
+bool MmioDevice::negotiated(uint32_t feature) const
+{
+    return (guest_features[0] & feature) != 0;
+}
 
-    ++id;
-    cpu.bus.store(cpu, used + 2, id, 16);
+// One half of a ring address of the modern interface
+static void set_address_half(uint64_t& address, uint64_t value, bool high)
+{
+    if (high)
+    {
+        address = (address & 0xffffffffULL) | (value << 32);
+    }
+    else
+    {
+        address = (address & ~0xffffffffULL) | (value & 0xffffffffULL);
+    }
 }
 
-uint64_t VirtioBlkDevice::load(Bus& bus, uint64_t address, uint64_t length)
+uint64_t MmioDevice::load(Bus& bus, uint64_t address, uint64_t length)
 {
-    address -= base_addr;
+    address -= mmio_base;
 
     if (address >= cfg::config)
     {
-        int index = address - cfg::config;
-        return config[index];
+        std::span<uint8_t> config = get_config();
+        uint64_t index = address - cfg::config;
+        uint64_t value = 0;
+
+        // The modern interface reads fields at their own width
+        for (uint64_t i = 0; i < length / 8 && index + i < config.size(); i++)
+        {
+            value |= static_cast<uint64_t>(config[index + i]) << (i * 8);
+        }
+
+        return value;
     }
 
+    Queue* queue = selected_queue();
+
     switch (address)
     {
     case cfg::magic_value:
         return cfg::magic;
     case cfg::version:
+#if VIRTIO_MMIO_LEGACY
         return cfg::version_legacy;
+#else
+        return cfg::version_modern;
+#endif
     case cfg::device_id:
-        return cfg::blk_dev;
+        return device_type;
     case cfg::vendor_id:
         return cfg::vendor;
     case cfg::device_features:
-        return host_features[host_features_sel];
+        return host_features_sel < host_features.size() ? host_features[host_features_sel] : 0;
     case cfg::queue_num_max:
-        return cfg::virtqueue_max_size;
+        // Queues past the last one do not exist
+        return queue != nullptr ? cfg::virtqueue_max_size : 0;
     case cfg::queue_pfn:
-        return queue_pfn;
+        return queue != nullptr ? queue->pfn : 0;
+    case cfg::queue_ready:
+        return queue != nullptr ? queue->ready : 0;
     case cfg::interrupt_status:
         return isr;
     case cfg::status:
         return status;
+    case cfg::config_generation:
+        return 0;
     default:
         break;
     }
@@ -127,18 +318,25 @@ uint64_t VirtioBlkDevice::load(Bus& bus, uint64_t address, uint64_t length)
     return 0;
 }
 
-void VirtioBlkDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t length)
+void MmioDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t length)
 {
-    address -= base_addr;
+    address -= mmio_base;
 
     if (address >= cfg::config)
     {
-        int index = address - cfg::config;
-        config[index] = (value >> (index * 8)) & 0xff;
+        std::span<uint8_t> config = get_config();
+        uint64_t index = address - cfg::config;
+
+        for (uint64_t i = 0; i < length / 8 && index + i < config.size(); i++)
+        {
+            config[index + i] = value >> (i * 8);
+        }
 
         return;
     }
 
+    Queue* queue = selected_queue();
+
     switch (address)
     {
     case cfg::device_features_sel: {
@@ -146,7 +344,10 @@ void VirtioBlkDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t
         break;
     }
     case cfg::driver_features: {
-        guest_features[guest_features_sel] = value;
+        if (guest_features_sel < guest_features.size())
+        {
+            guest_features[guest_features_sel] = value;
+        }
         break;
     }
     case cfg::driver_features_sel: {
@@ -157,28 +358,17 @@ void VirtioBlkDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t
         guest_page_size = value;
         break;
     }
-    case cfg::queue_sel:
-        break;
-    case cfg::queue_num: {
-        vq.num = value;
-        break;
-    }
-    case cfg::queue_align: {
-        vq.align = value;
-        break;
-    }
-    case cfg::queue_pfn: {
-        queue_pfn = value;
-        update();
+    case cfg::queue_sel: {
+        queue_sel = value;
         break;
     }
     case cfg::queue_notify: {
-        queue_notify = value;
-        notify_clock = clock;
+        // Every queue is looked at when the device ticks
+        bus.scheduler.schedule_in(this, 0);
         break;
     }
     case cfg::interrupt_ack: {
-        isr = ~value;
+        isr &= ~value;
         break;
     }
     case cfg::status: {
@@ -190,52 +380,634 @@ void VirtioBlkDevice::store(Bus& bus, uint64_t address, uint64_t value, uint64_t
         }
         else if (status & 0x4)
         {
-            update();
+            for (uint32_t index = 0; Queue* device_queue = get_queue(index); index++)
+            {
+                update(*device_queue);
+            }
         }
 
         break;
     }
     default:
+        if (queue != nullptr)
+        {
+            store_queue(*queue, address, value);
+        }
         break;
     }
+
+    // Acknowledging or resetting can drop the line
+    bus.set_irq_line(irqn, isr & 0x1);
 }
 
-void VirtioBlkDevice::tick(Cpu& cpu)
+void MmioDevice::store_queue(Queue& queue, uint64_t address, uint64_t value)
 {
-    if (queue_notify != cfg::queue_notify_reset && clock == notify_clock + cfg::disk_delay)
+    switch (address)
     {
-        isr |= 0x1;
+    case cfg::queue_num: {
+        queue.vq.num = std::min<uint64_t>(value, cfg::virtqueue_max_size);
+        break;
+    }
+    case cfg::queue_align: {
+        queue.vq.align = value;
+        break;
+    }
+    case cfg::queue_pfn: {
+        queue.pfn = value;
+        queue.ready = value != 0;
+        update(queue);
+        break;
+    }
+    case cfg::queue_ready: {
+        queue.ready = value & 0x1;
+        break;
+    }
+    case cfg::queue_desc_low:
+    case cfg::queue_desc_high: {
+        set_address_half(queue.vq.desc, value, address == cfg::queue_desc_high);
+        break;
+    }
+    case cfg::queue_driver_low:
+    case cfg::queue_driver_high: {
+        set_address_half(queue.vq.avail, value, address == cfg::queue_driver_high);
+        break;
+    }
+    case cfg::queue_device_low:
+    case cfg::queue_device_high: {
+        set_address_half(queue.vq.used, value, address == cfg::queue_device_high);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void MmioDevice::save_transport(snapshot::Writer& writer)
+{
+    std::span<uint8_t> config = get_config();
+
+    writer.put(queue_sel);
+    writer.put(host_features);
+    writer.put(guest_features);
+    writer.put(host_features_sel);
+    writer.put(guest_features_sel);
+    writer.put(guest_page_size);
+    writer.put(isr);
+    writer.put(status);
+    writer.put_bytes(config.data(), config.size());
+}
+
+void MmioDevice::restore_transport(snapshot::Reader& reader)
+{
+    std::span<uint8_t> config = get_config();
+
+    reader.get(queue_sel);
+    reader.get(host_features);
+    reader.get(guest_features);
+    reader.get(host_features_sel);
+    reader.get(guest_features_sel);
+    reader.get(guest_page_size);
+    reader.get(isr);
+    reader.get(status);
+    reader.get_bytes(config.data(), config.size());
+}
+
+void MmioDevice::save_queue(snapshot::Writer& writer, const Queue& queue)
+{
+    writer.put(queue.vq);
+    writer.put(queue.pfn);
+    writer.put(queue.ready);
+    writer.put(queue.last_avail);
+    writer.put(queue.used_idx);
+}
+
+void MmioDevice::restore_queue(snapshot::Reader& reader, Queue& queue)
+{
+    reader.get(queue.vq);
+    reader.get(queue.pfn);
+    reader.get(queue.ready);
+    reader.get(queue.last_avail);
+    reader.get(queue.used_idx);
+}
+
+uint64_t MmioDevice::get_base_address() const
+{
+    return mmio_base;
+}
+
+uint64_t MmioDevice::get_end_address() const
+{
+    return mmio_base + cfg::virtio_size;
+}
+
+void MmioDevice::dump(std::ostream& stream) const
+{
+}
+
+VirtioBlkDevice::VirtioBlkDevice() : MmioDevice(base_addr, cfg::virtio_irqn, cfg::blk_dev)
+{
+    host_features[0] |= cfg::blk_f_seg_max;
+
+    if (cfg::blk_queue_count > 1)
+    {
+        host_features[0] |= cfg::blk_f_mq;
+    }
+
+    helper::store32(config.data() + cfg::blk_config_seg_max, cfg::blk_seg_max);
+    helper::store16(config.data() + cfg::blk_config_num_queues, cfg::blk_queue_count);
+
+    reset();
+}
+
+VirtioBlkDevice::~VirtioBlkDevice()
+{
+}
+
+bool VirtioBlkDevice::open_disk(const char* path, disk::Mode mode, const char* overlay_path)
+{
+    if (!disk.open(path, mode, overlay_path))
+    {
+        return false;
+    }
+
+    // The capacity in sectors
+    helper::store64(config.data(), disk.size() / cfg::sector_size);
+
+    if (disk.read_only())
+    {
+        host_features[0] |= cfg::blk_f_ro;
+    }
+
+    if (disk.write_back())
+    {
+        host_features[0] |= cfg::blk_f_flush;
+    }
+
+    return true;
+}
+
+Queue* VirtioBlkDevice::get_queue(uint32_t index)
+{
+    return index < queues.size() ? &queues[index] : nullptr;
+}
+
+std::span<uint8_t> VirtioBlkDevice::get_config()
+{
+    return config;
+}
+
+void VirtioBlkDevice::reset()
+{
+    quiesce();
+
+    MmioDevice::reset();
+
+    for (BlkQueue& queue : queues)
+    {
+        queue.completed.clear();
+    }
+}
+
+BlkRequest VirtioBlkDevice::read_request(Cpu& cpu, BlkQueue& queue, uint16_t head)
+{
+    BlkRequest request = {};
+    request.completion = {head, cfg::blk_s_ioerr, 0, 0};
+
+    std::vector<VirtqDesc> chain = read_chain(cpu, queue, head);
+
+    if (chain.size() < 2)
+    {
+        return request;
+    }
+
+    // The header comes first and the status byte last, the data is everything in between
+    const VirtqDesc& header = chain.front();
+    const VirtqDesc& footer = chain.back();
+
+    if (header.len < cfg::blk_header_size || footer.len == 0 ||
+        guest_ram(*cpu.dram_device, header.addr, cfg::blk_header_size) == nullptr ||
+        guest_ram(*cpu.dram_device, footer.addr + footer.len - 1, 1) == nullptr)
+    {
+        return request;
+    }
+
+    request.type = load_ring<uint32_t>(cpu, header.addr);
+    request.sector = load_ring<uint64_t>(cpu, header.addr + 8);
+
+    BlkCompletion& completion = request.completion;
+    completion.status = cfg::blk_s_ok;
+    completion.status_addr = footer.addr + footer.len - 1;
+    completion.written = 1;
+
+    for (size_t i = 1; i < chain.size(); i++)
+    {
+        uint64_t address = chain[i].addr;
+        uint32_t length = i + 1 == chain.size() ? chain[i].len - 1 : chain[i].len;
+        uint8_t* host = guest_ram(*cpu.dram_device, address, length);
+
+        if (host == nullptr)
+        {
+            completion.status = cfg::blk_s_ioerr;
+            request.segments.clear();
+
+            break;
+        }
+
+        if (length != 0)
+        {
+            request.segments.push_back({host, address - cpu.dram_device->base_addr, length});
+        }
+    }
+
+    return request;
+}
+
+void VirtioBlkDevice::access_disk(Cpu& cpu, BlkQueue& queue)
+{
+    if (!queue_ready(cpu, queue))
+    {
+        return;
+    }
+
+    if (queue.worker == nullptr)
+    {
+        queue.worker = std::make_unique<BlkWorker>(*this, *cpu.dram_device);
+    }
+
+    uint16_t idx = avail_idx(cpu, queue);
+
+    while (queue.last_avail != idx)
+    {
+        uint16_t head = avail_entry(cpu, queue, queue.last_avail);
+
+        queue.worker->submit(read_request(cpu, queue, head));
+        queue.last_avail++;
+    }
+}
+
+void VirtioBlkDevice::retire(Cpu& cpu, BlkQueue& queue)
+{
+    uint16_t old_idx = queue.used_idx;
+
+    for (const BlkCompletion& completion : queue.completed)
+    {
+        if (completion.status_addr != 0)
+        {
+            store_ring<uint8_t>(cpu, completion.status_addr, completion.status);
+        }
+
+        push_used(cpu, queue, completion.head, completion.written);
+    }
+
+    queue.completed.clear();
+
+    publish_used(cpu, queue, old_idx);
+}
+
+void VirtioBlkDevice::quiesce()
+{
+    for (BlkQueue& queue : queues)
+    {
+        if (queue.worker != nullptr)
+        {
+            queue.worker->wait_idle();
+            queue.worker->take_completed(queue.completed);
+        }
+    }
+}
+
+void VirtioBlkDevice::forget_worker()
+{
+    // Their threads are gone, destroying them would wait for those threads forever
+    for (BlkQueue& queue : queues)
+    {
+        queue.worker.release();
+    }
+}
+
+BlkWorker::BlkWorker(VirtioBlkDevice& device, RamDevice& ram)
+    : device(device), ram(ram), thread(&BlkWorker::run, this)
+{
+}
+
+BlkWorker::~BlkWorker()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+
+    wake.notify_all();
+    thread.join();
+}
+
+void BlkWorker::submit(BlkRequest request)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pending.push_back(std::move(request));
+        in_flight++;
+    }
+
+    wake.notify_one();
+}
+
+void BlkWorker::take_completed(std::vector<BlkCompletion>& completions)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    completions.insert(completions.end(), completed.begin(), completed.end());
+    completed.clear();
+}
+
+bool BlkWorker::busy()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    return in_flight != 0;
+}
+
+void BlkWorker::wait_idle()
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    idle.wait(guard, [this] { return in_flight == 0; });
+}
+
+void BlkWorker::run()
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (true)
+    {
+        wake.wait(guard, [this] { return quit || !pending.empty(); });
+
+        if (quit)
+        {
+            return;
+        }
+
+        BlkRequest request = std::move(pending.front());
+        pending.pop_front();
+
+        guard.unlock();
+        transfer(request);
+        guard.lock();
+
+        completed.push_back(request.completion);
+
+        if (--in_flight == 0)
+        {
+            idle.notify_all();
+        }
+    }
+}
+
+void BlkWorker::transfer(BlkRequest& request)
+{
+    BlkCompletion& completion = request.completion;
 
-        access_disk(cpu);
+    disk::Image& disk = device.disk;
 
-        queue_notify = cfg::queue_notify_reset;
+    if (completion.status != cfg::blk_s_ok)
+    {
+        return;
+    }
+
+    if (request.type == cfg::blk_t_flush)
+    {
+        if (!disk.flush())
+        {
+            completion.status = cfg::blk_s_ioerr;
+        }
+
+        return;
+    }
+
+    if (request.type != cfg::blk_t_in && request.type != cfg::blk_t_out)
+    {
+        completion.status = cfg::blk_s_unsupp;
+        return;
     }
 
-    ++clock;
+    // A restored disk has no file behind it, but the guest was told it is read only
+    bool read_only = disk.read_only() || (device.host_features[0] & cfg::blk_f_ro) != 0;
+
+    if (request.type == cfg::blk_t_out && read_only)
+    {
+        completion.status = cfg::blk_s_ioerr;
+        return;
+    }
+    uint64_t length = 0;
+
+    for (const BlkSegment& segment : request.segments)
+    {
+        length += segment.length;
+    }
+
+    if (request.sector > disk.size() / cfg::sector_size ||
+        length > disk.size() - request.sector * cfg::sector_size)
+    {
+        completion.status = cfg::blk_s_ioerr;
+        return;
+    }
+
+    uint64_t offset = request.sector * cfg::sector_size;
+
+    for (const BlkSegment& segment : request.segments)
+    {
+        if (request.type == cfg::blk_t_out)
+        {
+            if (!disk.write(offset, segment.host, segment.length))
+            {
+                completion.status = cfg::blk_s_ioerr;
+                return;
+            }
+        }
+        else
+        {
+            if (!disk.read(offset, segment.host, segment.length))
+            {
+                completion.status = cfg::blk_s_ioerr;
+                return;
+            }
+
+            ram.dirty.mark_range(segment.ram_offset, segment.length);
+            completion.written += segment.length;
+        }
+
+        offset += segment.length;
+    }
 }
 
-std::optional<uint32_t> VirtioBlkDevice::is_interrupting()
+void VirtioBlkDevice::tick(Cpu& cpu)
 {
-    if (isr & 0x1)
+    bool any_busy = false;
+
+    for (BlkQueue& queue : queues)
     {
-        return cfg::virtio_irqn;
+        // Only a notification or requests in flight get the device ticked, new requests are
+        // taken either way so the guest can batch them without notifying
+        access_disk(cpu, queue);
+
+        // Checked before taking, so a request finishing in between is still picked up next time
+        bool busy = queue.worker != nullptr && queue.worker->busy();
+
+        if (queue.worker != nullptr)
+        {
+            queue.worker->take_completed(queue.completed);
+        }
+
+        if (!queue.completed.empty())
+        {
+            retire(cpu, queue);
+        }
+
+        if (!busy && queue_ready(cpu, queue))
+        {
+            set_notifications(cpu, queue, true);
+
+            // Requests added before the guest saw that would otherwise wait for the next notify
+            access_disk(cpu, queue);
+            busy = queue.worker != nullptr && queue.worker->busy();
+        }
+
+        if (busy)
+        {
+            set_notifications(cpu, queue, false);
+            any_busy = true;
+        }
     }
 
-    return {};
+    if (any_busy)
+    {
+        cpu.bus.scheduler.schedule_in(this, cfg::disk_delay);
+    }
+
+    cpu.bus.set_irq_line(cfg::virtio_irqn, isr & 0x1);
 }
 
-uint64_t VirtioBlkDevice::get_base_address() const
+static void put_string(snapshot::Writer& writer, const std::string& value)
 {
-    return base_addr;
+    writer.put(static_cast<uint64_t>(value.size()));
+    writer.put_bytes(value.data(), value.size());
 }
 
-uint64_t VirtioBlkDevice::get_end_address() const
+static std::string get_string(snapshot::Reader& reader)
 {
-    return end_addr;
+    uint64_t size = 0;
+    reader.get(size);
+
+    if (size > PATH_MAX)
+    {
+        reader.fail();
+        return {};
+    }
+
+    std::string value(size, '\0');
+    reader.get_bytes(value.data(), size);
+
+    return value;
 }
 
-void VirtioBlkDevice::dump(std::ostream& stream) const
+void VirtioBlkDevice::save(snapshot::Writer& writer)
 {
+    save_transport(writer);
+
+    for (const BlkQueue& queue : queues)
+    {
+        save_queue(writer, queue);
+
+        writer.put(static_cast<uint64_t>(queue.completed.size()));
+
+        for (const BlkCompletion& completion : queue.completed)
+        {
+            writer.put(completion);
+        }
+    }
+
+    put_string(writer, disk.get_path());
+    put_string(writer, disk.get_overlay_path());
+    writer.put(disk.get_mode());
+
+    // The disk is opened again from its files, only the writes that did not reach them are kept
+    std::vector<uint64_t> pages = disk.dirty.take();
+
+    writer.put_pages(disk.data, writer.is_incremental() ? pages : disk.changed.get());
+}
+
+void VirtioBlkDevice::restore(snapshot::Reader& reader)
+{
+    restore_transport(reader);
+
+    for (BlkQueue& queue : queues)
+    {
+        restore_queue(reader, queue);
+
+        uint64_t completed_count = 0;
+        reader.get(completed_count);
+
+        if (!reader.good() || completed_count > cfg::virtqueue_max_size)
+        {
+            reader.fail();
+            return;
+        }
+
+        queue.completed.resize(completed_count);
+
+        for (BlkCompletion& completion : queue.completed)
+        {
+            reader.get(completion);
+        }
+    }
+
+    std::string path = get_string(reader);
+    std::string overlay_path = get_string(reader);
+    disk::Mode mode = disk::Mode::discard;
+    reader.get(mode);
+
+    snapshot::Reader::Sparse sparse = reader.get_sparse();
+
+    if (!reader.good())
+    {
+        return;
+    }
+
+    // A disk given on the command line is taken instead, as are the ones of a parent snapshot
+    if (!disk.is_open() &&
+        !disk.open(path.c_str(), mode, overlay_path.empty() ? nullptr : overlay_path.c_str()))
+    {
+        reader.fail();
+        return;
+    }
+
+    if (sparse.size != disk.size())
+    {
+        reader.fail();
+        return;
+    }
+
+    // The writes go wherever the disk's mode sends them
+    std::vector<uint8_t> buffer;
+
+    for (const auto& run : sparse.runs)
+    {
+        for (uint64_t done = 0; done < run.length; done += buffer.size())
+        {
+            buffer.assign(std::min<uint64_t>(run.length - done, SIZE_MIB(1)), 0);
+
+            if (!run.zero)
+            {
+                reader.read_at(buffer.data(), buffer.size(), run.file_offset + done);
+            }
+
+            if (!reader.good() || !disk.write(run.offset + done, buffer.data(), buffer.size()))
+            {
+                reader.fail();
+                return;
+            }
+        }
+    }
 }
 
 std::string_view VirtioBlkDevice::get_peripheral_name() const
@@ -0,0 +1,290 @@
+#include "virtio_net.hpp"
+#include "cpu.hpp"
+#include "helper.hpp"
+#include "ram.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace virtio
+{
+VirtioNetDevice::VirtioNetDevice() : MmioDevice(base_addr, cfg::virtio_net_irqn, cfg::net_dev)
+{
+    host_features[0] |= cfg::net_f_csum | cfg::net_f_guest_csum | cfg::net_f_mac |
+                        cfg::net_f_mrg_rxbuf | cfg::net_f_status;
+
+    set_mac(cfg::net_default_mac);
+
+    reset();
+}
+
+VirtioNetDevice::~VirtioNetDevice()
+{
+}
+
+void VirtioNetDevice::set_backend(std::unique_ptr<net::Backend> new_backend)
+{
+    backend = std::move(new_backend);
+
+    helper::store16(config.data() + cfg::net_config_status,
+                    backend != nullptr ? cfg::net_s_link_up : 0);
+}
+
+void VirtioNetDevice::set_mac(const std::array<uint8_t, 6>& mac)
+{
+    std::copy(mac.begin(), mac.end(), config.begin());
+}
+
+Queue* VirtioNetDevice::get_queue(uint32_t index)
+{
+    return index < queues.size() ? &queues[index] : nullptr;
+}
+
+std::span<uint8_t> VirtioNetDevice::get_config()
+{
+    return config;
+}
+
+void VirtioNetDevice::reset()
+{
+    MmioDevice::reset();
+
+    rx_pending = false;
+}
+
+uint32_t VirtioNetDevice::header_size() const
+{
+    bool version_1 = (guest_features[1] & cfg::f_version_1) != 0;
+
+    return version_1 || negotiated(cfg::net_f_mrg_rxbuf) ? sizeof(net::Header)
+                                                         : cfg::net_header_legacy_size;
+}
+
+void VirtioNetDevice::transmit(Cpu& cpu)
+{
+    Queue& queue = queues[cfg::net_tx_queue];
+
+    if (!queue_ready(cpu, queue))
+    {
+        return;
+    }
+
+    uint16_t old_idx = queue.used_idx;
+    uint16_t idx = avail_idx(cpu, queue);
+
+    while (queue.last_avail != idx)
+    {
+        uint16_t head = avail_entry(cpu, queue, queue.last_avail++);
+
+        tx_frame.clear();
+
+        // The header and the frame, in as many pieces as the guest likes
+        for (const VirtqDesc& desc : read_chain(cpu, queue, head))
+        {
+            uint8_t* host = guest_ram(*cpu.dram_device, desc.addr, desc.len);
+
+            if (host == nullptr || (desc.flags & cfg::desc_f_write) != 0 ||
+                tx_frame.size() + desc.len > header_size() + net::frame_max)
+            {
+                tx_frame.clear();
+                break;
+            }
+
+            tx_frame.insert(tx_frame.end(), host, host + desc.len);
+        }
+
+        if (backend != nullptr && tx_frame.size() > header_size())
+        {
+            net::Header header = {};
+            memcpy(&header, tx_frame.data(), header_size());
+            header.num_buffers = 0;
+
+            backend->send(header, std::span(tx_frame).subspan(header_size()));
+        }
+
+        push_used(cpu, queue, head, 0);
+    }
+
+    if (queue.used_idx != old_idx)
+    {
+        publish_used(cpu, queue, old_idx);
+    }
+
+    set_notifications(cpu, queue, true);
+}
+
+void VirtioNetDevice::receive(Cpu& cpu)
+{
+    Queue& queue = queues[cfg::net_rx_queue];
+
+    if (!queue_ready(cpu, queue) || backend == nullptr)
+    {
+        return;
+    }
+
+    uint16_t old_idx = queue.used_idx;
+
+    // At most a ring's worth per poll, a busy backend could keep the hart here otherwise
+    for (uint32_t count = 0; count < queue.vq.num; count++)
+    {
+        if (!rx_pending && !backend->receive(rx_packet))
+        {
+            break;
+        }
+
+        rx_pending = true;
+
+        if (!deliver(cpu, rx_packet))
+        {
+            break;
+        }
+
+        rx_pending = false;
+    }
+
+    if (queue.used_idx != old_idx)
+    {
+        publish_used(cpu, queue, old_idx);
+    }
+
+    // New buffers are seen when polling, the guest need not tell
+    set_notifications(cpu, queue, false);
+}
+
+bool VirtioNetDevice::deliver(Cpu& cpu, net::Packet& packet)
+{
+    Queue& queue = queues[cfg::net_rx_queue];
+    RamDevice& ram = *cpu.dram_device;
+
+    bool mergeable = negotiated(cfg::net_f_mrg_rxbuf);
+    uint64_t total = header_size() + packet.frame.size();
+    uint64_t room = 0;
+
+    uint16_t idx = avail_idx(cpu, queue);
+    uint16_t position = queue.last_avail;
+
+    rx_segments.clear();
+    rx_heads.clear();
+
+    // Chains are only taken once the whole packet fits, without mergeable buffers it has to fit
+    // into one
+    while (room < total && (mergeable || rx_heads.empty()))
+    {
+        if (position == idx)
+        {
+            return false;
+        }
+
+        uint16_t head = avail_entry(cpu, queue, position++);
+
+        for (const VirtqDesc& desc : read_chain(cpu, queue, head))
+        {
+            uint8_t* host = guest_ram(ram, desc.addr, desc.len);
+
+            if (host != nullptr && (desc.flags & cfg::desc_f_write) != 0 && desc.len != 0)
+            {
+                rx_segments.push_back({host, desc.addr - ram.base_addr, desc.len,
+                                       static_cast<uint32_t>(rx_heads.size())});
+                room += desc.len;
+            }
+        }
+
+        rx_heads.push_back(head);
+    }
+
+    if (room < total)
+    {
+        return true;
+    }
+
+    net::Header header = packet.header;
+
+    // A guest that does not take partial checksums gets complete ones and no other flags
+    if (!negotiated(cfg::net_f_guest_csum))
+    {
+        net::complete_checksum(header, packet.frame);
+        header.flags = 0;
+    }
+
+    header.num_buffers = rx_heads.size();
+
+    std::array<uint8_t, sizeof(net::Header)> header_bytes;
+    memcpy(header_bytes.data(), &header, sizeof(header));
+
+    std::vector<uint32_t> written(rx_heads.size());
+    uint64_t offset = 0;
+
+    for (const NetSegment& segment : rx_segments)
+    {
+        uint32_t done = 0;
+
+        while (done < segment.length && offset < total)
+        {
+            bool in_header = offset < header_size();
+            const uint8_t* source = in_header ? header_bytes.data() + offset
+                                              : packet.frame.data() + offset - header_size();
+            uint64_t available = in_header ? header_size() - offset : total - offset;
+            uint64_t length = std::min<uint64_t>(available, segment.length - done);
+
+            memcpy(segment.host + done, source, length);
+
+            done += length;
+            offset += length;
+        }
+
+        ram.dirty.mark_range(segment.ram_offset, done);
+        written[segment.buffer] += done;
+    }
+
+    for (size_t i = 0; i < rx_heads.size(); i++)
+    {
+        push_used(cpu, queue, rx_heads[i], written[i]);
+    }
+
+    queue.last_avail = position;
+
+    return true;
+}
+
+void VirtioNetDevice::tick(Cpu& cpu)
+{
+    // Nothing is polled before the driver is done setting up, its first notify starts it
+    if ((status & 0x4) == 0)
+    {
+        return;
+    }
+
+    transmit(cpu);
+    receive(cpu);
+
+    cpu.bus.scheduler.schedule_in(this, cfg::net_delay);
+    cpu.bus.set_irq_line(irqn, isr & 0x1);
+}
+
+void VirtioNetDevice::save(snapshot::Writer& writer)
+{
+    // Frames in flight on the host side are lost, like on a real network
+    save_transport(writer);
+
+    for (const Queue& queue : queues)
+    {
+        save_queue(writer, queue);
+    }
+}
+
+void VirtioNetDevice::restore(snapshot::Reader& reader)
+{
+    restore_transport(reader);
+
+    for (Queue& queue : queues)
+    {
+        restore_queue(reader, queue);
+    }
+
+    rx_pending = false;
+}
+
+std::string_view VirtioNetDevice::get_peripheral_name() const
+{
+    return peripheral_name;
+}
+} // namespace virtio
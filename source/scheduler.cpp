@@ -0,0 +1,56 @@
+#include "scheduler.hpp"
+#include "bus.hpp"
+#include <algorithm>
+
+namespace scheduler
+{
+
+void Scheduler::schedule(BusDevice* device, uint64_t deadline)
+{
+    auto event = std::find_if(events.begin(), events.end(),
+                              [device](const Event& event) { return event.device == device; });
+
+    if (event == events.end())
+    {
+        events.push_back({device, deadline});
+    }
+    else
+    {
+        event->deadline = std::min(event->deadline, deadline);
+    }
+
+    next_deadline = std::min(next_deadline, deadline);
+}
+
+void Scheduler::schedule_in(BusDevice* device, uint64_t cycles)
+{
+    schedule(device, now + cycles);
+}
+
+bool Scheduler::due(uint64_t cycle)
+{
+    now = cycle;
+
+    return cycle >= next_deadline;
+}
+
+void Scheduler::run(Cpu& cpu)
+{
+    // Devices reschedule themselves from tick, so the deadline is cleared beforehand
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        if (events[i].deadline <= now)
+        {
+            events[i].deadline = never;
+            events[i].device->tick(cpu);
+        }
+    }
+
+    next_deadline = never;
+
+    for (const Event& event : events)
+    {
+        next_deadline = std::min(next_deadline, event.deadline);
+    }
+}
+} // namespace scheduler
@@ -0,0 +1,693 @@
+#include "snapshot.hpp"
+#include "cpu.hpp"
+#include "helper.hpp"
+#include <array>
+#include <climits>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fmt/core.h>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+namespace snapshot
+{
+
+constexpr std::array<char, 8> magic = {'R', 'V', '6', '4', 'S', 'N', 'A', 'P'};
+constexpr uint32_t version = 9;
+
+// Bounds the parent chain, which also ends parents that point back at their children
+constexpr uint64_t chain_limit = 1ULL << 16;
+
+constexpr uint64_t buffer_limit = SIZE_MIB(1);
+
+struct Header
+{
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t hart_count;
+    uint64_t ram_size;
+    uint64_t has_virtio_blk;
+    uint64_t has_virtio_net;
+
+    // Followed by the file name of the parent, in the same directory, for incremental ones
+    uint64_t parent_length;
+};
+
+static bool all_zero(const uint8_t* data, uint64_t length)
+{
+    return data[0] == 0 && memcmp(data, data + 1, length - 1) == 0;
+}
+
+void DirtyPages::resize(uint64_t size)
+{
+    word_count = ((size + page_size - 1) / page_size + 63) / 64;
+    words = std::make_unique<std::atomic<uint64_t>[]>(word_count);
+}
+
+void DirtyPages::mark_range(uint64_t offset, uint64_t length)
+{
+    for (uint64_t page = offset & ~(page_size - 1); page < offset + length; page += page_size)
+    {
+        mark(page);
+    }
+}
+
+std::vector<uint64_t> DirtyPages::take()
+{
+    std::vector<uint64_t> taken(word_count);
+
+    for (uint64_t i = 0; i < word_count; i++)
+    {
+        taken[i] = words[i].exchange(0, std::memory_order_relaxed);
+    }
+
+    return taken;
+}
+
+std::vector<uint64_t> DirtyPages::get() const
+{
+    std::vector<uint64_t> pages(word_count);
+
+    for (uint64_t i = 0; i < word_count; i++)
+    {
+        pages[i] = words[i].load(std::memory_order_relaxed);
+    }
+
+    return pages;
+}
+
+Writer::Writer(int fd, bool incremental) : fd(fd), incremental(incremental)
+{
+}
+
+void Writer::put_bytes(const void* data, uint64_t length)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    buffer.insert(buffer.end(), bytes, bytes + length);
+
+    if (buffer.size() >= buffer_limit)
+    {
+        flush();
+    }
+}
+
+void Writer::put_sparse(std::span<const uint8_t> data, DirtyPages& dirty)
+{
+    std::vector<uint64_t> dirty_pages = dirty.take();
+
+    put_runs(data, incremental ? &dirty_pages : nullptr);
+}
+
+void Writer::put_pages(std::span<const uint8_t> data, const std::vector<uint64_t>& pages)
+{
+    put_runs(data, &pages);
+}
+
+bool Writer::is_incremental() const
+{
+    return incremental;
+}
+
+void Writer::put_runs(std::span<const uint8_t> data, const std::vector<uint64_t>* pages)
+{
+    uint64_t granule = std::max<uint64_t>(sysconf(_SC_PAGESIZE), DirtyPages::page_size);
+    bool complete = pages == nullptr;
+
+    auto is_listed = [pages](uint64_t offset, uint64_t length)
+    {
+        for (uint64_t page = offset / DirtyPages::page_size;
+             page * DirtyPages::page_size < offset + length; page++)
+        {
+            if (((*pages)[page / 64] >> (page % 64)) & 1)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    };
+
+    struct Run
+    {
+        uint64_t offset;
+        uint64_t length;
+        uint64_t zero;
+    };
+
+    std::vector<Run> runs;
+
+    for (uint64_t offset = 0; offset < data.size(); offset += granule)
+    {
+        uint64_t length = std::min(granule, data.size() - offset);
+
+        if (!complete && !is_listed(offset, length))
+        {
+            continue;
+        }
+
+        // Pages that were cleared since the parent still have to be cleared on restore
+        bool zero = all_zero(data.data() + offset, length);
+
+        if (zero && complete)
+        {
+            continue;
+        }
+
+        if (!runs.empty() && runs.back().offset + runs.back().length == offset &&
+            runs.back().zero == zero)
+        {
+            runs.back().length += length;
+        }
+        else
+        {
+            runs.push_back({offset, length, zero});
+        }
+    }
+
+    put(static_cast<uint64_t>(data.size()));
+    put(granule);
+    put(static_cast<uint64_t>(complete));
+    put(static_cast<uint64_t>(runs.size()));
+
+    for (const Run& run : runs)
+    {
+        put(run);
+    }
+
+    flush();
+
+    std::vector<uint8_t> padding(granule, 0);
+
+    write_out(padding.data(), (granule - position % granule) % granule);
+
+    for (const Run& run : runs)
+    {
+        if (!run.zero)
+        {
+            write_out(data.data() + run.offset, run.length);
+            write_out(padding.data(), (granule - run.length % granule) % granule);
+        }
+    }
+}
+
+bool Writer::finish()
+{
+    flush();
+
+    return !failed;
+}
+
+void Writer::flush()
+{
+    write_out(buffer.data(), buffer.size());
+    buffer.clear();
+}
+
+void Writer::write_out(const void* data, uint64_t length)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t done = 0;
+
+    while (!failed && done < length)
+    {
+        ssize_t count = write(fd, bytes + done, length - done);
+
+        if (count <= 0)
+        {
+            failed = true;
+        }
+        else
+        {
+            done += count;
+        }
+    }
+
+    position += length;
+}
+
+Reader::Reader(int fd) : fd(fd)
+{
+}
+
+void Reader::get_bytes(void* data, uint64_t length)
+{
+    read_at(data, length, position);
+    position += length;
+}
+
+Reader::Sparse Reader::get_sparse()
+{
+    Sparse sparse = {};
+    uint64_t granule = 0;
+    uint64_t complete = 0;
+    uint64_t run_count = 0;
+
+    get(sparse.size);
+    get(granule);
+    get(complete);
+    get(run_count);
+
+    sparse.complete = complete != 0;
+
+    if (!good() || granule == 0 || (granule & (granule - 1)) != 0 ||
+        run_count > sparse.size / granule + 1)
+    {
+        fail();
+        return {};
+    }
+
+    for (uint64_t i = 0; i < run_count; i++)
+    {
+        Run run = {};
+        uint64_t zero = 0;
+
+        get(run.offset);
+        get(run.length);
+        get(zero);
+
+        run.zero = zero != 0;
+
+        if (run.offset > sparse.size || run.length > sparse.size - run.offset)
+        {
+            fail();
+            return {};
+        }
+
+        sparse.runs.push_back(run);
+    }
+
+    position = (position + granule - 1) & ~(granule - 1);
+
+    for (Run& run : sparse.runs)
+    {
+        if (!run.zero)
+        {
+            run.file_offset = position;
+            position += (run.length + granule - 1) & ~(granule - 1);
+        }
+    }
+
+    return sparse;
+}
+
+void Reader::read_at(void* data, uint64_t length, uint64_t file_offset)
+{
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    uint64_t done = 0;
+
+    while (!failed && done < length)
+    {
+        ssize_t count = pread(fd, bytes + done, length - done, file_offset + done);
+
+        if (count <= 0)
+        {
+            failed = true;
+        }
+        else
+        {
+            done += count;
+        }
+    }
+
+    if (failed)
+    {
+        memset(bytes, 0, length);
+    }
+}
+
+int Reader::get_fd() const
+{
+    return fd;
+}
+
+void Reader::fail()
+{
+    failed = true;
+}
+
+bool Reader::good() const
+{
+    return !failed;
+}
+
+static void put_tag(Writer& writer, std::string_view name)
+{
+    writer.put(static_cast<uint64_t>(name.size()));
+    writer.put_bytes(name.data(), name.size());
+}
+
+static bool check_tag(Reader& reader, std::string_view name)
+{
+    uint64_t size = 0;
+
+    reader.get(size);
+
+    if (size != name.size())
+    {
+        return false;
+    }
+
+    std::string tag(size, '\0');
+    reader.get_bytes(tag.data(), size);
+
+    return reader.good() && tag == name;
+}
+
+static bool read_header(Reader& reader, Header& header, std::string& parent)
+{
+    reader.get(header);
+
+    if (!reader.good() || header.magic != magic || header.version != version ||
+        header.parent_length > PATH_MAX)
+    {
+        return false;
+    }
+
+    parent.resize(header.parent_length);
+    reader.get_bytes(parent.data(), parent.size());
+
+    return reader.good();
+}
+
+std::optional<Info> read_info(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return {};
+    }
+
+    Reader reader(fd);
+    Header header;
+    std::string parent;
+    bool valid = read_header(reader, header, parent);
+
+    close(fd);
+
+    if (!valid)
+    {
+        return {};
+    }
+
+    return Info{header.ram_size, header.hart_count, header.has_virtio_blk != 0,
+                header.has_virtio_net != 0};
+}
+
+bool save(const char* path, std::span<Cpu* const> harts, const char* parent)
+{
+    // Written next to the target first, so a failed save never leaves half a snapshot behind
+    std::string temp_path = std::string(path) + ".tmp";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    Cpu& boot_hart = *harts[0];
+    Writer writer(fd, parent != nullptr);
+
+    // Disk requests in flight would change RAM and the disk while they are written
+    if (boot_hart.virtio_blk_device != nullptr)
+    {
+        boot_hart.virtio_blk_device->quiesce();
+    }
+    std::string parent_name =
+        parent != nullptr ? std::filesystem::path(parent).filename().string() : "";
+
+    writer.put(Header{magic, version, static_cast<uint32_t>(harts.size()),
+                      boot_hart.dram_device->data.size(), boot_hart.virtio_blk_device != nullptr,
+                      boot_hart.virtio_net_device != nullptr, parent_name.size()});
+    writer.put_bytes(parent_name.data(), parent_name.size());
+
+    for (Cpu* hart : harts)
+    {
+        hart->save(writer);
+    }
+
+    writer.put(boot_hart.bus.get_irq_lines());
+
+    for (BusDevice* device : boot_hart.bus.get_device_list())
+    {
+        put_tag(writer, device->get_peripheral_name());
+        device->save(writer);
+    }
+
+    // Stores through cached translations skip the RAM device, dropping them makes the next
+    // store to every page mark it again
+    for (Cpu* hart : harts)
+    {
+        hart->mmu.flush_tlb();
+    }
+
+    // The file has to be on the disk before it replaces the last one, a crash could leave an
+    // empty file under the name otherwise
+    bool saved = writer.finish() && fsync(fd) == 0;
+    saved = close(fd) == 0 && saved && rename(temp_path.c_str(), path) == 0;
+
+    if (!saved)
+    {
+        unlink(temp_path.c_str());
+    }
+
+    return saved;
+}
+
+static bool restore_file(const std::string& path, std::span<Cpu* const> harts)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    Cpu& boot_hart = *harts[0];
+    Reader reader(fd);
+    Header header;
+    std::string parent;
+
+    if (!read_header(reader, header, parent) || header.hart_count != harts.size() ||
+        header.ram_size != boot_hart.dram_device->data.size() ||
+        (header.has_virtio_blk != 0) != (boot_hart.virtio_blk_device != nullptr) ||
+        (header.has_virtio_net != 0) != (boot_hart.virtio_net_device != nullptr))
+    {
+        close(fd);
+        return false;
+    }
+
+    for (Cpu* hart : harts)
+    {
+        hart->restore(reader);
+    }
+
+    uint64_t irq_lines = 0;
+    reader.get(irq_lines);
+
+    for (BusDevice* device : boot_hart.bus.get_device_list())
+    {
+        if (!check_tag(reader, device->get_peripheral_name()))
+        {
+            reader.fail();
+            break;
+        }
+
+        device->restore(reader);
+    }
+
+    // Mapped RAM keeps the file open on its own
+    close(fd);
+
+    if (!reader.good())
+    {
+        return false;
+    }
+
+    boot_hart.bus.restore_irq_lines(irq_lines);
+
+    return true;
+}
+
+bool restore(const char* path, std::span<Cpu* const> harts)
+{
+    // Parents are applied first, every file carries the whole hart and device state so only
+    // the memory adds up
+    std::vector<std::string> chain = {path};
+
+    while (chain.size() < chain_limit)
+    {
+        int fd = open(chain.back().c_str(), O_RDONLY);
+
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        Reader reader(fd);
+        Header header;
+        std::string parent;
+        bool valid = read_header(reader, header, parent);
+
+        close(fd);
+
+        if (!valid)
+        {
+            return false;
+        }
+
+        if (parent.empty())
+        {
+            break;
+        }
+
+        chain.push_back((std::filesystem::path(chain.back()).parent_path() / parent).string());
+    }
+
+    if (chain.size() == chain_limit)
+    {
+        return false;
+    }
+
+    Cpu& boot_hart = *harts[0];
+
+    if (boot_hart.virtio_blk_device != nullptr)
+    {
+        boot_hart.virtio_blk_device->quiesce();
+    }
+
+    for (auto file = chain.rbegin(); file != chain.rend(); file++)
+    {
+        if (!restore_file(*file, harts))
+        {
+            return false;
+        }
+    }
+
+    // Every device is ticked right away, that also serves requests the guest made just
+    // before the snapshot
+    for (BusDevice* device : boot_hart.bus.get_device_list())
+    {
+        boot_hart.bus.scheduler.schedule(device, 0);
+    }
+
+    return true;
+}
+
+std::atomic<bool> save_requested = false;
+
+static std::string target_path;
+static std::vector<Cpu*> target_harts;
+static uint64_t target_interval = 0;
+
+// The last snapshot saved, the next one only carries what changed since
+static std::string last_saved;
+static uint64_t saved_count = 0;
+
+static std::mutex stop_lock;
+static std::condition_variable resumed;
+static uint64_t stopped_harts = 0;
+static uint64_t generation = 0;
+
+static void start_interval()
+{
+    if (target_interval == 0)
+    {
+        return;
+    }
+
+    std::thread(
+        [interval_seconds = target_interval]
+        {
+            while (true)
+            {
+                std::this_thread::sleep_for(std::chrono::seconds(interval_seconds));
+                request();
+            }
+        })
+        .detach();
+}
+
+void enable(const char* path, std::vector<Cpu*> harts, uint64_t interval_seconds)
+{
+    target_path = path;
+    target_harts = std::move(harts);
+    target_interval = interval_seconds;
+
+#ifdef SIGUSR1
+    std::signal(SIGUSR1, [](int) { request(); });
+#endif
+
+    start_interval();
+}
+
+void forked()
+{
+    if (target_path.empty())
+    {
+        return;
+    }
+
+    target_path = fmt::format("{}.{}", target_path, getpid());
+    last_saved.clear();
+    saved_count = 0;
+    stopped_harts = 0;
+
+    // The timer thread stayed with the parent
+    start_interval();
+}
+
+void request()
+{
+    save_requested.store(true, std::memory_order_relaxed);
+}
+
+void stop([[maybe_unused]] Cpu& cpu)
+{
+    std::unique_lock<std::mutex> lock(stop_lock);
+
+    if (target_path.empty())
+    {
+        save_requested = false;
+        return;
+    }
+
+    if (++stopped_harts < target_harts.size())
+    {
+        uint64_t stopped_generation = generation;
+        resumed.wait(lock, [stopped_generation] { return generation != stopped_generation; });
+        return;
+    }
+
+    std::string path =
+        saved_count == 0 ? target_path : fmt::format("{}.{}", target_path, saved_count);
+
+    if (save(path.c_str(), target_harts, last_saved.empty() ? nullptr : last_saved.c_str()))
+    {
+        std::cerr << fmt::format("\nSnapshot saved to {}\n", path);
+
+        last_saved = path;
+        saved_count++;
+    }
+    else
+    {
+        std::cerr << fmt::format("\nFailed to save snapshot to {}\n", path);
+
+        // Dirty pages were taken all the same, so the next one has to be complete
+        last_saved.clear();
+    }
+
+    save_requested = false;
+    stopped_harts = 0;
+    generation++;
+
+    resumed.notify_all();
+}
+} // namespace snapshot
@@ -2,11 +2,15 @@
 #include "cpu.hpp"
 #include "csrtypeinsn.hpp"
 #include "decoder.hpp"
+#include "disk.hpp"
+#include "elf.hpp"
 #include "ram.hpp"
 
 #include "clint.hpp"
 #include "helper.hpp"
 #include "plic.hpp"
+#include "snapshot.hpp"
+#include <algorithm>
 #include <exception>
 #include <filesystem>
 #include <fmt/core.h>
@@ -15,6 +19,7 @@
 #include <sstream>
 #include <string.h>
 #include <string_view>
+#include <unistd.h>
 #include <utility>
 
 #if __APPLE__
@@ -103,13 +108,60 @@ bool is_debugger_present()
 #define TO_HOST_OFFSET (0x1000U)
 #define TO_HOST_OFFSET_C (0x3000U)
 
+static bool block_mode = false;
+static bool jit_mode = false;
+
 bool test_binary(const std::filesystem::directory_entry& binary_path)
 {
-    RamDevice dram =
-        RamDevice(0x80000000U, SIZE_KIB(64), helper::load_file(binary_path.path().c_str()));
+    RamDevice dram = RamDevice(0x80000000U, SIZE_KIB(64));
+
+    uint64_t tohost_offset = TO_HOST_OFFSET;
+    uint64_t tohost_offset_c = TO_HOST_OFFSET_C;
+    std::optional<elf::Image> image;
+
+    if (binary_path.path().extension() == ".elf")
+    {
+        image = elf::load(binary_path.path().c_str(), dram, 0);
+
+        if (!image)
+        {
+            std::cerr << fmt::format("Failed to load {}\n", binary_path.path().c_str());
+            return false;
+        }
+
+        auto tohost = std::find_if(image->symbols.begin(), image->symbols.end(),
+                                   [](auto& symbol) { return symbol.name == "tohost"; });
+
+        if (tohost != image->symbols.end())
+        {
+            tohost_offset = tohost->address - dram.get_base_address();
+            tohost_offset_c = tohost_offset;
+        }
+    }
+    else
+    {
+        dram.set_data(helper::load_file(binary_path.path().c_str()));
+    }
 
     Cpu cpu = Cpu(&dram);
 
+    elf::SymbolTable symbols;
+
+    if (image)
+    {
+        cpu.pc = image->entry;
+
+        symbols.add(image->symbols);
+        cpu.symbols = &symbols;
+    }
+
+    if (jit_mode)
+    {
+        cpu.jit.init();
+        // Compile every block on first use so the tests exercise the generated code
+        cpu.jit.hot_threshold = 1;
+    }
+
     std::stringstream ss;
 
     uint64_t start = helper::get_milliseconds();
@@ -121,9 +173,16 @@ bool test_binary(const std::filesystem::directory_entry& binary_path)
 
     while (!timeout)
     {
-        cpu.loop(ss);
+        if (block_mode)
+        {
+            cpu.block_loop(ss);
+        }
+        else
+        {
+            cpu.loop(ss);
+        }
 
-        if (dram.data[TO_HOST_OFFSET] != 0 || dram.data[TO_HOST_OFFSET_C] != 0) [[unlikely]]
+        if (dram.data[tohost_offset] != 0 || dram.data[tohost_offset_c] != 0) [[unlikely]]
         {
             a0 = cpu.regs[Cpu::reg_abi_name::a0];
             break;
@@ -198,7 +257,8 @@ bool test_bins(std::string directory)
 
     for (const auto& entry : std::filesystem::directory_iterator(directory))
     {
-        if (std::filesystem::is_regular_file(entry) && entry.path().extension() == ".bin")
+        if (std::filesystem::is_regular_file(entry) &&
+            (entry.path().extension() == ".bin" || entry.path().extension() == ".elf"))
         {
             total += 1;
 
@@ -225,12 +285,203 @@ bool test_bins(std::string directory)
     return failed == 0;
 }
 
+// Fills every other page and a run long enough to be mapped on restore, the rest stays zero
+void fill_ram(RamDevice& dram, uint8_t seed)
+{
+    for (uint64_t offset = 0; offset < SIZE_MIB(1); offset += 2 * snapshot::DirtyPages::page_size)
+    {
+        memset(dram.data.data() + offset, seed + offset / snapshot::DirtyPages::page_size,
+               snapshot::DirtyPages::page_size);
+    }
+
+    for (uint64_t offset = SIZE_MIB(2); offset < SIZE_MIB(4); offset++)
+    {
+        dram.data[offset] = seed + offset / 7;
+    }
+
+    dram.dirty.mark_range(0, dram.data.size());
+}
+
+bool same_state(Cpu& expected, Cpu& actual)
+{
+    return expected.regs == actual.regs && expected.pc == actual.pc &&
+           std::ranges::equal(expected.dram_device->data, actual.dram_device->data);
+}
+
+bool test_snapshot_restore(const std::filesystem::path& directory)
+{
+    RamDevice dram = RamDevice(0x80000000U, SIZE_MIB(8));
+    Cpu cpu = Cpu(&dram);
+    Cpu* harts[] = {&cpu};
+
+    fill_ram(dram, 1);
+    cpu.pc = 0x80001234U;
+    cpu.regs[Cpu::reg_abi_name::a0] = 0x1122334455667788U;
+
+    std::string path = (directory / "ram.snap").string();
+
+    if (!snapshot::save(path.c_str(), harts))
+    {
+        return false;
+    }
+
+    // What the RAM held before has to give way to the snapshot, zero pages included
+    RamDevice restored_dram = RamDevice(0x80000000U, SIZE_MIB(8));
+    Cpu restored = Cpu(&restored_dram);
+    Cpu* restored_harts[] = {&restored};
+
+    memset(restored_dram.data.data(), 0xff, restored_dram.data.size());
+
+    return snapshot::restore(path.c_str(), restored_harts) && same_state(cpu, restored);
+}
+
+bool test_incremental_snapshot(const std::filesystem::path& directory)
+{
+    RamDevice dram = RamDevice(0x80000000U, SIZE_MIB(8));
+    Cpu cpu = Cpu(&dram);
+    Cpu* harts[] = {&cpu};
+
+    fill_ram(dram, 2);
+
+    std::string parent_path = (directory / "chain.snap").string();
+    std::string path = parent_path + ".1";
+
+    if (!snapshot::save(parent_path.c_str(), harts))
+    {
+        return false;
+    }
+
+    // A page that goes back to zero, one that was zero and part of the long run
+    memset(dram.data.data(), 0, snapshot::DirtyPages::page_size);
+    memset(dram.data.data() + snapshot::DirtyPages::page_size, 0x5a,
+           snapshot::DirtyPages::page_size);
+    memset(dram.data.data() + SIZE_MIB(3), 0xa5, SIZE_MIB(1) + 100);
+
+    dram.dirty.mark_range(0, 2 * snapshot::DirtyPages::page_size);
+    dram.dirty.mark_range(SIZE_MIB(3), SIZE_MIB(1) + 100);
+    cpu.pc = 0x80005678U;
+
+    if (!snapshot::save(path.c_str(), harts, parent_path.c_str()) ||
+        std::filesystem::file_size(path) >= std::filesystem::file_size(parent_path))
+    {
+        return false;
+    }
+
+    RamDevice restored_dram = RamDevice(0x80000000U, SIZE_MIB(8));
+    Cpu restored = Cpu(&restored_dram);
+    Cpu* restored_harts[] = {&restored};
+
+    return snapshot::restore(path.c_str(), restored_harts) && same_state(cpu, restored);
+}
+
+bool test_overlay_reopen(const std::filesystem::path& directory)
+{
+    std::string image_path = (directory / "disk.img").string();
+    std::string overlay_path = (directory / "disk.ovl").string();
+
+    // The last block is partial
+    std::vector<uint8_t> image(3 * disk::overlay_block_size + 1234);
+
+    for (size_t offset = 0; offset < image.size(); offset++)
+    {
+        image[offset] = offset * 13 + offset / 4096;
+    }
+
+    std::ofstream(image_path, std::ios::binary)
+        .write(reinterpret_cast<const char*>(image.data()), image.size());
+
+    std::vector<uint8_t> expected = image;
+    std::vector<uint8_t> written(disk::overlay_block_size, 0x3c);
+
+    {
+        disk::Image disk;
+
+        // Across the first two blocks and up to the end of the disk
+        uint64_t offsets[] = {disk::overlay_block_size / 2, image.size() - 100};
+        uint64_t lengths[] = {disk::overlay_block_size, 100};
+
+        if (!disk.open(image_path.c_str(), disk::Mode::write_back, overlay_path.c_str()))
+        {
+            return false;
+        }
+
+        for (int write = 0; write < 2; write++)
+        {
+            if (!disk.write(offsets[write], written.data(), lengths[write]))
+            {
+                return false;
+            }
+
+            std::copy_n(written.begin(), lengths[write], expected.begin() + offsets[write]);
+        }
+
+        if (!disk.flush())
+        {
+            return false;
+        }
+    }
+
+    disk::Image disk;
+    std::vector<uint8_t> contents(image.size());
+
+    return helper::load_file(image_path.c_str()) == image &&
+           disk.open(image_path.c_str(), disk::Mode::read_only, overlay_path.c_str()) &&
+           disk.read(0, contents.data(), contents.size()) && contents == expected;
+}
+
+bool test_host(const std::filesystem::path& directory)
+{
+    std::pair<const char*, bool (*)(const std::filesystem::path&)> tests[] = {
+        {"snapshot_restore", test_snapshot_restore},
+        {"incremental_snapshot", test_incremental_snapshot},
+        {"overlay_reopen", test_overlay_reopen},
+    };
+
+    int failed = 0;
+
+    for (const auto& [name, test] : tests)
+    {
+        std::cout << fmt::format("Performing test: {}\n", name);
+
+        if (test(directory))
+        {
+            std::cout << "Pass\n";
+        }
+        else
+        {
+            std::cout << "Fail\n";
+            failed += 1;
+        }
+    }
+
+    return failed == 0;
+}
+
 int main(int argc, char* argv[])
 {
-    if (argc != 2)
+    if (argc != 2 && argc != 3)
     {
         return 1;
     }
 
+    // Tests of the emulator itself rather than guest binaries, with files in a scratch directory
+    if (std::string_view(argv[1]) == "host")
+    {
+        std::filesystem::path directory =
+            std::filesystem::temp_directory_path() / fmt::format("test_cpu_{}", getpid());
+        std::filesystem::create_directories(directory);
+
+        bool passed = test_host(directory);
+        std::filesystem::remove_all(directory);
+
+        return !passed;
+    }
+
+    if (argc == 3)
+    {
+        jit_mode = std::string_view(argv[2]) == "jit";
+        block_mode = jit_mode || std::string_view(argv[2]) == "block";
+    }
+
     return !test_bins(argv[1]);
 }